@@ -0,0 +1,128 @@
+#include <unistd.h>
+
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+
+#include "benchmark/benchmark.h"
+#include "include/ldapgroups.hpp"
+#include "include/ldapquery.hpp"
+
+#define LEVELS 100
+#define GROUPS_PER_LEVEL 100
+#define PARENTS 2
+#define CACHE_FILE "bench_ldapgroups_cache"
+
+namespace {
+
+// Synthetic directory of LEVELS * GROUPS_PER_LEVEL groups, every group is
+// nested in PARENTS random groups of the level above it.
+class Directory {
+ public:
+  Directory() {
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> pick(0, GROUPS_PER_LEVEL - 1);
+    for (int level = 0; level < LEVELS - 1; ++level) {
+      for (int i = 0; i < GROUPS_PER_LEVEL; ++i) {
+        std::set<std::string> &parents = groups[dn(level, i)];
+        for (int j = 0; j < PARENTS; ++j) {
+          parents.insert(dn(level + 1, pick(random)));
+        }
+      }
+    }
+    for (int i = 0; i < GROUPS_PER_LEVEL; ++i) {
+      groups[dn(LEVELS - 1, i)];
+    }
+  }
+
+  static std::string dn(int level, int i) {
+    return "cn=group-" + std::to_string(level) + "-" + std::to_string(i) +
+           ",ou=groups,dc=example,dc=org";
+  }
+
+  GroupGraph::Fetch fetch() {
+    return [this](const std::string &dn, std::set<std::string> *parents) {
+      ++fetches;
+      auto node = groups.find(dn);
+      if (node == groups.end()) return LDAPQUERY_ERROR;
+      *parents = node->second;
+      return LDAPQUERY_TRUE;
+    };
+  }
+
+  std::map<std::string, std::set<std::string>> groups;
+  int64_t fetches = 0;
+};
+
+Directory &directory() {
+  static Directory instance;
+  return instance;
+}
+
+// The user is in a few groups of the lowest level, the authorized group is
+// missing, so the whole reachable hierarchy is walked.
+const std::set<std::string> user_groups = {
+    Directory::dn(0, 1), Directory::dn(0, 2), Directory::dn(0, 3)};
+const std::set<std::string> targets = {"cn=admins,ou=groups,dc=example,dc=org"};
+
+void BM_NestedGroupsCold(benchmark::State &state) {
+  Directory &dir = directory();
+  GroupGraph::Fetch fetch = dir.fetch();
+  dir.fetches = 0;
+  for (auto _ : state) {
+    GroupGraph graph;
+    benchmark::DoNotOptimize(graph.is_member(user_groups, targets, fetch));
+  }
+  state.counters["fetches"] = benchmark::Counter(
+      dir.fetches, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_NestedGroupsCold)->Unit(benchmark::kMicrosecond);
+
+// Logins as the module runs them, each with a new graph over the shared
+// file that the first login filled
+void BM_NestedGroupsShared(benchmark::State &state) {
+  Directory &dir = directory();
+  GroupGraph::Fetch fetch = dir.fetch();
+  unlink(CACHE_FILE);
+  {
+    GroupGraph graph;
+    graph.open(CACHE_FILE);
+    graph.is_member(user_groups, targets, fetch);
+  }
+  dir.fetches = 0;
+  size_t groups = 0;
+  for (auto _ : state) {
+    GroupGraph graph;
+    graph.open(CACHE_FILE);
+    benchmark::DoNotOptimize(graph.is_member(user_groups, targets, fetch));
+    state.PauseTiming();
+    groups = graph.size();
+    state.ResumeTiming();
+  }
+  state.counters["fetches"] = benchmark::Counter(
+      dir.fetches, benchmark::Counter::kAvgIterations);
+  state.counters["groups"] = groups;
+  unlink(CACHE_FILE);
+}
+BENCHMARK(BM_NestedGroupsShared)->Unit(benchmark::kMicrosecond);
+
+// A target a few levels up ends the walk there
+void BM_NestedGroupsNearMatch(benchmark::State &state) {
+  Directory &dir = directory();
+  GroupGraph::Fetch fetch = dir.fetch();
+  std::set<std::string> near;
+  for (int i = 0; i < GROUPS_PER_LEVEL; ++i) near.insert(Directory::dn(3, i));
+  dir.fetches = 0;
+  for (auto _ : state) {
+    GroupGraph graph;
+    benchmark::DoNotOptimize(graph.is_member(user_groups, near, fetch));
+  }
+  state.counters["fetches"] = benchmark::Counter(
+      dir.fetches, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_NestedGroupsNearMatch)->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
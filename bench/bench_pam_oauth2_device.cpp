@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+
+#include "benchmark/benchmark.h"
+#include "include/config.hpp"
+#include "include/qrcache.hpp"
+#include "pam_oauth2_device.hpp"
+
+#define CONFIG_FILE "bench_config.json"
+#define VERIFICATION_URL "https://provider.com/oidc/device"
+#define USER_CODE "e1e9b7be-e720-467e-bbe1"
+
+namespace {
+
+std::string username(int i) { return "provider_user_id_" + std::to_string(i); }
+
+// Writes a configuration that maps each of users provider users to a local
+// account, and as many LDAP groups to the accounts
+void write_config(int users) {
+  std::ofstream file(CONFIG_FILE);
+  file << "{\"oauth\": {\"client\": {\"id\": \"client_id\", \"secret\": "
+          "\"client_secret\"}, \"scope\": \"openid profile\", "
+          "\"device_endpoint\": \"https://provider.com/devicecode\", "
+          "\"token_endpoint\": \"https://provider.com/token\", "
+          "\"userinfo_endpoint\": \"https://provider.com/userinfo\", "
+          "\"username_attribute\": \"preferred_username\"}, "
+          "\"qr\": {\"error_correction_level\": 0}, "
+          "\"ldap\": {\"hosts\": [\"ldaps://ldap:636\"], \"basedn\": "
+          "\"dc=example,dc=org\", \"user\": \"cn=reader\", \"passwd\": "
+          "\"secret\", \"filter\": \"(&(objectClass=user)(fedid=%s))\", "
+          "\"attr\": \"uid\", \"groups\": {";
+  for (int i = 0; i < users; ++i) {
+    file << (i > 0 ? ", " : "") << "\"cn=group-" << i
+         << ",ou=groups,dc=example,dc=org\": [\"account" << i << "\"]";
+  }
+  file << "}}, \"users\": {";
+  for (int i = 0; i < users; ++i) {
+    file << (i > 0 ? ", " : "") << "\"" << username(i) << "\": [\"account"
+         << i << "\"]";
+  }
+  file << "}}";
+}
+
+void BM_ConfigLoad(benchmark::State &state) {
+  write_config(state.range(0));
+  for (auto _ : state) {
+    Config config;
+    config.load(CONFIG_FILE);
+    benchmark::DoNotOptimize(config.usermap.size());
+  }
+  unlink(CONFIG_FILE);
+}
+BENCHMARK(BM_ConfigLoad)->Arg(2)->Arg(10000)->Unit(benchmark::kMicrosecond);
+
+void BM_GetQr(benchmark::State &state) {
+  const std::string text = VERIFICATION_URL "?user_code=" USER_CODE;
+  for (auto _ : state) {
+    std::string qr = getQr(text.c_str(), state.range(0));
+    benchmark::DoNotOptimize(qr.data());
+  }
+}
+BENCHMARK(BM_GetQr)->DenseRange(0, 2)->Unit(benchmark::kMicrosecond);
+
+// The prompt without a QR code, with one and with one from the cache
+void BM_GetPrompt(benchmark::State &state) {
+  DeviceAuthResponse response;
+  response.user_code = USER_CODE;
+  response.verification_uri = VERIFICATION_URL;
+  response.expires_in = 1800;
+  QrCache cache;
+  for (auto _ : state) {
+    std::string prompt =
+        response.get_prompt(0, state.range(0) > 0, false, NULL, "auto",
+                            state.range(0) == 2 ? &cache : NULL, NULL);
+    benchmark::DoNotOptimize(prompt.data());
+  }
+}
+BENCHMARK(BM_GetPrompt)->DenseRange(0, 2)->Unit(benchmark::kMicrosecond);
+
+void BM_ParseAuthorizationResponse(benchmark::State &state) {
+  const std::string body(
+      "{\"device_code\": \"GmRhmhcxhwAzkoEqiMEg_DnyEysNkuNhszIySk9eS\", "
+      "\"user_code\": \"WDJB-MJHT\", \"verification_uri\": "
+      "\"https://provider.com/device\", \"verification_uri_complete\": "
+      "\"https://provider.com/device?user_code=WDJB-MJHT\", "
+      "\"expires_in\": 1800, \"interval\": 5}");
+  for (auto _ : state) {
+    DeviceAuthResponse response;
+    parse_authorization_response(body, &response);
+    benchmark::DoNotOptimize(response.device_code.data());
+  }
+}
+BENCHMARK(BM_ParseAuthorizationResponse);
+
+void BM_ParseTokenResponse(benchmark::State &state) {
+  const std::string body(
+      "{\"access_token\": \"" + std::string(800, 'a') +
+      "\", \"token_type\": \"Bearer\", \"expires_in\": 3600, "
+      "\"refresh_token\": \"" + std::string(400, 'r') + "\", \"id_token\": \"" +
+      std::string(1200, 'i') + "\", \"scope\": \"openid profile\"}");
+  for (auto _ : state) {
+    std::string token;
+    parse_token_response(body, &token);
+    benchmark::DoNotOptimize(token.data());
+  }
+}
+BENCHMARK(BM_ParseTokenResponse);
+
+void BM_ParseUserinfoResponse(benchmark::State &state) {
+  const std::string body(
+      "{\"sub\": \"YzQ4YWIzMzJhZjc5OWFkMzgwNmEwM2M5\", \"preferred_username\": "
+      "\"jdoe\", \"name\": \"Joe Doe\", \"given_name\": \"Joe\", "
+      "\"family_name\": \"Doe\", \"email\": \"jdoe@example.org\", "
+      "\"email_verified\": true, \"acr\": "
+      "\"https://refeds.org/profile/mfa\"}");
+  for (auto _ : state) {
+    Userinfo userinfo;
+    parse_userinfo_response(body, "preferred_username", &userinfo);
+    benchmark::DoNotOptimize(userinfo.username.data());
+  }
+}
+BENCHMARK(BM_ParseUserinfoResponse);
+
+// The last user of a usermap of the given size, no LDAP
+void BM_IsAuthorized(benchmark::State &state) {
+  Config config;
+  config.require_mfa = false;
+  for (int i = 0; i < state.range(0); ++i) {
+    config.usermap[username(i)].insert("account" + std::to_string(i));
+  }
+  const std::string remote = username(state.range(0) - 1);
+  const std::string local = "account" + std::to_string(state.range(0) - 1);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(is_authorized(config, local, remote, ""));
+  }
+}
+BENCHMARK(BM_IsAuthorized)->Arg(10)->Arg(1000)->Arg(100000);
+
+// Appends chunks of the given size up to a 64 KiB response
+void BM_WriteCallback(benchmark::State &state) {
+  std::string chunk(state.range(0), 'x');
+  const size_t chunks = 65536 / chunk.length();
+  for (auto _ : state) {
+    std::string response;
+    for (size_t i = 0; i < chunks; ++i) {
+      WriteCallback(&chunk[0], 1, chunk.length(), &response);
+    }
+    benchmark::DoNotOptimize(response.data());
+  }
+  state.SetBytesProcessed(state.iterations() * chunks * chunk.length());
+}
+BENCHMARK(BM_WriteCallback)->Arg(256)->Arg(16384);
+
+}  // namespace
+
+BENCHMARK_MAIN();
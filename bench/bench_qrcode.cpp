@@ -0,0 +1,207 @@
+#include <unistd.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "include/nayuki/BitBuffer.hpp"
+#include "include/nayuki/QrCode.hpp"
+#include "include/nayuki/QrSegment.hpp"
+#include "include/qrcache.hpp"
+#include "include/qrrender.hpp"
+
+#define VERIFICATION_URL \
+  "https://provider.com/oidc/device?user_code=e1e9b7be-e720-467e-bbe1"
+
+using qrcodegen::QrCode;
+using qrcodegen::QrSegment;
+
+namespace {
+
+// Encodes the URL in the version given by the benchmark argument, the
+// remaining capacity is filled with padding.
+void encode(benchmark::State &state, QrCode::MaskSearch search) {
+  int version = state.range(0);
+  std::vector<QrSegment> segs = QrSegment::makeSegments(VERIFICATION_URL);
+  for (auto _ : state) {
+    QrCode qr = QrCode::encodeSegments(segs, QrCode::Ecc::LOW, version,
+                                       version, -1, false, search);
+    benchmark::DoNotOptimize(qr.getMask());
+  }
+}
+
+void BM_EncodeMaskSerial(benchmark::State &state) {
+  encode(state, QrCode::MaskSearch::SERIAL);
+}
+BENCHMARK(BM_EncodeMaskSerial)
+    ->Arg(5)
+    ->Arg(15)
+    ->Arg(40)
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_EncodeMaskParallel(benchmark::State &state) {
+  encode(state, QrCode::MaskSearch::PARALLEL);
+}
+BENCHMARK(BM_EncodeMaskParallel)
+    ->Arg(5)
+    ->Arg(15)
+    ->Arg(40)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+void BM_EncodeMaskFast(benchmark::State &state) {
+  encode(state, QrCode::MaskSearch::FAST);
+}
+BENCHMARK(BM_EncodeMaskFast)
+    ->Arg(5)
+    ->Arg(15)
+    ->Arg(40)
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_EncodeMaskFixed(benchmark::State &state) {
+  int version = state.range(0);
+  std::vector<QrSegment> segs = QrSegment::makeSegments(VERIFICATION_URL);
+  for (auto _ : state) {
+    QrCode qr = QrCode::encodeSegments(segs, QrCode::Ecc::LOW, version,
+                                       version, 0, false);
+    benchmark::DoNotOptimize(qr.getMask());
+  }
+}
+BENCHMARK(BM_EncodeMaskFixed)
+    ->Arg(5)
+    ->Arg(15)
+    ->Arg(40)
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_EncodeFixedBuffer(benchmark::State &state) {
+  int version = state.range(0);
+  QrCode qr;
+  for (auto _ : state) {
+    QrCode::Status status = QrCode::encodeText(
+        VERIFICATION_URL, QrCode::Ecc::LOW, qr, version, version, -1, false);
+    benchmark::DoNotOptimize(status);
+  }
+}
+BENCHMARK(BM_EncodeFixedBuffer)
+    ->Arg(5)
+    ->Arg(15)
+    ->Arg(40)
+    ->Unit(benchmark::kMicrosecond);
+
+// A full version 40 code at HIGH ECC holds 81 blocks of 30 ECC codewords each,
+// the fixed mask leaves mostly the codeword and ECC computation.
+void BM_EncodeEccV40High(benchmark::State &state) {
+  std::vector<std::uint8_t> data(1273);
+  for (size_t i = 0; i < data.size(); ++i) data[i] = i * 31 + 7;
+  std::vector<QrSegment> segs(1, QrSegment::makeBytes(data));
+  for (auto _ : state) {
+    QrCode qr = QrCode::encodeSegments(segs, QrCode::Ecc::HIGH, 40, 40, 0,
+                                       false);
+    benchmark::DoNotOptimize(qr.getMask());
+  }
+}
+BENCHMARK(BM_EncodeEccV40High)->Unit(benchmark::kMicrosecond);
+
+// Builds a byte segment of the given size and assembles the data codewords
+// the way encodeSegments does, after the 4-bit mode and 16-bit count fields.
+void BM_SegmentAssembly(benchmark::State &state) {
+  std::vector<std::uint8_t> data(state.range(0));
+  for (size_t i = 0; i < data.size(); ++i) data[i] = i * 31 + 7;
+  std::vector<std::uint8_t> codewords(data.size() + 3);
+  for (auto _ : state) {
+    QrSegment seg = QrSegment::makeBytes(data);
+    qrcodegen::BitBuffer bb;
+    bb.appendBits(seg.getMode().getModeBits(), 4);
+    bb.appendBits(seg.getNumChars(), 16);
+    bb.appendData(seg.getData());
+    bb.appendBits(0, 4);
+    bb.getBytes(codewords.data());
+    benchmark::DoNotOptimize(codewords.data());
+  }
+}
+BENCHMARK(BM_SegmentAssembly)->Arg(100)->Arg(500)->Arg(2000);
+
+void BM_PenaltyScore(benchmark::State &state) {
+  QrCode qr = QrCode::encodeSegments(QrSegment::makeSegments(VERIFICATION_URL),
+                                     QrCode::Ecc::LOW, state.range(0),
+                                     state.range(0));
+  for (auto _ : state) benchmark::DoNotOptimize(qr.getPenaltyScore());
+}
+BENCHMARK(BM_PenaltyScore)->Arg(5)->Arg(15)->Arg(40);
+
+void BM_ReferencePenaltyScore(benchmark::State &state) {
+  QrCode qr = QrCode::encodeSegments(QrSegment::makeSegments(VERIFICATION_URL),
+                                     QrCode::Ecc::LOW, state.range(0),
+                                     state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(qr.getReferencePenaltyScore());
+  }
+}
+BENCHMARK(BM_ReferencePenaltyScore)->Arg(5)->Arg(15)->Arg(40);
+
+// Renders the URL in the version given by the second argument with the
+// renderer given by the first, reporting the size of the output
+void BM_Render(benchmark::State &state) {
+  static const char *const kRenderers[] = {"halfblock", "quadrant", "sixel",
+                                           "kitty"};
+  const QrRenderer *renderer = QrRenderer::get(kRenderers[state.range(0)], "");
+  QrCode qr = QrCode::encodeSegments(QrSegment::makeSegments(VERIFICATION_URL),
+                                     QrCode::Ecc::LOW, state.range(1),
+                                     state.range(1));
+  size_t bytes = 0;
+  for (auto _ : state) {
+    std::string rendered = renderer->render(qr, 1);
+    bytes = rendered.length();
+    benchmark::DoNotOptimize(rendered.data());
+  }
+  state.SetLabel(kRenderers[state.range(0)]);
+  state.counters["bytes"] = bytes;
+}
+BENCHMARK(BM_Render)->Apply([](benchmark::internal::Benchmark *b) {
+  for (int renderer = 0; renderer < 4; ++renderer) {
+    for (int version : {6, 15}) b->Args({renderer, version});
+  }
+});
+
+// The QR code of a prompt as getQr draws it, then from the cache in memory
+// and, as a newly forked process sees it, in a file
+void BM_PromptQr(benchmark::State &state) {
+  static const char *const kSources[] = {"render", "memory", "file"};
+  const QrRenderer *renderer = QrRenderer::get("halfblock", "");
+  const std::string key =
+      QrCache::key(VERIFICATION_URL, 0, 1, renderer->name(), "auto");
+  QrCache warm(state.range(0) == 2 ? "bench_qr_cache" : "");
+  if (state.range(0) > 0) {
+    warm.put(key, renderer->render(QrCode::encodeText(VERIFICATION_URL,
+                                                      QrCode::Ecc::LOW),
+                                   1));
+  }
+  for (auto _ : state) {
+    std::string rendered;
+    if (state.range(0) == 0) {
+      QrCode qr;
+      QrCode::encodeText(VERIFICATION_URL, QrCode::Ecc::LOW, qr, 1, 40, -1,
+                         true, true);
+      rendered = renderer->render(qr, 1);
+    } else if (state.range(0) == 1) {
+      warm.get(key, &rendered);
+    } else {
+      QrCache("bench_qr_cache").get(key, &rendered);
+    }
+    benchmark::DoNotOptimize(rendered.data());
+  }
+  if (state.range(0) == 2) {
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx",
+             static_cast<unsigned long long>(QrCache::hash(key)));
+    unlink((std::string("bench_qr_cache/qr-") + hash).c_str());
+    rmdir("bench_qr_cache");
+  }
+  state.SetLabel(kSources[state.range(0)]);
+}
+BENCHMARK(BM_PromptQr)->DenseRange(0, 2)->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
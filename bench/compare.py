@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""Compares Google Benchmark JSON results with a baseline.
+
+Usage: compare.py [--threshold PERCENT] [--metric cpu_time|real_time]
+                  BASELINE RESULTS
+
+BASELINE and RESULTS are JSON files written with --benchmark_out, or
+directories of them matched by file name. The median of repeated runs is
+compared when there is one. Exits with 1 when a benchmark got slower than
+its baseline by more than the threshold or results have no baseline, and
+with 2 when BASELINE does not exist.
+"""
+
+import argparse
+import json
+import os
+import sys
+
+UNITS = {'ns': 1, 'us': 1e3, 'ms': 1e6, 's': 1e9}
+
+
+def load(path, metric):
+    """Returns the time of each benchmark in nanoseconds."""
+    with open(path) as f:
+        data = json.load(f)
+    runs, medians = {}, {}
+    for run in data['benchmarks']:
+        if run.get('error_occurred'):
+            continue
+        time = run[metric] * UNITS[run.get('time_unit', 'ns')]
+        name = run.get('run_name', run['name'])
+        if run.get('run_type') == 'aggregate':
+            if run.get('aggregate_name') == 'median':
+                medians[name] = time
+        else:
+            runs.setdefault(name, []).append(time)
+    times = {name: sum(values) / len(values) for name, values in runs.items()}
+    times.update(medians)
+    return times
+
+
+def pairs(baseline, results):
+    if not os.path.isdir(results):
+        yield baseline, results
+        return
+    for name in sorted(os.listdir(results)):
+        if name.endswith('.json'):
+            yield os.path.join(baseline, name), os.path.join(results, name)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--threshold', type=float, default=10.0,
+                        help='allowed slowdown in percent (default 10)')
+    parser.add_argument('--metric', default='cpu_time',
+                        choices=['cpu_time', 'real_time'])
+    parser.add_argument('baseline')
+    parser.add_argument('results')
+    args = parser.parse_args()
+
+    # A gate that compares nothing must not pass
+    if not os.path.exists(args.baseline):
+        print('no baseline {}, run make baseline first'.format(args.baseline),
+              file=sys.stderr)
+        return 2
+
+    regressions = missing = 0
+    print('{:<56} {:>12} {:>12} {:>8}'.format(
+        'Benchmark', 'Baseline ns', 'Current ns', 'Change'))
+    for baseline_path, results_path in pairs(args.baseline, args.results):
+        current = load(results_path, args.metric)
+        if not os.path.exists(baseline_path):
+            print('{}: no baseline'.format(baseline_path))
+            missing += 1
+            continue
+        baseline = load(baseline_path, args.metric)
+        for name in sorted(current):
+            if name not in baseline:
+                print('{:<56} {:>12} {:>12.1f}'.format(name, '-',
+                                                        current[name]))
+                continue
+            change = (current[name] / baseline[name] - 1) * 100
+            regressed = change > args.threshold
+            regressions += regressed
+            print('{:<56} {:>12.1f} {:>12.1f} {:>+7.1f}%{}'.format(
+                name, baseline[name], current[name], change,
+                ' REGRESSION' if regressed else ''))
+    if regressions:
+        print('{} benchmarks slower by more than {}%'.format(
+            regressions, args.threshold))
+    if missing:
+        print('{} results without a baseline'.format(missing))
+    return 1 if regressions or missing else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
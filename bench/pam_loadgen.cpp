@@ -0,0 +1,198 @@
+// Load generator: runs concurrent logins through pam_sm_authenticate of the
+// module against an identity provider, usually test/mock_idp.py, and
+// reports the throughput, the latency of the login phases, CPU time and
+// peak RSS as key=value lines.
+
+#include <dlfcn.h>
+#include <getopt.h>
+#include <math.h>
+#include <security/pam_appl.h>
+#include <security/pam_modules.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+typedef int (*Authenticate)(pam_handle_t *, int, int, const char **);
+
+// The module resolves the PAM functions below to this executable, linked
+// with -rdynamic, before libpam. Every login thus runs on a synthetic handle
+// and conversation, no PAM service has to be configured.
+struct pam_handle {
+  const char *user;
+  struct pam_conv conv;
+  Clock::time_point prompted, answered;
+};
+
+extern "C" int pam_get_user(pam_handle_t *pamh, const char **user,
+                            const char *prompt) {
+  *user = pamh->user;
+  return PAM_SUCCESS;
+}
+
+extern "C" int pam_get_item(const pam_handle_t *pamh, int item_type,
+                            const void **item) {
+  if (item_type != PAM_CONV) return PAM_SYSTEM_ERR;
+  *item = &pamh->conv;
+  return PAM_SUCCESS;
+}
+
+extern "C" const char *pam_getenv(pam_handle_t *pamh, const char *name) {
+  return NULL;
+}
+
+// Answers the prompt at once, as a user hitting enter
+static int converse(int num_msg, const struct pam_message **msg,
+                    struct pam_response **resp, void *appdata_ptr) {
+  pam_handle_t *pamh = static_cast<pam_handle_t *>(appdata_ptr);
+  pamh->prompted = Clock::now();
+  *resp = static_cast<struct pam_response *>(
+      calloc(num_msg, sizeof(struct pam_response)));
+  if (*resp == NULL) return PAM_SYSTEM_ERR;
+  for (int i = 0; i < num_msg; ++i) (*resp)[i].resp = strdup("");
+  pamh->answered = Clock::now();
+  return PAM_SUCCESS;
+}
+
+struct Login {
+  int rc;
+  // Milliseconds until the prompt, from the answer to the result and in all
+  double device_ms, token_ms, total_ms;
+};
+
+static Login login(Authenticate authenticate, const char *user,
+                   const char *config) {
+  pam_handle_t pamh;
+  pamh.user = user;
+  pamh.conv.conv = converse;
+  pamh.conv.appdata_ptr = &pamh;
+  Clock::time_point start = Clock::now();
+  pamh.prompted = pamh.answered = start;
+  Login result;
+  result.rc = authenticate(&pamh, 0, 1, &config);
+  Clock::time_point end = Clock::now();
+  typedef std::chrono::duration<double, std::milli> Ms;
+  result.device_ms = Ms(pamh.prompted - start).count();
+  result.token_ms = Ms(end - pamh.answered).count();
+  result.total_ms = Ms(end - start).count();
+  return result;
+}
+
+static double percentile(const std::vector<double> &sorted, double p) {
+  size_t rank = static_cast<size_t>(ceil(p * sorted.size()));
+  return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+static void report_phase(const char *phase, const std::vector<Login> &logins,
+                         double Login::*field) {
+  std::vector<double> values;
+  for (auto &result : logins) values.push_back(result.*field);
+  std::sort(values.begin(), values.end());
+  printf("phase=%s p50_ms=%.2f p99_ms=%.2f p999_ms=%.2f max_ms=%.2f\n",
+         phase, percentile(values, 0.5), percentile(values, 0.99),
+         percentile(values, 0.999), values.back());
+}
+
+static double seconds(const struct timeval &tv) {
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-m module] [-c config] [-u user] [-n logins] "
+          "[-j concurrency]\n",
+          name);
+}
+
+int main(int argc, char **argv) {
+  const char *module = "../pam_oauth2_device.so";
+  const char *config = "loadgen_config.json";
+  const char *user = "loadgen";
+  int logins = 100, concurrency = 10;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:c:u:n:j:")) != -1) {
+    switch (opt) {
+      case 'm':
+        module = optarg;
+        break;
+      case 'c':
+        config = optarg;
+        break;
+      case 'u':
+        user = optarg;
+        break;
+      case 'n':
+        logins = atoi(optarg);
+        break;
+      case 'j':
+        concurrency = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (logins < 1 || concurrency < 1) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  void *handle = dlopen(module, RTLD_NOW | RTLD_LOCAL);
+  if (handle == NULL) {
+    fprintf(stderr, "cannot load %s: %s\n", module, dlerror());
+    return 1;
+  }
+  Authenticate authenticate =
+      reinterpret_cast<Authenticate>(dlsym(handle, "pam_sm_authenticate"));
+  if (authenticate == NULL) {
+    fprintf(stderr, "no pam_sm_authenticate in %s\n", module);
+    return 1;
+  }
+  // A first login on its own initializes libcurl, which is not thread-safe
+  if (login(authenticate, user, config).rc != PAM_SUCCESS) {
+    fprintf(stderr, "login of %s with %s failed, see syslog\n", user, config);
+    return 1;
+  }
+
+  std::vector<Login> results(logins);
+  std::atomic<int> next(0);
+  struct rusage before, after;
+  getrusage(RUSAGE_SELF, &before);
+  Clock::time_point start = Clock::now();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < concurrency; ++i) {
+    threads.emplace_back([&]() {
+      for (int j = next++; j < logins; j = next++) {
+        results[j] = login(authenticate, user, config);
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+  double elapsed =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  getrusage(RUSAGE_SELF, &after);
+
+  int failed = 0;
+  for (auto &result : results) failed += result.rc != PAM_SUCCESS;
+  double cpu_user = seconds(after.ru_utime) - seconds(before.ru_utime);
+  double cpu_sys = seconds(after.ru_stime) - seconds(before.ru_stime);
+  printf("logins=%d concurrency=%d failed=%d seconds=%.3f "
+         "logins_per_second=%.2f\n",
+         logins, concurrency, failed, elapsed, logins / elapsed);
+  printf("cpu_user_s=%.3f cpu_sys_s=%.3f cpu_ms_per_login=%.3f "
+         "max_rss_kb=%ld\n",
+         cpu_user, cpu_sys, (cpu_user + cpu_sys) * 1000 / logins,
+         after.ru_maxrss);
+  report_phase("device", results, &Login::device_ms);
+  report_phase("token", results, &Login::token_ms);
+  report_phase("total", results, &Login::total_ms);
+  return failed > 0 ? 1 : 0;
+}
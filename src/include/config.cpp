@@ -4,10 +4,13 @@
 #include <set>
 
 #include "nlohmann/json.hpp"
+#include "probes.hpp"
 
 using json = nlohmann::json;
 
 void Config::load(const char *path) {
+  PROBE_START(start);
+  PROBE(config__load__start, path);
   std::ifstream config_fstream(path);
   json j;
   config_fstream >> j;
@@ -27,6 +30,28 @@ void Config::load(const char *path) {
       j.at("qr").at("error_correction_level").get<int>();
   qr_show =
       (j["qr"].contains("show")) ? j.at("qr").at("show").get<bool>() : true;
+  qr_uppercase_host = (j["qr"].contains("uppercase_host"))
+                          ? j.at("qr").at("uppercase_host").get<bool>()
+                          : false;
+  qr_renderer = (j["qr"].contains("renderer"))
+                    ? j.at("qr").at("renderer").get<std::string>()
+                    : "auto";
+  // "auto", "fast" or a mask number, as a number or a string
+  qr_mask = "auto";
+  if (j["qr"].contains("mask")) {
+    qr_mask = j.at("qr").at("mask").is_number()
+                  ? std::to_string(j.at("qr").at("mask").get<int>())
+                  : j.at("qr").at("mask").get<std::string>();
+  }
+  qr_cache_dir = (j["qr"].contains("cache_dir"))
+                     ? j.at("qr").at("cache_dir").get<std::string>()
+                     : "/run/pam_oauth2_device";
+  stats_file = (j.find("stats") != j.end() && j["stats"].contains("file"))
+                   ? j.at("stats").at("file").get<std::string>()
+                   : "/run/pam_oauth2_device/stats";
+  trace_export = (j.find("trace") != j.end() && j["trace"].contains("export"))
+                     ? j.at("trace").at("export").get<std::string>()
+                     : "";
   token_user_gen = (j["oauth"].contains("token_user_gen"))
                        ? j.at("oauth").at("token_user_gen").get<bool>()
                        : false;
@@ -39,6 +64,50 @@ void Config::load(const char *path) {
     ldap_passwd = j.at("ldap").at("passwd").get<std::string>();
     ldap_filter = j.at("ldap").at("filter").get<std::string>();
     ldap_attr = j.at("ldap").at("attr").get<std::string>();
+    ldap_health_file =
+        j["ldap"].contains("health_file")
+            ? j.at("ldap").at("health_file").get<std::string>()
+            : "/run/pam_oauth2_device/ldap_health";
+    // The key attribute is the one compared with the username in the filter,
+    // e.g. `fedid` in "(&(objectClass=user)(fedid=%s))"
+    if (j["ldap"].contains("key_attr")) {
+      ldap_key_attr = j.at("ldap").at("key_attr").get<std::string>();
+    } else {
+      auto end = ldap_filter.find("=%s)");
+      auto begin = ldap_filter.rfind('(', end);
+      if (end != std::string::npos && begin != std::string::npos) {
+        ldap_key_attr = ldap_filter.substr(begin + 1, end - begin - 1);
+      }
+    }
+    ldap_index_file = j["ldap"].contains("index_file")
+                          ? j.at("ldap").at("index_file").get<std::string>()
+                          : "";
+    ldap_index_max_age =
+        j["ldap"].contains("index_max_age")
+            ? j.at("ldap").at("index_max_age").get<long>()
+            : 86400;
+    if (j["ldap"].contains("groups")) {
+      for (auto &element : j["ldap"]["groups"].items()) {
+        for (auto &local_user : element.value()) {
+          ldap_groups[element.key()].insert((std::string)local_user);
+        }
+      }
+    }
+    ldap_group_attr = j["ldap"].contains("group_attr")
+                          ? j.at("ldap").at("group_attr").get<std::string>()
+                          : "memberOf";
+    ldap_group_in_chain =
+        j["ldap"].contains("group_in_chain")
+            ? j.at("ldap").at("group_in_chain").get<bool>()
+            : false;
+    ldap_group_cache_ttl =
+        j["ldap"].contains("group_cache_ttl")
+            ? j.at("ldap").at("group_cache_ttl").get<long>()
+            : 300;
+    ldap_group_cache_file =
+        j["ldap"].contains("group_cache_file")
+            ? j.at("ldap").at("group_cache_file").get<std::string>()
+            : "/run/pam_oauth2_device/ldap_groups";
   }
   if (j.find("users") != j.end()) {
     for (auto &element : j["users"].items()) {
@@ -53,4 +122,17 @@ void Config::load(const char *path) {
       }
     }
   }
+  // Compiled once here rather than for every prompt
+  if (j.find("prompt") != j.end()) {
+    if (j["prompt"].contains("template")) {
+      prompt_templates.set("",
+                           j.at("prompt").at("template").get<std::string>());
+    }
+    if (j["prompt"].contains("locales")) {
+      for (auto &element : j["prompt"]["locales"].items()) {
+        prompt_templates.set(element.key(), element.value().get<std::string>());
+      }
+    }
+  }
+  PROBE(config__load__done, path, PROBE_ELAPSED_US(start));
 }
@@ -5,16 +5,23 @@
 #include <set>
 #include <string>
 
+#include "prompt.hpp"
+
 class Config {
  public:
   void load(const char *path);
   std::string client_id, client_secret, scope, device_endpoint, token_endpoint,
       userinfo_endpoint, username_attribute, ldap_basedn, ldap_user,
-      ldap_passwd, ldap_filter, ldap_attr;
-  bool require_mfa, qr_show, token_user_gen;
+      ldap_passwd, ldap_filter, ldap_attr, ldap_health_file, ldap_key_attr,
+      ldap_index_file, ldap_group_attr, ldap_group_cache_file, qr_renderer,
+      qr_mask, qr_cache_dir, stats_file, trace_export;
+  bool require_mfa, qr_show, qr_uppercase_host, token_user_gen,
+      ldap_group_in_chain;
   std::set<std::string> ldap_hosts;
   int qr_error_correction_level;
-  std::map<std::string, std::set<std::string>> usermap;
+  long ldap_index_max_age, ldap_group_cache_ttl;
+  std::map<std::string, std::set<std::string>> usermap, ldap_groups;
+  PromptTemplates prompt_templates;
 };
 
 #endif  // PAM_OAUTH2_DEVICE_CONFIG_HPP
@@ -0,0 +1,285 @@
+#include "ldapgroups.hpp"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ldapquery.hpp"
+
+#define LDAPGROUPS_MAGIC 0x4c444732
+
+static int64_t now_s() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// FNV-1a
+static uint32_t hash_dn(const std::string &dn) {
+  uint32_t hash = 2166136261u;
+  for (unsigned char c : dn) {
+    hash ^= c;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static size_t table_size(uint32_t slots) {
+  return sizeof(GroupEdgesTable) + slots * sizeof(GroupEdges);
+}
+
+GroupGraph::GroupGraph(int64_t ttl)
+    : ttl(ttl), fd(-1), table(NULL), mapped(0) {}
+
+GroupGraph::~GroupGraph() {
+  if (table != NULL) munmap(table, table_size(mapped));
+  if (fd != -1) close(fd);
+}
+
+bool GroupGraph::open(const std::string &path) {
+  if (table != NULL) return fd != -1;
+  std::string dir = path.substr(0, path.find_last_of('/'));
+  if (!dir.empty() && dir != path) mkdir(dir.c_str(), 0700);
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd != -1) {
+    flock(fd, LOCK_EX);
+    struct stat st;
+    if (map(LDAPGROUPS_SLOTS) && fstat(fd, &st) == 0) {
+      uint32_t slots = table->slots;
+      if (table->magic != LDAPGROUPS_MAGIC || slots < LDAPGROUPS_SLOTS ||
+          slots > LDAPGROUPS_MAX_SLOTS || (slots & (slots - 1)) != 0 ||
+          st.st_size < (off_t)table_size(slots)) {
+        memset(table, 0, table_size(LDAPGROUPS_SLOTS));
+        table->magic = LDAPGROUPS_MAGIC;
+        table->slots = LDAPGROUPS_SLOTS;
+      } else if (slots != mapped) {
+        map(slots);
+      }
+      flock(fd, LOCK_UN);
+      return true;
+    }
+    flock(fd, LOCK_UN);
+    if (table != NULL) munmap(table, table_size(mapped));
+    table = NULL;
+    close(fd);
+    fd = -1;
+  }
+  if (map(LDAPGROUPS_SLOTS)) {
+    table->magic = LDAPGROUPS_MAGIC;
+    table->slots = LDAPGROUPS_SLOTS;
+  }
+  return false;
+}
+
+// Maps the table with the given number of slots, growing the file when it
+// is smaller. Keeps the current mapping when that fails.
+bool GroupGraph::map(uint32_t slots) {
+  size_t size = table_size(slots);
+  void *addr;
+  if (fd != -1) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        (st.st_size < (off_t)size && ftruncate(fd, size) != 0)) {
+      return false;
+    }
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  } else {
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+  if (addr == MAP_FAILED) return false;
+  if (table != NULL) {
+    if (fd == -1) memcpy(addr, table, sizeof(GroupEdgesTable));
+    munmap(table, table_size(mapped));
+  }
+  table = static_cast<GroupEdgesTable *>(addr);
+  mapped = slots;
+  return true;
+}
+
+// Doubles the slots and inserts the memoized groups again
+bool GroupGraph::grow() {
+  if (table->slots != mapped) return false;
+  std::vector<GroupEdges> entries;
+  for (uint32_t i = 0; i < mapped; ++i) {
+    if (edges()[i].dn[0] != '\0') entries.push_back(edges()[i]);
+  }
+  if (!map(mapped * 2)) return false;
+  table->slots = mapped;
+  memset(edges(), 0, mapped * sizeof(GroupEdges));
+  for (auto &entry : entries) {
+    GroupEdges *slot = find(entry.dn, true);
+    if (slot != NULL) *slot = entry;
+  }
+  return true;
+}
+
+GroupEdges *GroupGraph::edges() {
+  return reinterpret_cast<GroupEdges *>(table + 1);
+}
+
+void GroupGraph::lock() {
+  if (fd == -1) return;
+  flock(fd, LOCK_EX);
+  // Another process grew the table
+  if (table->slots != mapped && table->slots <= LDAPGROUPS_MAX_SLOTS) {
+    map(table->slots);
+  }
+}
+
+void GroupGraph::unlock() {
+  if (fd != -1) flock(fd, LOCK_UN);
+}
+
+std::string GroupGraph::normalize(const std::string &dn) {
+  std::string result(dn);
+  for (auto &c : result) c = tolower(static_cast<unsigned char>(c));
+  return result;
+}
+
+size_t GroupGraph::size() {
+  if (table == NULL) open("");
+  if (table == NULL) return 0;
+  size_t result = 0;
+  lock();
+  for (uint32_t i = 0; i < mapped; ++i) {
+    if (edges()[i].dn[0] != '\0') ++result;
+  }
+  unlock();
+  return result;
+}
+
+GroupEdges *GroupGraph::find(const std::string &dn, bool create) {
+  if (dn.empty() || dn.length() >= LDAPGROUPS_DN_LEN) return NULL;
+  uint32_t hash = hash_dn(dn);
+  GroupEdges *replace = NULL;
+  for (uint32_t i = 0; i < LDAPGROUPS_PROBES; ++i) {
+    GroupEdges *slot = &edges()[(hash + i) % mapped];
+    if (dn == slot->dn) return slot;
+    // Prefer a free slot, then the one fetched longest ago
+    if (replace == NULL ||
+        (replace->dn[0] != '\0' &&
+         (slot->dn[0] == '\0' || slot->fetched_s < replace->fetched_s))) {
+      replace = slot;
+    }
+  }
+  if (!create) return NULL;
+  if (replace->dn[0] != '\0' && mapped < LDAPGROUPS_MAX_SLOTS && grow()) {
+    return find(dn, true);
+  }
+  memset(replace, 0, sizeof(GroupEdges));
+  memcpy(replace->dn, dn.c_str(), dn.length() + 1);
+  return replace;
+}
+
+bool GroupGraph::load(const std::string &dn, int64_t now, Node *node) {
+  if (table == NULL) return false;
+  bool found = false;
+  GroupEdges *slot = find(dn, false);
+  // A clock that went backwards (reboot with a persistent file) expires the
+  // edges
+  if (slot != NULL && slot->fetched_s <= now && now < slot->fetched_s + ttl &&
+      slot->length <= LDAPGROUPS_PARENTS_LEN) {
+    node->groups.clear();
+    for (uint32_t i = 0; i < slot->length;) {
+      size_t length = strnlen(slot->parents + i, slot->length - i);
+      node->groups.insert(std::string(slot->parents + i, length));
+      i += length + 1;
+    }
+    node->expires = slot->fetched_s + ttl;
+    found = true;
+  }
+  return found;
+}
+
+void GroupGraph::store(const std::string &dn,
+                       const std::set<std::string> &parents, int64_t now) {
+  size_t length = 0;
+  for (auto &parent : parents) length += parent.length() + 1;
+  if (table == NULL || length > LDAPGROUPS_PARENTS_LEN) return;
+  GroupEdges *slot = find(dn, true);
+  if (slot != NULL) {
+    slot->fetched_s = now;
+    slot->length = 0;
+    for (auto &parent : parents) {
+      memcpy(slot->parents + slot->length, parent.c_str(),
+             parent.length() + 1);
+      slot->length += parent.length() + 1;
+    }
+  }
+}
+
+// Returns the direct parents of a group, NULL when they cannot be fetched.
+// Called with the table locked, the lock is released while fetching.
+const GroupGraph::Node *GroupGraph::parents(const std::string &dn,
+                                            const Fetch &fetch, int64_t now) {
+  auto node = nodes.find(dn);
+  if (node != nodes.end() && node->second.expires > now) return &node->second;
+  Node entry;
+  if (!load(dn, now, &entry)) {
+    std::set<std::string> parents;
+    unlock();
+    int rc = fetch(dn, &parents);
+    lock();
+    if (rc == LDAPQUERY_ERROR) return NULL;
+    for (auto &parent : parents) entry.groups.insert(normalize(parent));
+    entry.expires = now + ttl;
+    store(dn, entry.groups, now);
+  }
+  Node &result = nodes[dn];
+  result.groups.swap(entry.groups);
+  result.expires = entry.expires;
+  return &result;
+}
+
+int GroupGraph::is_member(const std::set<std::string> &groups,
+                          const std::set<std::string> &targets,
+                          const Fetch &fetch) {
+  if (table == NULL) open("");
+  std::set<std::string> normalized_targets;
+  int64_t now = now_s();
+  bool failed = false;
+
+  for (auto &target : targets) normalized_targets.insert(normalize(target));
+  // Walk breadth first from all the groups at once, so that shared ancestors
+  // are visited once, and stop at the first target reached. Groups that
+  // cannot be fetched fail the check unless a target is found elsewhere.
+  std::set<std::string> visited;
+  std::deque<std::string> queue;
+  for (auto &group : groups) {
+    std::string dn = normalize(group);
+    if (normalized_targets.count(dn) > 0) return LDAPQUERY_TRUE;
+    if (visited.insert(dn).second) queue.push_back(dn);
+  }
+  int result = LDAPQUERY_FALSE;
+  lock();
+  while (!queue.empty() && result != LDAPQUERY_TRUE) {
+    std::string group = queue.front();
+    queue.pop_front();
+    const Node *node = parents(group, fetch, now);
+    if (node == NULL) {
+      failed = true;
+      continue;
+    }
+    for (auto &parent : node->groups) {
+      if (normalized_targets.count(parent) > 0) {
+        result = LDAPQUERY_TRUE;
+        break;
+      }
+      if (visited.insert(parent).second) queue.push_back(parent);
+    }
+  }
+  unlock();
+  if (result != LDAPQUERY_TRUE && failed) result = LDAPQUERY_ERROR;
+  return result;
+}
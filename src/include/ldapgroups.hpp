@@ -0,0 +1,91 @@
+#ifndef PAM_OAUTH2_DEVICE_LDAPGROUPS_HPP
+#define PAM_OAUTH2_DEVICE_LDAPGROUPS_HPP
+
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+
+// Slots of a new table. It doubles, up to LDAPGROUPS_MAX_SLOTS, when every
+// slot a group may take is in use.
+#define LDAPGROUPS_SLOTS 1024
+#define LDAPGROUPS_MAX_SLOTS 65536
+#define LDAPGROUPS_DN_LEN 256
+// Parent DNs of a group, NUL separated. A group with more is only memoized
+// by the graph that fetched it.
+#define LDAPGROUPS_PARENTS_LEN 752
+// Slots a group may take, the one fetched longest ago is replaced
+#define LDAPGROUPS_PROBES 16
+
+struct GroupEdges {
+  char dn[LDAPGROUPS_DN_LEN];
+  int64_t fetched_s;
+  uint32_t length;
+  uint32_t reserved;
+  char parents[LDAPGROUPS_PARENTS_LEN];
+};
+
+// Header of the table, followed by its slots
+struct GroupEdgesTable {
+  uint32_t magic;
+  uint32_t slots;
+};
+
+// Memoized graph of nested LDAP groups. Edges lead from a group to the
+// groups it is a direct member of. They are kept in a memory mapped file
+// shared by every process running the module, so that a login in a new sshd
+// process does not query LDAP again for groups other logins fetched, or in
+// process private memory when the file cannot be mapped. Edges expire ttl
+// seconds after they were fetched. A graph also keeps the edges it used
+// until they expire. DNs are compared case-insensitively.
+class GroupGraph {
+ public:
+  // Fetches the direct parents of a group. Returns LDAPQUERY_TRUE, or
+  // LDAPQUERY_FALSE when the group does not exist, e.g. a deleted group
+  // still listed by its members, which then has no parents.
+  typedef std::function<int(const std::string &dn,
+                            std::set<std::string> *parents)>
+      Fetch;
+
+  explicit GroupGraph(int64_t ttl = 300);
+  ~GroupGraph();
+  bool open(const std::string &path);
+  // Returns LDAPQUERY_TRUE when one of groups, or a group they are nested
+  // in, is one of targets.
+  int is_member(const std::set<std::string> &groups,
+                const std::set<std::string> &targets, const Fetch &fetch);
+  // Returns the number of memoized groups
+  size_t size();
+  static std::string normalize(const std::string &dn);
+
+ private:
+  struct Node {
+    std::set<std::string> groups;
+    int64_t expires;
+  };
+  GroupGraph(const GroupGraph &);
+  GroupGraph &operator=(const GroupGraph &);
+  const Node *parents(const std::string &dn, const Fetch &fetch, int64_t now);
+  bool load(const std::string &dn, int64_t now, Node *node);
+  void store(const std::string &dn, const std::set<std::string> &parents,
+             int64_t now);
+  GroupEdges *find(const std::string &dn, bool create);
+  bool map(uint32_t slots);
+  bool grow();
+  GroupEdges *edges();
+  void lock();
+  void unlock();
+
+  // Direct parents of each group used by this graph
+  std::map<std::string, Node> nodes;
+  int64_t ttl;
+  int fd;
+  GroupEdgesTable *table;
+  // Slots of the mapping, behind table->slots until another process's
+  // growth is mapped
+  uint32_t mapped;
+};
+
+#endif  // PAM_OAUTH2_DEVICE_LDAPGROUPS_HPP
@@ -0,0 +1,154 @@
+#include "ldaphealth.hpp"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define LDAPHEALTH_MAGIC 0x4c444831
+
+static int64_t now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+LdapHealth::LdapHealth() : fd(-1), table(NULL) {}
+
+LdapHealth::~LdapHealth() {
+  if (fd != -1) {
+    munmap(table, sizeof(LdapHealthTable));
+    close(fd);
+  } else {
+    delete table;
+  }
+}
+
+bool LdapHealth::open(const std::string &path) {
+  if (table != NULL) return fd != -1;
+  std::string dir = path.substr(0, path.find_last_of('/'));
+  if (!dir.empty() && dir != path) mkdir(dir.c_str(), 0700);
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd != -1) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 &&
+        (st.st_size >= (off_t)sizeof(LdapHealthTable) ||
+         ftruncate(fd, sizeof(LdapHealthTable)) == 0)) {
+      void *addr = mmap(NULL, sizeof(LdapHealthTable), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+      if (addr != MAP_FAILED) {
+        table = static_cast<LdapHealthTable *>(addr);
+        lock();
+        if (table->magic != LDAPHEALTH_MAGIC ||
+            table->count > LDAPHEALTH_MAX_HOSTS) {
+          memset(table, 0, sizeof(LdapHealthTable));
+          table->magic = LDAPHEALTH_MAGIC;
+        }
+        unlock();
+        return true;
+      }
+    }
+    close(fd);
+    fd = -1;
+  }
+  table = new LdapHealthTable();
+  table->magic = LDAPHEALTH_MAGIC;
+  return false;
+}
+
+void LdapHealth::lock() {
+  if (fd != -1) flock(fd, LOCK_EX);
+}
+
+void LdapHealth::unlock() {
+  if (fd != -1) flock(fd, LOCK_UN);
+}
+
+LdapHostHealth *LdapHealth::find(const std::string &host, bool create) {
+  if (host.length() >= LDAPHEALTH_HOST_LEN) return NULL;
+  for (uint32_t i = 0; i < table->count; ++i) {
+    if (host == table->hosts[i].host) return &table->hosts[i];
+  }
+  if (!create || table->count == LDAPHEALTH_MAX_HOSTS) return NULL;
+  LdapHostHealth *entry = &table->hosts[table->count++];
+  memset(entry, 0, sizeof(LdapHostHealth));
+  memcpy(entry->host, host.c_str(), host.length() + 1);
+  return entry;
+}
+
+std::vector<std::string> LdapHealth::order(
+    const std::set<std::string> &hosts) {
+  if (table == NULL) open("");
+  std::vector<std::pair<double, std::string>> healthy;
+  std::vector<std::string> probes;
+  int64_t now = now_ms();
+
+  lock();
+  for (auto &host : hosts) {
+    LdapHostHealth *entry = find(host, false);
+    if (entry == NULL || entry->state == LDAPHEALTH_CLOSED) {
+      healthy.push_back(
+          std::make_pair(entry ? entry->latency_ms : 0.0, host));
+      continue;
+    }
+    // An open breaker lets one process probe the host once the wait is over.
+    // A clock that went backwards (reboot with a persistent file) also
+    // releases the breaker. A probe that never reported back is retried.
+    int64_t elapsed = now - entry->changed_ms;
+    if (elapsed >= LDAPHEALTH_OPEN_MS || elapsed < 0) {
+      entry->state = LDAPHEALTH_HALF_OPEN;
+      entry->changed_ms = now;
+      probes.push_back(host);
+    }
+  }
+  unlock();
+
+  std::stable_sort(healthy.begin(), healthy.end(),
+                   [](const std::pair<double, std::string> &a,
+                      const std::pair<double, std::string> &b) {
+                     return a.first < b.first;
+                   });
+  std::vector<std::string> result;
+  for (auto &host : healthy) result.push_back(host.second);
+  result.insert(result.end(), probes.begin(), probes.end());
+  return result;
+}
+
+void LdapHealth::record(const std::string &host, bool success,
+                        double latency_ms) {
+  if (table == NULL) open("");
+  lock();
+  LdapHostHealth *entry = find(host, true);
+  if (entry != NULL) {
+    if (success) {
+      entry->latency_ms =
+          entry->successes == 0
+              ? latency_ms
+              : LDAPHEALTH_EWMA_ALPHA * latency_ms +
+                    (1 - LDAPHEALTH_EWMA_ALPHA) * entry->latency_ms;
+      ++entry->successes;
+      entry->consecutive_errors = 0;
+      if (entry->state != LDAPHEALTH_CLOSED) {
+        entry->state = LDAPHEALTH_CLOSED;
+        entry->changed_ms = now_ms();
+      }
+    } else {
+      ++entry->errors;
+      ++entry->consecutive_errors;
+      if (entry->state == LDAPHEALTH_HALF_OPEN ||
+          entry->consecutive_errors >= LDAPHEALTH_FAILURE_THRESHOLD) {
+        entry->state = LDAPHEALTH_OPEN;
+        entry->changed_ms = now_ms();
+      }
+    }
+  }
+  unlock();
+}
@@ -0,0 +1,66 @@
+#ifndef PAM_OAUTH2_DEVICE_LDAPHEALTH_HPP
+#define PAM_OAUTH2_DEVICE_LDAPHEALTH_HPP
+
+#include <stdint.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#define LDAPHEALTH_MAX_HOSTS 32
+#define LDAPHEALTH_HOST_LEN 256
+
+// Consecutive errors after which the circuit breaker of a host opens.
+#define LDAPHEALTH_FAILURE_THRESHOLD 3
+// Time an open breaker waits before a single probe query is let through.
+#define LDAPHEALTH_OPEN_MS 30000
+// Weight of the newest latency sample in the moving average.
+#define LDAPHEALTH_EWMA_ALPHA 0.3
+
+enum LdapBreakerState {
+  LDAPHEALTH_CLOSED = 0,
+  LDAPHEALTH_OPEN = 1,
+  LDAPHEALTH_HALF_OPEN = 2
+};
+
+struct LdapHostHealth {
+  char host[LDAPHEALTH_HOST_LEN];
+  double latency_ms;
+  uint32_t consecutive_errors;
+  uint32_t state;
+  uint64_t errors;
+  uint64_t successes;
+  int64_t changed_ms;
+};
+
+struct LdapHealthTable {
+  uint32_t magic;
+  uint32_t count;
+  LdapHostHealth hosts[LDAPHEALTH_MAX_HOSTS];
+};
+
+// Health of the configured LDAP replicas, kept in a memory mapped file so
+// that every process running the module shares what the others learned.
+// Falls back to process private memory when the file cannot be mapped.
+class LdapHealth {
+ public:
+  LdapHealth();
+  ~LdapHealth();
+  bool open(const std::string &path);
+  // Returns the hosts worth querying, fastest healthy replica first. Hosts
+  // with an open circuit breaker are left out.
+  std::vector<std::string> order(const std::set<std::string> &hosts);
+  void record(const std::string &host, bool success, double latency_ms);
+
+ private:
+  LdapHealth(const LdapHealth &);
+  LdapHealth &operator=(const LdapHealth &);
+  LdapHostHealth *find(const std::string &host, bool create);
+  void lock();
+  void unlock();
+
+  int fd;
+  LdapHealthTable *table;
+};
+
+#endif  // PAM_OAUTH2_DEVICE_LDAPHEALTH_HPP
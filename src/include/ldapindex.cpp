@@ -0,0 +1,129 @@
+#include "ldapindex.hpp"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#define LDAPINDEX_MAGIC 0x4c444931
+
+LdapIndex::LdapIndex() : data(NULL), length(0), header(NULL), offsets(NULL) {}
+
+LdapIndex::~LdapIndex() {
+  if (data != NULL) munmap(const_cast<char *>(data), length);
+}
+
+bool LdapIndex::open(const std::string &path, int64_t max_age) {
+  struct stat st;
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return false;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(LdapIndexHeader)) {
+    close(fd);
+    return false;
+  }
+  void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) return false;
+  data = static_cast<const char *>(addr);
+  length = st.st_size;
+  header = reinterpret_cast<const LdapIndexHeader *>(data);
+  offsets = reinterpret_cast<const uint32_t *>(data + sizeof(LdapIndexHeader));
+
+  // Every record must lie in the string area, which ends with a terminator
+  size_t strings = sizeof(LdapIndexHeader) + header->count * sizeof(uint32_t);
+  bool valid = header->magic == LDAPINDEX_MAGIC &&
+               header->count <= length / sizeof(uint32_t) &&
+               strings <= length && data[length - 1] == '\0';
+  for (uint32_t i = 0; valid && i < header->count; ++i) {
+    valid = offsets[i] >= strings && offsets[i] < length;
+  }
+  if (valid && max_age > 0) {
+    valid = time(NULL) - header->created <= max_age;
+  }
+  if (!valid) {
+    munmap(addr, length);
+    data = NULL;
+    length = 0;
+    header = NULL;
+    offsets = NULL;
+  }
+  return valid;
+}
+
+bool LdapIndex::contains(const std::string &key,
+                         const std::string &value) const {
+  if (data == NULL) return false;
+  uint32_t low = 0, high = header->count;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    const char *record_key = data + offsets[mid];
+    const char *record_value = record_key + strlen(record_key) + 1;
+    if (record_value >= data + length) return false;
+    int cmp = strcmp(record_key, key.c_str());
+    if (cmp == 0) cmp = strcmp(record_value, value.c_str());
+    if (cmp == 0) return true;
+    if (cmp < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return false;
+}
+
+size_t LdapIndex::size() const { return header != NULL ? header->count : 0; }
+
+bool LdapIndex::write(
+    const std::string &path,
+    const std::map<std::string, std::set<std::string>> &mapping) {
+  std::vector<uint32_t> record_offsets;
+  std::string strings;
+  for (auto &element : mapping) {
+    if (element.first.find('\0') != std::string::npos) continue;
+    for (auto &value : element.second) {
+      if (value.find('\0') != std::string::npos) continue;
+      record_offsets.push_back(strings.length());
+      strings.append(element.first).push_back('\0');
+      strings.append(value).push_back('\0');
+    }
+  }
+  LdapIndexHeader index_header;
+  memset(&index_header, 0, sizeof(index_header));
+  index_header.magic = LDAPINDEX_MAGIC;
+  index_header.count = record_offsets.size();
+  index_header.created = time(NULL);
+  uint32_t base = sizeof(LdapIndexHeader) +
+                  record_offsets.size() * sizeof(uint32_t);
+  for (auto &offset : record_offsets) offset += base;
+  if (strings.empty()) strings.push_back('\0');
+
+  std::string tmp_path = path + ".XXXXXX";
+  std::vector<char> tmp_name(tmp_path.begin(), tmp_path.end());
+  tmp_name.push_back('\0');
+  int fd = mkstemp(tmp_name.data());
+  if (fd == -1) return false;
+  FILE *file = fdopen(fd, "wb");
+  if (file == NULL) {
+    close(fd);
+    unlink(tmp_name.data());
+    return false;
+  }
+  bool ok =
+      fwrite(&index_header, sizeof(index_header), 1, file) == 1 &&
+      (record_offsets.empty() ||
+       fwrite(record_offsets.data(), sizeof(uint32_t), record_offsets.size(),
+              file) == record_offsets.size()) &&
+      fwrite(strings.data(), 1, strings.length(), file) == strings.length();
+  ok = fflush(file) == 0 && fsync(fileno(file)) == 0 && ok;
+  ok = fclose(file) == 0 && ok;
+  if (ok) ok = rename(tmp_name.data(), path.c_str()) == 0;
+  if (!ok) unlink(tmp_name.data());
+  return ok;
+}
@@ -0,0 +1,45 @@
+#ifndef PAM_OAUTH2_DEVICE_LDAPINDEX_HPP
+#define PAM_OAUTH2_DEVICE_LDAPINDEX_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <string>
+
+struct LdapIndexHeader {
+  uint32_t magic;
+  uint32_t count;
+  int64_t created;
+};
+
+// Read-only, memory mapped snapshot of the LDAP mapping between the key
+// attribute used in the filter and the authorized attribute values.
+// The file holds a header, `count` offsets of the records sorted by key and
+// value, and the records themselves as "key\0value\0" strings.
+class LdapIndex {
+ public:
+  LdapIndex();
+  ~LdapIndex();
+  // Maps the index file. Snapshots older than max_age seconds are rejected,
+  // max_age 0 accepts any snapshot.
+  bool open(const std::string &path, int64_t max_age = 0);
+  bool contains(const std::string &key, const std::string &value) const;
+  size_t size() const;
+  // Writes the mapping to a temporary file and renames it over path, so the
+  // readers always map either the old or the new snapshot.
+  static bool write(const std::string &path,
+                    const std::map<std::string, std::set<std::string>> &mapping);
+
+ private:
+  LdapIndex(const LdapIndex &);
+  LdapIndex &operator=(const LdapIndex &);
+
+  const char *data;
+  size_t length;
+  const LdapIndexHeader *header;
+  const uint32_t *offsets;
+};
+
+#endif  // PAM_OAUTH2_DEVICE_LDAPINDEX_HPP
@@ -7,28 +7,39 @@
 
 #include <string>
 
-int ldap_check_attr(const std::string &host, const std::string &basedn,
-                    const std::string &user, const std::string &passwd,
-                    const std::string &filter, const std::string &attr,
-                    const std::string &value) {
-  LDAP *ld;
-  LDAPMessage *res, *msg;
-  BerElement *ber;
+#include "ldapgroups.hpp"
+#include "metrics.hpp"
+#include "probes.hpp"
+
+#define LDAPQUERY_PAGE_SIZE 500
+#define LDAPQUERY_IN_CHAIN "1.2.840.113556.1.4.1941"
+
+// Starts the span of an LDAP operation on host
+static void ldap_span(PhaseTimer *span, const std::string &host) {
+  span->client();
+  span->attribute("ldap.host", host);
+}
+
+static int ldap_connect(const std::string &host, const std::string &user,
+                        const std::string &passwd, LDAP **ld,
+                        LoginMetrics *metrics) {
   BerValue *servercredp;
-  char *a, *passwd_local;
-  int rc, i;
+  char *passwd_local;
+  int rc;
   struct berval cred;
-  struct berval **vals;
-  char *attr_local = NULL;
-  char *attrs[] = {attr_local, NULL};
   const int ldap_version = LDAP_VERSION3;
 
-  if (ldap_initialize(&ld, host.c_str()) != LDAP_SUCCESS) {
+  PhaseTimer span(metrics, "", "ldap.bind");
+  ldap_span(&span, host);
+  if (ldap_initialize(ld, host.c_str()) != LDAP_SUCCESS) {
+    span.fail();
     return LDAPQUERY_ERROR;
   }
 
-  if (ldap_set_option(ld, LDAP_OPT_PROTOCOL_VERSION, &ldap_version) !=
+  if (ldap_set_option(*ld, LDAP_OPT_PROTOCOL_VERSION, &ldap_version) !=
       LDAP_SUCCESS) {
+    ldap_unbind_ext_s(*ld, NULL, NULL);
+    span.fail();
     return LDAPQUERY_ERROR;
   }
 
@@ -36,20 +47,52 @@ int ldap_check_attr(const std::string &host, const std::string &basedn,
   snprintf(passwd_local, passwd.length() + 1, "%s", passwd.c_str());
   cred.bv_val = passwd_local;
   cred.bv_len = passwd.length();
-  rc = ldap_sasl_bind_s(ld, user.c_str(), LDAP_SASL_SIMPLE, &cred, NULL, NULL,
+  rc = ldap_sasl_bind_s(*ld, user.c_str(), LDAP_SASL_SIMPLE, &cred, NULL, NULL,
                         &servercredp);
   delete[] passwd_local;
   if (rc != LDAP_SUCCESS) {
+    ldap_unbind_ext_s(*ld, NULL, NULL);
+    span.fail();
+    return LDAPQUERY_ERROR;
+  }
+  return LDAPQUERY_TRUE;
+}
+
+int ldap_check_attr(const std::string &host, const std::string &basedn,
+                    const std::string &user, const std::string &passwd,
+                    const std::string &filter, const std::string &attr,
+                    const std::string &value, LoginMetrics *metrics) {
+  LDAP *ld;
+  LDAPMessage *res, *msg;
+  BerElement *ber;
+  char *a;
+  int rc, i;
+  struct berval **vals;
+  char *attr_local = NULL;
+  char *attrs[] = {attr_local, NULL};
+
+  PROBE_START(start);
+  PROBE(ldap__check__attr__start, host.c_str());
+  if (ldap_connect(host, user, passwd, &ld, metrics) != LDAPQUERY_TRUE) {
+    PROBE(ldap__check__attr__done, host.c_str(), LDAPQUERY_ERROR, 0,
+          PROBE_ELAPSED_US(start));
     return LDAPQUERY_ERROR;
   }
+  PROBE(ldap__check__attr__bound, host.c_str(), PROBE_ELAPSED_US(start));
 
   attr_local = strdup(attr.c_str());
+  PhaseTimer span(metrics, "", "ldap.search");
+  ldap_span(&span, host);
   rc = ldap_search_ext_s(ld, basedn.c_str(), LDAP_SCOPE_SUBTREE, filter.c_str(),
                          attrs, 0, NULL, NULL, NULL, 0, &res);
   free(attr_local);
+  if (rc != LDAP_SUCCESS) span.fail();
+  span.stop();
   if (rc != LDAP_SUCCESS) {
     ldap_msgfree(res);
     ldap_unbind_ext_s(ld, NULL, NULL);
+    PROBE(ldap__check__attr__done, host.c_str(), LDAPQUERY_ERROR, rc,
+          PROBE_ELAPSED_US(start));
     return LDAPQUERY_ERROR;
   }
 
@@ -82,6 +125,210 @@ int ldap_check_attr(const std::string &host, const std::string &basedn,
   }
 
   ldap_msgfree(res);
+  ldap_unbind_ext_s(ld, NULL, NULL);
+  PROBE(ldap__check__attr__done, host.c_str(), rc, LDAP_SUCCESS,
+        PROBE_ELAPSED_US(start));
+  return rc;
+}
+
+int ldap_get_mapping(const std::string &host, const std::string &basedn,
+                     const std::string &user, const std::string &passwd,
+                     const std::string &filter, const std::string &key_attr,
+                     const std::string &attr,
+                     std::map<std::string, std::set<std::string>> *mapping,
+                     LoginMetrics *metrics, const std::atomic<bool> *cancel) {
+  LDAP *ld;
+  LDAPMessage *res, *entry;
+  LDAPControl *page_control, **returned_controls, *controls[2];
+  struct berval cookie = {0, NULL};
+  struct berval **keys, **vals;
+  int rc, err, i, j;
+  ber_int_t count;
+  char *key_attr_local, *attr_local;
+
+  if (ldap_connect(host, user, passwd, &ld, metrics) != LDAPQUERY_TRUE) {
+    return LDAPQUERY_ERROR;
+  }
+
+  key_attr_local = strdup(key_attr.c_str());
+  attr_local = strdup(attr.c_str());
+  char *attrs[] = {key_attr_local, attr_local, NULL};
+  rc = LDAPQUERY_FALSE;
+  do {
+    if (ldap_create_page_control(ld, LDAPQUERY_PAGE_SIZE, &cookie, 1,
+                                 &page_control) != LDAP_SUCCESS) {
+      rc = LDAPQUERY_ERROR;
+      break;
+    }
+    controls[0] = page_control;
+    controls[1] = NULL;
+    PhaseTimer span(metrics, "", "ldap.search");
+    ldap_span(&span, host);
+    err = ldap_search_ext_s(ld, basedn.c_str(), LDAP_SCOPE_SUBTREE,
+                            filter.c_str(), attrs, 0, controls, NULL, NULL,
+                            LDAP_NO_LIMIT, &res);
+    if (err != LDAP_SUCCESS) span.fail();
+    span.stop();
+    ldap_control_free(page_control);
+    if (err != LDAP_SUCCESS) {
+      ldap_msgfree(res);
+      rc = LDAPQUERY_ERROR;
+      break;
+    }
+
+    for (entry = ldap_first_entry(ld, res); entry != NULL;
+         entry = ldap_next_entry(ld, entry)) {
+      keys = ldap_get_values_len(ld, entry, key_attr.c_str());
+      vals = ldap_get_values_len(ld, entry, attr.c_str());
+      if (keys != NULL && vals != NULL) {
+        for (i = 0; keys[i] != NULL; ++i) {
+          std::set<std::string> &values = (*mapping)[std::string(
+              keys[i]->bv_val, keys[i]->bv_len)];
+          for (j = 0; vals[j] != NULL; ++j) {
+            values.insert(std::string(vals[j]->bv_val, vals[j]->bv_len));
+          }
+        }
+        rc = LDAPQUERY_TRUE;
+      }
+      if (keys != NULL) ldap_value_free_len(keys);
+      if (vals != NULL) ldap_value_free_len(vals);
+    }
+
+    // The server hands back a cookie until the last page has been sent
+    if (cookie.bv_val != NULL) {
+      ber_memfree(cookie.bv_val);
+      cookie.bv_val = NULL;
+      cookie.bv_len = 0;
+    }
+    returned_controls = NULL;
+    if (ldap_parse_result(ld, res, &err, NULL, NULL, NULL, &returned_controls,
+                          0) != LDAP_SUCCESS ||
+        err != LDAP_SUCCESS) {
+      rc = LDAPQUERY_ERROR;
+    } else {
+      page_control = ldap_control_find(LDAP_CONTROL_PAGEDRESULTS,
+                                       returned_controls, NULL);
+      if (page_control != NULL) {
+        ldap_parse_pageresponse_control(ld, page_control, &count, &cookie);
+      }
+    }
+    if (returned_controls != NULL) ldap_controls_free(returned_controls);
+    ldap_msgfree(res);
+    if (cancel != NULL && *cancel) rc = LDAPQUERY_ERROR;
+  } while (rc != LDAPQUERY_ERROR && cookie.bv_val != NULL &&
+           cookie.bv_len > 0);
+
+  if (cookie.bv_val != NULL) ber_memfree(cookie.bv_val);
+  free(key_attr_local);
+  free(attr_local);
+  ldap_unbind_ext_s(ld, NULL, NULL);
+  return rc;
+}
+
+// Collects the values of attr of every entry matching filter on host.
+// Returns LDAPQUERY_FALSE when no entry matches, or for a base search when
+// basedn does not exist.
+static int ldap_search_values(LDAP *ld, const std::string &host,
+                              const std::string &basedn, int scope,
+                              const std::string &filter,
+                              const std::string &attr,
+                              std::set<std::string> *values,
+                              LoginMetrics *metrics) {
+  LDAPMessage *res, *entry;
+  struct berval **vals;
+  int rc, i;
+  char *attr_local = strdup(attr.c_str());
+  char *attrs[] = {attr_local, NULL};
+
+  PhaseTimer span(metrics, "", "ldap.search");
+  ldap_span(&span, host);
+  rc = ldap_search_ext_s(ld, basedn.c_str(), scope, filter.c_str(), attrs, 0,
+                         NULL, NULL, NULL, LDAP_NO_LIMIT, &res);
+  free(attr_local);
+  if (rc != LDAP_SUCCESS && rc != LDAP_NO_SUCH_OBJECT) span.fail();
+  span.stop();
+  if (rc == LDAP_NO_SUCH_OBJECT && scope == LDAP_SCOPE_BASE) {
+    ldap_msgfree(res);
+    return LDAPQUERY_FALSE;
+  }
+  if (rc != LDAP_SUCCESS) {
+    ldap_msgfree(res);
+    return LDAPQUERY_ERROR;
+  }
+  rc = LDAPQUERY_FALSE;
+  for (entry = ldap_first_entry(ld, res); entry != NULL;
+       entry = ldap_next_entry(ld, entry)) {
+    rc = LDAPQUERY_TRUE;
+    if ((vals = ldap_get_values_len(ld, entry, attr.c_str())) != NULL) {
+      for (i = 0; vals[i] != NULL; ++i) {
+        values->insert(std::string(vals[i]->bv_val, vals[i]->bv_len));
+      }
+      ldap_value_free_len(vals);
+    }
+  }
+  ldap_msgfree(res);
+  return rc;
+}
+
+int ldap_check_group(const std::string &host, const std::string &basedn,
+                     const std::string &user, const std::string &passwd,
+                     const std::string &filter, const std::string &group_attr,
+                     const std::set<std::string> &groups, bool in_chain,
+                     GroupGraph *graph, LoginMetrics *metrics) {
+  LDAP *ld;
+  int rc;
+
+  if (ldap_connect(host, user, passwd, &ld, metrics) != LDAPQUERY_TRUE) {
+    return LDAPQUERY_ERROR;
+  }
+
+  if (in_chain) {
+    rc = LDAPQUERY_FALSE;
+    for (auto &group : groups) {
+      std::set<std::string> found;
+      std::string chain_filter = "(&" + filter + "(" + group_attr + ":" +
+                                 LDAPQUERY_IN_CHAIN +
+                                 ":=" + ldap_escape_filter(group) + "))";
+      int found_rc = ldap_search_values(ld, host, basedn, LDAP_SCOPE_SUBTREE,
+                                        chain_filter, "1.1", &found, metrics);
+      if (found_rc == LDAPQUERY_TRUE) {
+        rc = LDAPQUERY_TRUE;
+        break;
+      }
+      if (found_rc == LDAPQUERY_ERROR) rc = LDAPQUERY_ERROR;
+    }
+  } else {
+    std::set<std::string> direct;
+    rc = ldap_search_values(ld, host, basedn, LDAP_SCOPE_SUBTREE, filter,
+                            group_attr, &direct, metrics);
+    if (rc == LDAPQUERY_TRUE) {
+      rc = graph->is_member(
+          direct, groups,
+          [ld, &host, &group_attr, metrics](const std::string &dn,
+                                            std::set<std::string> *parents) {
+            return ldap_search_values(ld, host, dn, LDAP_SCOPE_BASE,
+                                      "(objectClass=*)", group_attr, parents,
+                                      metrics);
+          });
+    }
+  }
+
   ldap_unbind_ext_s(ld, NULL, NULL);
   return rc;
 }
+
+std::string ldap_escape_filter(const std::string &value) {
+  static const char hex[] = "0123456789abcdef";
+  std::string result;
+  result.reserve(value.length());
+  for (char c : value) {
+    if (c == '*' || c == '(' || c == ')' || c == '\\' || c == '\0') {
+      result.push_back('\\');
+      result.push_back(hex[(c >> 4) & 0xf]);
+      result.push_back(hex[c & 0xf]);
+    } else {
+      result.push_back(c);
+    }
+  }
+  return result;
+}
@@ -5,11 +5,41 @@
 #define LDAPQUERY_TRUE 1
 #define LDAPQUERY_FALSE 0
 
+#include <atomic>
+#include <map>
+#include <set>
 #include <string>
 
+class GroupGraph;
+class LoginMetrics;
+
 int ldap_check_attr(const std::string &host, const std::string &basedn,
                     const std::string &user, const std::string &passwd,
                     const std::string &filter, const std::string &attr,
-                    const std::string &value);
+                    const std::string &value, LoginMetrics *metrics = NULL);
+
+// Pages through every entry matching filter and collects the values of
+// attr for each value of key_attr. Stops with LDAPQUERY_ERROR after the
+// current page once cancel is set.
+int ldap_get_mapping(const std::string &host, const std::string &basedn,
+                     const std::string &user, const std::string &passwd,
+                     const std::string &filter, const std::string &key_attr,
+                     const std::string &attr,
+                     std::map<std::string, std::set<std::string>> *mapping,
+                     LoginMetrics *metrics = NULL,
+                     const std::atomic<bool> *cancel = NULL);
+
+// Checks whether the entry matching filter is a member of one of groups,
+// directly or through nested groups. With in_chain the server resolves the
+// nesting (matching rule 1.2.840.113556.1.4.1941), otherwise the group_attr
+// values are walked upwards through graph.
+int ldap_check_group(const std::string &host, const std::string &basedn,
+                     const std::string &user, const std::string &passwd,
+                     const std::string &filter, const std::string &group_attr,
+                     const std::set<std::string> &groups, bool in_chain,
+                     GroupGraph *graph, LoginMetrics *metrics = NULL);
+
+// Escapes a value to be used in a search filter (RFC 4515).
+std::string ldap_escape_filter(const std::string &value);
 
 #endif  // PAM_OAUTH2_DEVICE_LDAPQUERY_H
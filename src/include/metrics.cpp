@@ -0,0 +1,152 @@
+#include "metrics.hpp"
+
+#include <stdio.h>
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+typedef std::chrono::duration<double, std::milli> Milliseconds;
+
+static std::string format_ms(double ms) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.3f", ms);
+  return buffer;
+}
+
+static std::string quote(const std::string &value) {
+  if (!value.empty() && value.find_first_of(" \t\"=\\") == std::string::npos) {
+    return value;
+  }
+  std::string result("\"");
+  for (char c : value) {
+    if (c == '"' || c == '\\') result.push_back('\\');
+    result.push_back(c);
+  }
+  result.push_back('"');
+  return result;
+}
+
+LoginMetrics::LoginMetrics()
+    : start(std::chrono::steady_clock::now()), login_trace(NULL) {}
+
+double LoginMetrics::elapsed_ms() const {
+  return Milliseconds(std::chrono::steady_clock::now() - start).count();
+}
+
+LoginMetrics::Field &LoginMetrics::find(const std::string &key, Kind kind) {
+  for (auto &field : fields) {
+    if (field.key == key) return field;
+  }
+  Field field;
+  field.key = key;
+  field.kind = kind;
+  field.ms = 0;
+  field.count = 0;
+  fields.push_back(field);
+  return fields.back();
+}
+
+void LoginMetrics::add_ms(const std::string &key, double ms) {
+  std::lock_guard<std::mutex> lock(mutex);
+  find(key, MS).ms += ms;
+}
+
+void LoginMetrics::add_sample(const std::string &key, const std::string &label,
+                              double ms) {
+  std::lock_guard<std::mutex> lock(mutex);
+  find(key, SAMPLES).samples.push_back(std::make_pair(label, ms));
+}
+
+void LoginMetrics::add_count(const std::string &key, long count) {
+  std::lock_guard<std::mutex> lock(mutex);
+  find(key, COUNT).count += count;
+}
+
+void LoginMetrics::set(const std::string &key, const std::string &value) {
+  std::lock_guard<std::mutex> lock(mutex);
+  find(key, TEXT).text = value;
+}
+
+std::string LoginMetrics::record() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::string result;
+  for (auto &field : fields) {
+    if (!result.empty()) result.push_back(' ');
+    result.append(field.key).push_back('=');
+    if (field.kind == MS) {
+      result.append(format_ms(field.ms));
+    } else if (field.kind == COUNT) {
+      result.append(std::to_string(field.count));
+    } else if (field.kind == TEXT) {
+      result.append(quote(field.text));
+    } else {
+      for (size_t i = 0; i < field.samples.size(); ++i) {
+        if (i > 0) result.push_back(',');
+        auto &sample = field.samples[i];
+        if (!sample.first.empty()) result.append(sample.first).push_back('@');
+        result.append(format_ms(sample.second));
+      }
+    }
+  }
+  return result;
+}
+
+std::vector<LoginMetrics::Field> LoginMetrics::snapshot() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return fields;
+}
+
+void LoginMetrics::set_trace(LoginTrace *trace) { login_trace = trace; }
+
+LoginTrace *LoginMetrics::trace() const { return login_trace; }
+
+PhaseTimer::PhaseTimer(LoginMetrics *metrics, const std::string &key,
+                       const char *span)
+    : metrics(metrics),
+      key(key),
+      start(std::chrono::steady_clock::now()),
+      running(true) {
+  if (metrics == NULL || metrics->trace() == NULL) return;
+  this->span.reset(new TraceSpan());
+  if (span != NULL) {
+    this->span->name = span;
+  } else {
+    this->span->name = key.substr(0, key.rfind("_ms"));
+  }
+  this->span->span_id = LoginTrace::new_span_id();
+  this->span->client = false;
+  this->span->error = false;
+}
+
+PhaseTimer::~PhaseTimer() { stop(); }
+
+double PhaseTimer::stop() {
+  auto end = std::chrono::steady_clock::now();
+  double ms = Milliseconds(end - start).count();
+  if (running && metrics != NULL) {
+    if (!key.empty()) metrics->add_ms(key, ms);
+    if (span) {
+      span->start = start;
+      span->end = end;
+      metrics->trace()->add(*span);
+    }
+  }
+  running = false;
+  return ms;
+}
+
+std::string PhaseTimer::client() {
+  if (!span) return "";
+  span->client = true;
+  return metrics->trace()->traceparent(span->span_id);
+}
+
+void PhaseTimer::attribute(const std::string &key, const std::string &value) {
+  if (span) span->attributes.push_back(std::make_pair(key, value));
+}
+
+void PhaseTimer::fail() {
+  if (span) span->error = true;
+}
@@ -0,0 +1,83 @@
+#ifndef PAM_OAUTH2_DEVICE_METRICS_HPP
+#define PAM_OAUTH2_DEVICE_METRICS_HPP
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "trace.hpp"
+
+// Timings and counters of one login, logged as a single record of key=value
+// fields in the order they were first added. Phases running more than once
+// add up, samples list each run. Safe to use from several threads.
+class LoginMetrics {
+ public:
+  enum Kind { MS, COUNT, TEXT, SAMPLES };
+  struct Field {
+    std::string key;
+    Kind kind;
+    double ms;
+    long count;
+    std::string text;
+    // Labels and milliseconds
+    std::vector<std::pair<std::string, double>> samples;
+  };
+
+  LoginMetrics();
+  // Milliseconds since the login started
+  double elapsed_ms() const;
+  void add_ms(const std::string &key, double ms);
+  // Appends label@ms, or ms alone without a label, to a comma-separated list
+  void add_sample(const std::string &key, const std::string &label,
+                  double ms);
+  void add_count(const std::string &key, long count);
+  void set(const std::string &key, const std::string &value);
+  // Returns the fields, values with spaces, quotes or '=' are quoted
+  std::string record() const;
+  // Returns a copy of the fields
+  std::vector<Field> snapshot() const;
+  // Phases also become spans of the trace, which may be NULL
+  void set_trace(LoginTrace *trace);
+  LoginTrace *trace() const;
+
+ private:
+  Field &find(const std::string &key, Kind kind);
+
+  std::chrono::steady_clock::time_point start;
+  std::vector<Field> fields;
+  LoginTrace *login_trace;
+  mutable std::mutex mutex;
+};
+
+// Adds the time from construction to stop() or destruction to a phase of
+// the metrics, which may be NULL, and a span to their trace. The span is
+// named span, by default the key without "_ms". Without a key the phase is
+// only traced.
+class PhaseTimer {
+ public:
+  PhaseTimer(LoginMetrics *metrics, const std::string &key,
+             const char *span = NULL);
+  ~PhaseTimer();
+  // Ends the phase early, returns its milliseconds
+  double stop();
+  // Marks the span a request to a server, returns the traceparent header
+  // to send with it, "" when the login is not traced
+  std::string client();
+  void attribute(const std::string &key, const std::string &value);
+  void fail();
+
+ private:
+  PhaseTimer(const PhaseTimer &);
+  PhaseTimer &operator=(const PhaseTimer &);
+
+  LoginMetrics *metrics;
+  std::string key;
+  std::chrono::steady_clock::time_point start;
+  bool running;
+  std::unique_ptr<TraceSpan> span;
+};
+
+#endif  // PAM_OAUTH2_DEVICE_METRICS_HPP
@@ -28,14 +28,81 @@
 namespace qrcodegen {
 
 BitBuffer::BitBuffer()
-	: std::vector<bool>() {}
+	: bitLength(0) {}
 
 
 void BitBuffer::appendBits(std::uint32_t val, int len) {
-	if (len < 0 || len > 31 || val >> len != 0)
+	if (len < 0 || len > 32 || (len < 32 && val >> len != 0))
 		throw std::domain_error("Value out of range");
-	for (int i = len - 1; i >= 0; i--)  // Append bit by bit
-		this->push_back(((val >> i) & 1) != 0);
+	if (len > 0)
+		appendWord(static_cast<std::uint64_t>(val) << (64 - len), len);
+}
+
+
+void BitBuffer::appendBytes(const std::uint8_t *data, std::size_t len) {
+	if (bitLength % 8 != 0) {  // Unaligned, shift each byte into place
+		for (std::size_t i = 0; i < len; i++)
+			appendWord(static_cast<std::uint64_t>(data[i]) << 56, 8);
+		return;
+	}
+	std::size_t pos = bitLength / 8;  // Byte index of the next bit
+	words.resize((pos + len + 7) / 8, 0);
+	std::size_t i = 0;
+	for (; i < len && (pos + i) % 8 != 0; i++)  // Fill up the partial last word
+		words[(pos + i) / 8] |= static_cast<std::uint64_t>(data[i]) << (56 - (pos + i) % 8 * 8);
+	for (; i + 8 <= len; i += 8) {  // Whole words
+		std::uint64_t word = 0;
+		for (int j = 0; j < 8; j++)
+			word = (word << 8) | data[i + j];
+		words[(pos + i) / 8] = word;
+	}
+	for (; i < len; i++)
+		words[(pos + i) / 8] |= static_cast<std::uint64_t>(data[i]) << (56 - (pos + i) % 8 * 8);
+	bitLength += len * 8;
+}
+
+
+void BitBuffer::appendData(const BitBuffer &other) {
+	if (bitLength % 64 == 0) {  // Aligned, copy the words as they are
+		words.insert(words.end(), other.words.begin(), other.words.end());
+		bitLength += other.bitLength;
+		return;
+	}
+	for (std::size_t i = 0; i < other.words.size(); i++) {
+		std::size_t remaining = other.bitLength - i * 64;
+		appendWord(other.words[i], remaining < 64 ? static_cast<int>(remaining) : 64);
+	}
+}
+
+
+std::size_t BitBuffer::size() const {
+	return bitLength;
+}
+
+
+bool BitBuffer::getBit(std::size_t index) const {
+	if (index >= bitLength)
+		throw std::out_of_range("Bit index out of range");
+	return ((words[index >> 6] >> (63 - (index & 63))) & 1) != 0;
+}
+
+
+void BitBuffer::getBytes(std::uint8_t result[]) const {
+	for (std::size_t i = 0; i < (bitLength + 7) / 8; i++)
+		result[i] = static_cast<std::uint8_t>(words[i / 8] >> (56 - i % 8 * 8));
+}
+
+
+void BitBuffer::appendWord(std::uint64_t word, int len) {
+	int used = static_cast<int>(bitLength % 64);
+	if (used == 0)
+		words.push_back(word);
+	else {
+		words.back() |= word >> used;
+		if (len > 64 - used)  // Spills over into a new word
+			words.push_back(word << (64 - used));
+	}
+	bitLength += len;
 }
 
 }
@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
@@ -31,8 +32,19 @@ namespace qrcodegen {
 
 /* 
  * An appendable sequence of bits (0s and 1s). Mainly used by QrSegment.
+ * The bits are packed into 64-bit words, the first bit in the most significant bit of the first word.
  */
-class BitBuffer final : public std::vector<bool> {
+class BitBuffer final {
+	
+	/*---- Fields ----*/
+	
+	// The packed bits. The unused low-order bits of the last word are always zero.
+	private: std::vector<std::uint64_t> words;
+	
+	// The number of bits appended so far.
+	private: std::size_t bitLength;
+	
+	
 	
 	/*---- Constructor ----*/
 	
@@ -41,12 +53,39 @@ class BitBuffer final : public std::vector<bool> {
 	
 	
 	
-	/*---- Method ----*/
+	/*---- Methods ----*/
 	
 	// Appends the given number of low-order bits of the given value
-	// to this buffer. Requires 0 <= len <= 31 and val < 2^len.
+	// to this buffer. Requires 0 <= len <= 32 and val < 2^len.
 	public: void appendBits(std::uint32_t val, int len);
 	
+	
+	// Appends the given bytes, 8 bits each. When this buffer ends at a byte
+	// boundary the bytes are copied a word at a time instead of bit by bit.
+	public: void appendBytes(const std::uint8_t *data, std::size_t len);
+	
+	
+	// Appends all bits of the given buffer to this buffer.
+	public: void appendData(const BitBuffer &other);
+	
+	
+	// Returns the number of bits in this buffer.
+	public: std::size_t size() const;
+	
+	
+	// Returns the bit at the given index. Requires index < size().
+	public: bool getBit(std::size_t index) const;
+	
+	
+	// Writes the bits to the given array in big endian, 8 bits per byte. The array must hold
+	// (size() + 7) / 8 bytes, the low-order bits of the last byte are zero if size() % 8 != 0.
+	public: void getBytes(std::uint8_t result[]) const;
+	
+	
+	// Appends the given number of high-order bits of the given word. Requires
+	// 0 < len <= 64, the remaining low-order bits of the word must be zero.
+	private: void appendWord(std::uint64_t word, int len);
+	
 };
 
 }
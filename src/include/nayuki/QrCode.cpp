@@ -25,13 +25,19 @@
 #include <climits>
 #include <cstddef>
 #include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <mutex>
 #include <sstream>
+#include <system_error>
+#include <thread>
 #include <utility>
 #include "BitBuffer.hpp"
 #include "QrCode.hpp"
 
 using std::int8_t;
 using std::uint8_t;
+using std::uint64_t;
 using std::size_t;
 using std::vector;
 
@@ -62,33 +68,35 @@ QrCode QrCode::encodeBinary(const vector<uint8_t> &data, Ecc ecl) {
 
 
 QrCode QrCode::encodeSegments(const vector<QrSegment> &segs, Ecc ecl,
-		int minVersion, int maxVersion, int mask, bool boostEcl) {
+		int minVersion, int maxVersion, int mask, bool boostEcl, MaskSearch maskSearch) {
 	if (!(MIN_VERSION <= minVersion && minVersion <= maxVersion && maxVersion <= MAX_VERSION) || mask < -1 || mask > 7)
 		throw std::invalid_argument("Invalid value");
 	
-	// Find the minimal version number to use
+	// Find the minimal version number to use, searching the versions with the same
+	// character count field widths at once
 	int version, dataUsedBits;
-	for (version = minVersion; ; version++) {
-		int dataCapacityBits = getNumDataCodewords(version, ecl) * 8;  // Number of data bits available
-		dataUsedBits = QrSegment::getTotalBits(segs, version);
-		if (dataUsedBits != -1 && dataUsedBits <= dataCapacityBits)
+	for (int rangeStart = minVersion; ; ) {
+		int rangeEnd = std::min(getCharCountRangeEnd(rangeStart), maxVersion);
+		dataUsedBits = QrSegment::getTotalBits(segs, rangeStart);
+		version = dataUsedBits == -1 ? -1 : getMinVersion(dataUsedBits, ecl, rangeStart, rangeEnd);
+		if (version != -1)
 			break;  // This version number is found to be suitable
-		if (version >= maxVersion) {  // All versions in the range could not fit the given data
+		if (rangeEnd >= maxVersion) {  // All versions in the range could not fit the given data
 			std::ostringstream sb;
 			if (dataUsedBits == -1)
 				sb << "Segment too long";
 			else {
 				sb << "Data length = " << dataUsedBits << " bits, ";
-				sb << "Max capacity = " << dataCapacityBits << " bits";
+				sb << "Max capacity = " << getNumDataCodewords(maxVersion, ecl) * 8 << " bits";
 			}
 			throw data_too_long(sb.str());
 		}
+		rangeStart = rangeEnd + 1;
 	}
-	if (dataUsedBits == -1)
-		throw std::logic_error("Assertion error");
 	
 	// Increase the error correction level while the data still fits in the current version number
-	for (Ecc newEcl : vector<Ecc>{Ecc::MEDIUM, Ecc::QUARTILE, Ecc::HIGH}) {  // From low to high
+	static const Ecc higherEcls[] = {Ecc::MEDIUM, Ecc::QUARTILE, Ecc::HIGH};  // From low to high
+	for (Ecc newEcl : higherEcls) {
 		if (boostEcl && dataUsedBits <= getNumDataCodewords(version, newEcl) * 8)
 			ecl = newEcl;
 	}
@@ -98,7 +106,7 @@ QrCode QrCode::encodeSegments(const vector<QrSegment> &segs, Ecc ecl,
 	for (const QrSegment &seg : segs) {
 		bb.appendBits(seg.getMode().getModeBits(), 4);
 		bb.appendBits(seg.getNumChars(), seg.getMode().numCharCountBits(version));
-		bb.insert(bb.end(), seg.getData().begin(), seg.getData().end());
+		bb.appendData(seg.getData());
 	}
 	if (bb.size() != static_cast<unsigned int>(dataUsedBits))
 		throw std::logic_error("Assertion error");
@@ -118,15 +126,102 @@ QrCode QrCode::encodeSegments(const vector<QrSegment> &segs, Ecc ecl,
 	
 	// Pack bits into bytes in big endian
 	vector<uint8_t> dataCodewords(bb.size() / 8);
-	for (size_t i = 0; i < bb.size(); i++)
-		dataCodewords[i >> 3] |= (bb.at(i) ? 1 : 0) << (7 - (i & 7));
+	bb.getBytes(dataCodewords.data());
 	
 	// Create the QR Code object
-	return QrCode(version, ecl, dataCodewords, mask);
+	return QrCode(version, ecl, dataCodewords, mask, maskSearch);
+}
+
+
+QrCode::Status QrCode::encodeText(const char *text, Ecc ecl, QrCode &result,
+		int minVersion, int maxVersion, int mask, bool boostEcl, bool optimalSegments, MaskSearch maskSearch) {
+	if (!(MIN_VERSION <= minVersion && minVersion <= maxVersion && maxVersion <= MAX_VERSION) || mask < -1 || mask > 7)
+		return Status::INVALID_ARGUMENT;
+	size_t numChars = std::strlen(text);
+	if (numChars > static_cast<unsigned int>(MAX_TEXT_LENGTH))
+		return Status::DATA_TOO_LONG;
+	
+	// The mode indicator of each character. Without optimal segments, select one mode for the
+	// whole text like QrSegment::makeSegments(), an empty text has no segment.
+	uint8_t modes[MAX_TEXT_LENGTH];
+	if (!optimalSegments) {
+		const QrSegment::Mode &mode = QrSegment::isNumeric(text) ? QrSegment::Mode::NUMERIC :
+			QrSegment::isAlphanumeric(text) ? QrSegment::Mode::ALPHANUMERIC : QrSegment::Mode::BYTE;
+		std::fill(modes, modes + numChars, static_cast<uint8_t>(mode.getModeBits()));
+	}
+	
+	// Find the minimal version number to use, the optimal segments only change where
+	// the width of the character count fields does
+	int version, dataUsedBits;
+	for (int rangeStart = minVersion; ; ) {
+		int rangeEnd = std::min(getCharCountRangeEnd(rangeStart), maxVersion);
+		dataUsedBits = optimalSegments ?
+			QrSegment::computeOptimalModes(text, numChars, rangeStart, modes) :
+			QrSegment::getTotalBits(modes, numChars, rangeStart);
+		version = dataUsedBits == -1 ? -1 : getMinVersion(dataUsedBits, ecl, rangeStart, rangeEnd);
+		if (version != -1)
+			break;  // This version number is found to be suitable
+		if (rangeEnd >= maxVersion)  // All versions in the range could not fit the given data
+			return Status::DATA_TOO_LONG;
+		rangeStart = rangeEnd + 1;
+	}
+	
+	// Increase the error correction level while the data still fits in the current version number
+	static const Ecc higherEcls[] = {Ecc::MEDIUM, Ecc::QUARTILE, Ecc::HIGH};  // From low to high
+	for (Ecc newEcl : higherEcls) {
+		if (boostEcl && dataUsedBits <= getNumDataCodewords(version, newEcl) * 8)
+			ecl = newEcl;
+	}
+	
+	// Write the segments, terminator and padding into the data codewords
+	uint8_t dataCodewords[MAX_RAW_CODEWORDS] = {};
+	int bitLen = 0;
+	for (size_t start = 0, end; start < numChars; start = end) {
+		for (end = start + 1; end < numChars && modes[end] == modes[start]; end++);
+		const QrSegment::Mode &mode = modes[start] == QrSegment::Mode::NUMERIC.getModeBits() ? QrSegment::Mode::NUMERIC :
+			modes[start] == QrSegment::Mode::ALPHANUMERIC.getModeBits() ? QrSegment::Mode::ALPHANUMERIC : QrSegment::Mode::BYTE;
+		appendBits(mode.getModeBits(), 4, dataCodewords, bitLen);
+		appendBits(static_cast<uint32_t>(end - start), mode.numCharCountBits(version), dataCodewords, bitLen);
+		if (&mode == &QrSegment::Mode::NUMERIC) {
+			for (size_t i = start; i < end; i += 3) {
+				int n = std::min<int>(3, static_cast<int>(end - i));
+				uint32_t value = 0;
+				for (int j = 0; j < n; j++)
+					value = value * 10 + (text[i + j] - '0');
+				appendBits(value, n * 3 + 1, dataCodewords, bitLen);
+			}
+		} else if (&mode == &QrSegment::Mode::ALPHANUMERIC) {
+			for (size_t i = start; i < end; i += 2) {
+				int n = std::min<int>(2, static_cast<int>(end - i));
+				uint32_t value = 0;
+				for (int j = 0; j < n; j++)
+					value = value * 45 + (std::strchr(QrSegment::ALPHANUMERIC_CHARSET, text[i + j]) - QrSegment::ALPHANUMERIC_CHARSET);
+				appendBits(value, n * 5 + 1, dataCodewords, bitLen);
+			}
+		} else {
+			for (size_t i = start; i < end; i++)
+				appendBits(static_cast<uint8_t>(text[i]), 8, dataCodewords, bitLen);
+		}
+	}
+	if (bitLen != dataUsedBits)
+		throw std::logic_error("Assertion error");
+	int dataCapacityBits = getNumDataCodewords(version, ecl) * 8;
+	appendBits(0, std::min(4, dataCapacityBits - bitLen), dataCodewords, bitLen);
+	appendBits(0, (8 - bitLen % 8) % 8, dataCodewords, bitLen);
+	for (uint8_t padByte = 0xEC; bitLen < dataCapacityBits; padByte ^= 0xEC ^ 0x11)
+		appendBits(padByte, 8, dataCodewords, bitLen);
+	
+	// Draw the QR Code into the result
+	result.version = version;
+	result.size = version * 4 + 17;
+	result.stride = (result.size + 63) / 64;
+	result.errorCorrectionLevel = ecl;
+	result.drawQrCode(dataCodewords, mask, maskSearch);
+	return Status::OK;
 }
 
 
-QrCode::QrCode(int ver, Ecc ecl, const vector<uint8_t> &dataCodewords, int mask) :
+QrCode::QrCode(int ver, Ecc ecl, const vector<uint8_t> &dataCodewords, int mask, MaskSearch maskSearch) :
 		// Initialize fields and check arguments
 		version(ver),
 		errorCorrectionLevel(ecl) {
@@ -134,22 +229,75 @@ QrCode::QrCode(int ver, Ecc ecl, const vector<uint8_t> &dataCodewords, int mask)
 		throw std::domain_error("Version value out of range");
 	if (mask < -1 || mask > 7)
 		throw std::domain_error("Mask value out of range");
+	if (dataCodewords.size() != static_cast<unsigned int>(getNumDataCodewords(ver, ecl)))
+		throw std::invalid_argument("Invalid argument");
 	size = ver * 4 + 17;
-	modules    = vector<vector<bool> >(size, vector<bool>(size));  // Initially all white
-	isFunction = vector<vector<bool> >(size, vector<bool>(size));
-	
-	// Compute ECC, draw modules
-	drawFunctionPatterns();
-	const vector<uint8_t> allCodewords = addEccAndInterleave(dataCodewords);
-	drawCodewords(allCodewords);
+	stride = (size + 63) / 64;
+	drawQrCode(dataCodewords.data(), mask, maskSearch);
+}
+
+
+QrCode::QrCode() :
+		version(1),
+		size(21),
+		errorCorrectionLevel(Ecc::LOW),
+		mask(0),
+		stride(1),
+		modules(),  // All white
+		isFunction() {}
+
+
+void QrCode::drawQrCode(const uint8_t *dataCodewords, int mask, MaskSearch maskSearch) {
+	// Start from the function modules of the version, compute ECC, draw codewords
+	const FunctionTemplate &tmpl = getFunctionTemplate(version);
+	size_t words = static_cast<size_t>(size) * stride;
+	std::copy(tmpl.modules   .begin(), tmpl.modules   .end(), modules);
+	std::copy(tmpl.isFunction.begin(), tmpl.isFunction.end(), isFunction);
+	std::fill(modules    + words, modules    + MAX_WORDS, 0);
+	std::fill(isFunction + words, isFunction + MAX_WORDS, 0);
+	uint8_t allCodewords[MAX_RAW_CODEWORDS];
+	addEccAndInterleave(dataCodewords, allCodewords);
+	drawCodewords(allCodewords, tmpl);
 	
 	// Do masking
+	if (mask == -1 && maskSearch == MaskSearch::PARALLEL) {
+		long penalties[8];
+		std::exception_ptr errors[8];
+		vector<std::thread> workers;
+		workers.reserve(8);
+		try {
+			for (int i = 0; i < 8; i++) {
+				workers.emplace_back([this, i, &penalties, &errors]() {
+					try {
+						penalties[i] = getMaskedPenaltyScore(i);
+					} catch (...) {
+						errors[i] = std::current_exception();
+					}
+				});
+			}
+		} catch (const std::system_error &) {
+			// Could not start a thread, score the remaining masks here
+			for (size_t i = workers.size(); i < 8; i++)
+				penalties[i] = getMaskedPenaltyScore(static_cast<int>(i));
+		}
+		for (std::thread &worker : workers)
+			worker.join();
+		long minPenalty = LONG_MAX;
+		for (int i = 0; i < 8; i++) {
+			if (errors[i])
+				std::rethrow_exception(errors[i]);
+			if (penalties[i] < minPenalty) {  // Ties keep the lower mask, like the serial search
+				mask = i;
+				minPenalty = penalties[i];
+			}
+		}
+	}
 	if (mask == -1) {  // Automatically choose best mask
 		long minPenalty = LONG_MAX;
 		for (int i = 0; i < 8; i++) {
 			applyMask(i);
 			drawFormatBits(i);
-			long penalty = getPenaltyScore();
+			long penalty = maskSearch == MaskSearch::FAST ? getSampledPenaltyScore() : getPenaltyScore();
 			if (penalty < minPenalty) {
 				mask = i;
 				minPenalty = penalty;
@@ -162,9 +310,18 @@ QrCode::QrCode(int ver, Ecc ecl, const vector<uint8_t> &dataCodewords, int mask)
 	this->mask = mask;
 	applyMask(mask);  // Apply the final choice of mask
 	drawFormatBits(mask);  // Overwrite old format bits
-	
-	isFunction.clear();
-	isFunction.shrink_to_fit();
+}
+
+
+QrCode::QrCode(int ver) :
+		version(ver),
+		size(ver * 4 + 17),
+		errorCorrectionLevel(Ecc::LOW),
+		mask(0),
+		stride((size + 63) / 64),
+		modules(),  // Initially all white
+		isFunction() {
+	drawFunctionPatterns();
 }
 
 
@@ -193,6 +350,23 @@ bool QrCode::getModule(int x, int y) const {
 }
 
 
+uint64_t QrCode::getRowWord(int y, int i) const {
+	if (y < 0 || y >= size || i < 0 || i >= stride)
+		return 0;
+	return modules[static_cast<size_t>(y) * stride + i];
+}
+
+
+uint64_t QrCode::getColumnWord(int x, int i) const {
+	if (x < 0 || x >= size || i < 0 || i >= stride)
+		return 0;
+	uint64_t result = 0;
+	for (int j = 0, y = i * 64; j < 64 && y < size; j++, y++)
+		result |= ((modules[static_cast<size_t>(y) * stride + (x >> 6)] >> (x & 63)) & 1) << j;
+	return result;
+}
+
+
 std::string QrCode::toSvgString(int border) const {
 	if (border < 0)
 		throw std::domain_error("Border must be non-negative");
@@ -221,6 +395,46 @@ std::string QrCode::toSvgString(int border) const {
 }
 
 
+const QrCode::FunctionTemplate &QrCode::getFunctionTemplate(int ver) {
+	if (ver < MIN_VERSION || ver > MAX_VERSION)
+		throw std::domain_error("Version value out of range");
+	static FunctionTemplate templates[MAX_VERSION + 1];
+	static std::once_flag built[MAX_VERSION + 1];
+	std::call_once(built[ver], [ver]() {
+		QrCode qr(ver);
+		FunctionTemplate &tmpl = templates[ver];
+		
+		// Do the funny zigzag scan over the modules not marked as function modules
+		tmpl.dataModules.reserve(getNumRawDataModules(ver));
+		for (int right = qr.size - 1; right >= 1; right -= 2) {  // Index of right column in each column pair
+			if (right == 6)
+				right = 5;
+			for (int vert = 0; vert < qr.size; vert++) {  // Vertical counter
+				for (int j = 0; j < 2; j++) {
+					int x = right - j;  // Actual x coordinate
+					bool upward = ((right + 1) & 2) == 0;
+					int y = upward ? qr.size - 1 - vert : vert;  // Actual y coordinate
+					int index = y * qr.stride * 64 + x;
+					if (((qr.isFunction[index >> 6] >> (index & 63)) & 1) == 0)
+						tmpl.dataModules.push_back(static_cast<uint16_t>(index));
+				}
+			}
+		}
+		if (tmpl.dataModules.size() != static_cast<unsigned int>(getNumRawDataModules(ver)))
+			throw std::logic_error("Assertion error");
+		for (int e = 0; e < 4; e++) {  // The capacity table must agree with the ECC tables
+			if (DATA_CODEWORDS[e][ver] != getNumRawDataModules(ver) / 8
+					- ECC_CODEWORDS_PER_BLOCK[e][ver] * NUM_ERROR_CORRECTION_BLOCKS[e][ver])
+				throw std::logic_error("Assertion error");
+		}
+		size_t words = static_cast<size_t>(qr.size) * qr.stride;
+		tmpl.modules   .assign(qr.modules   , qr.modules    + words);
+		tmpl.isFunction.assign(qr.isFunction, qr.isFunction + words);
+	});
+	return templates[ver];
+}
+
+
 void QrCode::drawFunctionPatterns() {
 	// Draw horizontal and vertical timing patterns
 	for (int i = 0; i < size; i++) {
@@ -322,101 +536,78 @@ void QrCode::drawAlignmentPattern(int x, int y) {
 
 
 void QrCode::setFunctionModule(int x, int y, bool isBlack) {
-	modules.at(y).at(x) = isBlack;
-	isFunction.at(y).at(x) = true;
+	size_t i = static_cast<size_t>(y) * stride + (x >> 6);
+	uint64_t bit = static_cast<uint64_t>(1) << (x & 63);
+	if (isBlack)
+		modules[i] |= bit;
+	else
+		modules[i] &= ~bit;
+	isFunction[i] |= bit;
 }
 
 
 bool QrCode::module(int x, int y) const {
-	return modules.at(y).at(x);
+	return ((modules[static_cast<size_t>(y) * stride + (x >> 6)] >> (x & 63)) & 1) != 0;
 }
 
 
-vector<uint8_t> QrCode::addEccAndInterleave(const vector<uint8_t> &data) const {
-	if (data.size() != static_cast<unsigned int>(getNumDataCodewords(version, errorCorrectionLevel)))
-		throw std::invalid_argument("Invalid argument");
-	
+void QrCode::addEccAndInterleave(const uint8_t *data, uint8_t *result) const {
 	// Calculate parameter numbers
 	int numBlocks = NUM_ERROR_CORRECTION_BLOCKS[static_cast<int>(errorCorrectionLevel)][version];
 	int blockEccLen = ECC_CODEWORDS_PER_BLOCK  [static_cast<int>(errorCorrectionLevel)][version];
 	int rawCodewords = getNumRawDataModules(version) / 8;
 	int numShortBlocks = numBlocks - rawCodewords % numBlocks;
 	int shortBlockLen = rawCodewords / numBlocks;
+	int shortDataLen = shortBlockLen - blockEccLen;
+	int numDataCodewords = getNumDataCodewords(version, errorCorrectionLevel);
 	
-	// Split data into blocks and append ECC to each block
-	vector<vector<uint8_t> > blocks;
-	const ReedSolomonGenerator rs(blockEccLen);
-	for (int i = 0, k = 0; i < numBlocks; i++) {
-		vector<uint8_t> dat(data.cbegin() + k, data.cbegin() + (k + shortBlockLen - blockEccLen + (i < numShortBlocks ? 0 : 1)));
-		k += dat.size();
-		const vector<uint8_t> ecc = rs.getRemainder(dat);
-		if (i < numShortBlocks)
-			dat.push_back(0);
-		dat.insert(dat.end(), ecc.cbegin(), ecc.cend());
-		blocks.push_back(std::move(dat));
-	}
-	
-	// Interleave (not concatenate) the bytes from every block into a single sequence
-	vector<uint8_t> result;
-	for (size_t i = 0; i < blocks.at(0).size(); i++) {
-		for (size_t j = 0; j < blocks.size(); j++) {
-			// Skip the padding byte in short blocks
-			if (i != static_cast<unsigned int>(shortBlockLen - blockEccLen) || j >= static_cast<unsigned int>(numShortBlocks))
-				result.push_back(blocks.at(j).at(i));
-		}
+	// Interleave (not concatenate) the bytes from every block into a single sequence, writing
+	// each block directly to its positions. Data byte i of block j goes to i * numBlocks + j,
+	// except the last data byte of the long blocks, which follows those of all blocks. The ECC
+	// bytes follow all data bytes, byte i of block j at numDataCodewords + i * numBlocks + j.
+	const ReedSolomonGenerator &rs = ReedSolomonGenerator::get(blockEccLen);
+	uint8_t ecc[ReedSolomonGenerator::MAX_DEGREE];
+	for (int j = 0, k = 0; j < numBlocks; j++) {
+		int datLen = shortDataLen + (j < numShortBlocks ? 0 : 1);
+		const uint8_t *dat = &data[k];
+		k += datLen;
+		for (int i = 0; i < shortDataLen; i++)
+			result[i * numBlocks + j] = dat[i];
+		if (j >= numShortBlocks)
+			result[shortDataLen * numBlocks + j - numShortBlocks] = dat[shortDataLen];
+		rs.getRemainder(dat, datLen, ecc);
+		for (int i = 0; i < blockEccLen; i++)
+			result[numDataCodewords + i * numBlocks + j] = ecc[i];
 	}
-	if (result.size() != static_cast<unsigned int>(rawCodewords))
-		throw std::logic_error("Assertion error");
-	return result;
 }
 
 
-void QrCode::drawCodewords(const vector<uint8_t> &data) {
-	if (data.size() != static_cast<unsigned int>(getNumRawDataModules(version) / 8))
-		throw std::invalid_argument("Invalid argument");
-	
-	size_t i = 0;  // Bit index into the data
-	// Do the funny zigzag scan
-	for (int right = size - 1; right >= 1; right -= 2) {  // Index of right column in each column pair
-		if (right == 6)
-			right = 5;
-		for (int vert = 0; vert < size; vert++) {  // Vertical counter
-			for (int j = 0; j < 2; j++) {
-				int x = right - j;  // Actual x coordinate
-				bool upward = ((right + 1) & 2) == 0;
-				int y = upward ? size - 1 - vert : vert;  // Actual y coordinate
-				if (!isFunction.at(y).at(x) && i < data.size() * 8) {
-					modules.at(y).at(x) = getBit(data.at(i >> 3), 7 - static_cast<int>(i & 7));
-					i++;
-				}
-				// If this QR Code has any remainder bits (0 to 7), they were assigned as
-				// 0/false/white by the constructor and are left unchanged by this method
-			}
+void QrCode::drawCodewords(const uint8_t *data, const FunctionTemplate &tmpl) {
+	// If this QR Code has any remainder bits (0 to 7), they are at the end of the data
+	// module list, and are left as 0/false/white by this method
+	const uint16_t *position = tmpl.dataModules.data();
+	for (size_t j = 0, len = tmpl.dataModules.size() / 8; j < len; j++) {
+		uint8_t b = data[j];
+		for (int i = 7; i >= 0; i--, position++) {
+			if (getBit(b, i))
+				modules[*position >> 6] |= static_cast<uint64_t>(1) << (*position & 63);
 		}
 	}
-	if (i != data.size() * 8)
-		throw std::logic_error("Assertion error");
 }
 
 
 void QrCode::applyMask(int mask) {
 	if (mask < 0 || mask > 7)
 		throw std::domain_error("Mask value out of range");
+	// Only the columns inside the grid of the last word of a row are masked
+	uint64_t lastWordBits = ~static_cast<uint64_t>(0) >> (stride * 64 - size);
 	for (int y = 0; y < size; y++) {
-		for (int x = 0; x < size; x++) {
-			bool invert;
-			switch (mask) {
-				case 0:  invert = (x + y) % 2 == 0;                    break;
-				case 1:  invert = y % 2 == 0;                          break;
-				case 2:  invert = x % 3 == 0;                          break;
-				case 3:  invert = (x + y) % 3 == 0;                    break;
-				case 4:  invert = (x / 3 + y / 2) % 2 == 0;            break;
-				case 5:  invert = x * y % 2 + x * y % 3 == 0;          break;
-				case 6:  invert = (x * y % 2 + x * y % 3) % 2 == 0;    break;
-				case 7:  invert = ((x + y) % 2 + x * y % 3) % 2 == 0;  break;
-				default:  throw std::logic_error("Assertion error");
-			}
-			modules.at(y).at(x) = modules.at(y).at(x) ^ (invert & !isFunction.at(y).at(x));
+		size_t row = static_cast<size_t>(y) * stride;
+		for (int i = 0; i < stride; i++) {
+			uint64_t invert = getMaskWord(mask, y, i) & ~isFunction[row + i];
+			if (i == stride - 1)
+				invert &= lastWordBits;
+			modules[row + i] ^= invert;
 		}
 	}
 }
@@ -425,6 +616,76 @@ void QrCode::applyMask(int mask) {
 long QrCode::getPenaltyScore() const {
 	long result = 0;
 	
+	// Adjacent modules in row/column having same color, and finder-like patterns
+	uint64_t columns[MAX_WORDS];
+	getTransposedModules(columns);
+	for (int i = 0; i < size; i++) {
+		result += getLinePenaltyScore(&modules[static_cast<size_t>(i) * stride], size);
+		result += getLinePenaltyScore(&columns[static_cast<size_t>(i) * stride], size);
+	}
+	
+	// 2*2 blocks of modules having same color. Bit x of same is set iff modules x and
+	// x + 1 of a row have the same color, the last module of a row has no right neighbour.
+	int lastWordPairs = size - 1 - (stride - 1) * 64;  // 0 when the last word holds only the last module
+	uint64_t lastWordBits = lastWordPairs > 0 ? ~static_cast<uint64_t>(0) >> (64 - lastWordPairs) : 0;
+	for (int y = 0; y < size - 1; y++) {
+		const uint64_t *upper = &modules[static_cast<size_t>(y) * stride];
+		const uint64_t *lower = upper + stride;
+		for (int i = 0; i < stride; i++) {
+			uint64_t upperNext = upper[i] >> 1, lowerNext = lower[i] >> 1;
+			if (i + 1 < stride) {
+				upperNext |= upper[i + 1] << 63;
+				lowerNext |= lower[i + 1] << 63;
+			}
+			uint64_t same = ~(upper[i] ^ upperNext) & ~(lower[i] ^ lowerNext) & ~(upper[i] ^ lower[i]);
+			if (i == stride - 1)
+				same &= lastWordBits;
+			result += popCount(same) * PENALTY_N2;
+		}
+	}
+	
+	// Balance of black and white modules
+	int black = 0;
+	for (size_t i = 0, words = static_cast<size_t>(size) * stride; i < words; i++)
+		black += popCount(modules[i]);
+	int total = size * size;  // Note that size is odd, so black/total != 1/2
+	// Compute the smallest integer k >= 0 such that (45-5k)% <= black/total <= (55+5k)%
+	int k = static_cast<int>((std::abs(black * 20L - total * 10L) + total - 1) / total) - 1;
+	result += k * PENALTY_N4;
+	return result;
+}
+
+long QrCode::getSampledPenaltyScore() const {
+	long result = 0;
+	
+	// Adjacent modules in row/column having same color, and finder-like patterns, in the
+	// sampled lines. A column is gathered one bit per row.
+	uint64_t column[MAX_STRIDE];
+	for (int i = PENALTY_SAMPLE_STEP / 2; i < size; i += PENALTY_SAMPLE_STEP) {
+		result += getLinePenaltyScore(&modules[static_cast<size_t>(i) * stride], size);
+		std::fill(column, column + stride, 0);
+		const uint64_t *word = &modules[i >> 6];
+		for (int y = 0; y < size; y++, word += stride)
+			column[y >> 6] |= ((*word >> (i & 63)) & 1) << (y & 63);
+		result += getLinePenaltyScore(column, size);
+	}
+	result *= PENALTY_SAMPLE_STEP;
+	
+	// Balance of black and white modules, like getPenaltyScore()
+	int black = 0;
+	for (size_t i = 0, words = static_cast<size_t>(size) * stride; i < words; i++)
+		black += popCount(modules[i]);
+	int total = size * size;
+	int k = static_cast<int>((std::abs(black * 20L - total * 10L) + total - 1) / total) - 1;
+	result += k * PENALTY_N4;
+	return result;
+}
+
+
+
+long QrCode::getReferencePenaltyScore() const {
+	long result = 0;
+	
 	// Adjacent modules in row having same color, and finder-like patterns
 	for (int y = 0; y < size; y++) {
 		std::deque<int> runHistory(7, 0);
@@ -491,12 +752,8 @@ long QrCode::getPenaltyScore() const {
 	
 	// Balance of black and white modules
 	int black = 0;
-	for (const vector<bool> &row : modules) {
-		for (bool color : row) {
-			if (color)
-				black++;
-		}
-	}
+	for (size_t i = 0, words = static_cast<size_t>(size) * stride; i < words; i++)
+		black += popCount(modules[i]);
 	int total = size * size;  // Note that size is odd, so black/total != 1/2
 	// Compute the smallest integer k >= 0 such that (45-5k)% <= black/total <= (55+5k)%
 	int k = static_cast<int>((std::abs(black * 20L - total * 10L) + total - 1) / total) - 1;
@@ -505,6 +762,14 @@ long QrCode::getPenaltyScore() const {
 }
 
 
+long QrCode::getMaskedPenaltyScore(int mask) const {
+	QrCode copy(*this);
+	copy.applyMask(mask);
+	copy.drawFormatBits(mask);
+	return copy.getPenaltyScore();
+}
+
+
 vector<int> QrCode::getAlignmentPatternPositions() const {
 	if (version == 1)
 		return vector<int>();
@@ -536,12 +801,26 @@ int QrCode::getNumRawDataModules(int ver) {
 
 
 int QrCode::getNumDataCodewords(int ver, Ecc ecl) {
-	return getNumRawDataModules(ver) / 8
-		- ECC_CODEWORDS_PER_BLOCK    [static_cast<int>(ecl)][ver]
-		* NUM_ERROR_CORRECTION_BLOCKS[static_cast<int>(ecl)][ver];
+	if (ver < MIN_VERSION || ver > MAX_VERSION)
+		throw std::domain_error("Version number out of range");
+	return DATA_CODEWORDS[static_cast<int>(ecl)][ver];
+}
+
+
+int QrCode::getMinVersion(int dataUsedBits, Ecc ecl, int minVersion, int maxVersion) {
+	const int16_t *capacities = DATA_CODEWORDS[static_cast<int>(ecl)];
+	int dataUsedCodewords = (dataUsedBits + 7) / 8;  // Capacities are whole codewords
+	const int16_t *found = std::lower_bound(capacities + minVersion, capacities + maxVersion + 1, dataUsedCodewords);
+	return found <= capacities + maxVersion ? static_cast<int>(found - capacities) : -1;
+}
+
+
+int QrCode::getCharCountRangeEnd(int ver) {
+	return ver <= 9 ? 9 : ver <= 26 ? 26 : MAX_VERSION;
 }
 
 
+
 void QrCode::addRunToHistory(int run, std::deque<int> &history) {
 	history.pop_back();
 	history.push_front(run);
@@ -555,11 +834,146 @@ bool QrCode::hasFinderLikePattern(const std::deque<int> &runHistory) {
 }
 
 
+long QrCode::getLinePenaltyScore(const uint64_t *line, int length) {
+	// Bit x of the transitions is set iff module x differs from module x - 1, with white
+	// modules assumed before and after the line. Runs alternate in color starting with
+	// a white run, which is empty if the line starts with black. A line ending with black
+	// ends with an empty white run, like the dummy run of getReferencePenaltyScore().
+	long result = 0;
+	int runs[MAX_SIZE + 8] = {};  // Starts with the 6 empty runs of a fresh history
+	int numRuns = 6;
+	int start = 0;
+	int words = (length + 64) / 64;  // Includes the transition past the last module
+	for (int i = 0; i < words; i++) {
+		uint64_t carry = i > 0 ? line[i - 1] >> 63 : 0;
+		uint64_t word = i < (length + 63) / 64 ? line[i] : 0;
+		uint64_t transitions = word ^ (word << 1 | carry);
+		while (transitions != 0) {
+			int end = i * 64 + countTrailingZeros(transitions);
+			transitions &= transitions - 1;
+			runs[numRuns++] = end - start;
+			start = end;
+		}
+	}
+	runs[numRuns++] = length - start;  // Final run, always white
+	
+	// Runs with an even index (counting from the first real run) are white, a
+	// finder-like pattern is checked when a white run ends, newest run first
+	for (int i = 6; i < numRuns; i++) {
+		int run = runs[i];
+		if (run >= 5)
+			result += PENALTY_N1 + run - 5;
+		int n = runs[i - 1];
+		if (((i - 6) & 1) == 0 && n > 0 && runs[i - 2] == n && runs[i - 4] == n && runs[i - 5] == n
+				&& runs[i - 3] == n * 3 && std::max(run, runs[i - 6]) >= n * 4)
+			result += PENALTY_N3;
+	}
+	return result;
+}
+
+
+void QrCode::getTransposedModules(uint64_t *result) const {
+	uint64_t block[64];
+	for (int i = 0; i < stride; i++) {  // Block row, covering y = i * 64 to i * 64 + 63
+		for (int j = 0; j < stride; j++) {  // Block column, covering x = j * 64 to j * 64 + 63
+			for (int k = 0; k < 64; k++) {
+				int y = i * 64 + k;
+				block[k] = y < size ? modules[static_cast<size_t>(y) * stride + j] : 0;
+			}
+			transpose64(block);
+			for (int k = 0; k < 64 && j * 64 + k < size; k++)
+				result[static_cast<size_t>(j * 64 + k) * stride + i] = block[k];
+		}
+	}
+}
+
+
+void QrCode::transpose64(uint64_t a[64]) {
+	// Swaps the off-diagonal 32*32 blocks, then the 16*16 blocks within each of them, and so on
+	uint64_t m = 0x00000000FFFFFFFFULL;
+	for (int j = 32; j != 0; j >>= 1, m ^= m << j) {
+		for (int k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+			uint64_t t = ((a[k] >> j) ^ a[k | j]) & m;
+			a[k] ^= t << j;
+			a[k | j] ^= t;
+		}
+	}
+}
+
+
 bool QrCode::getBit(long x, int i) {
 	return ((x >> i) & 1) != 0;
 }
 
 
+int QrCode::popCount(uint64_t x) {
+#if defined(__GNUC__)
+	return __builtin_popcountll(x);
+#else
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return static_cast<int>((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+
+int QrCode::countTrailingZeros(uint64_t x) {
+#if defined(__GNUC__)
+	return __builtin_ctzll(x);
+#else
+	int result = 0;
+	for (; (x & 1) == 0; x >>= 1)
+		result++;
+	return result;
+#endif
+}
+
+
+void QrCode::appendBits(uint32_t val, int len, uint8_t buffer[], int &bitLen) {
+	if (len < 0 || len > 31 || val >> len != 0)
+		throw std::domain_error("Value out of range");
+	for (int i = len - 1; i >= 0; i--, bitLen++)  // Append bit by bit
+		buffer[bitLen >> 3] |= ((val >> i) & 1) << (7 - (bitLen & 7));
+}
+
+
+uint64_t QrCode::getMaskWord(int mask, int y, int i) {
+	// Every mask pattern repeats after 6 columns and 12 rows, so a table of the
+	// first 12 rows covers the up to 3 words of every row of every version
+	static const struct MaskTable {
+		uint64_t words[8][12][3];
+		MaskTable() {
+			for (int m = 0; m < 8; m++) {
+				for (int y = 0; y < 12; y++) {
+					for (int i = 0; i < 3; i++) {
+						uint64_t word = 0;
+						for (int j = 0; j < 64; j++) {
+							int x = i * 64 + j;
+							bool invert;
+							switch (m) {
+								case 0:  invert = (x + y) % 2 == 0;                    break;
+								case 1:  invert = y % 2 == 0;                          break;
+								case 2:  invert = x % 3 == 0;                          break;
+								case 3:  invert = (x + y) % 3 == 0;                    break;
+								case 4:  invert = (x / 3 + y / 2) % 2 == 0;            break;
+								case 5:  invert = x * y % 2 + x * y % 3 == 0;          break;
+								case 6:  invert = (x * y % 2 + x * y % 3) % 2 == 0;    break;
+								case 7:  invert = ((x + y) % 2 + x * y % 3) % 2 == 0;  break;
+								default:  throw std::logic_error("Assertion error");
+							}
+							word |= static_cast<uint64_t>(invert) << j;
+						}
+						words[m][y][i] = word;
+					}
+				}
+			}
+		}
+	} table;
+	return table.words[mask][y % 12][i];
+}
+
+
 /*---- Tables of constants ----*/
 
 const int QrCode::PENALTY_N1 =  3;
@@ -586,15 +1000,17 @@ const int8_t QrCode::NUM_ERROR_CORRECTION_BLOCKS[4][41] = {
 	{-1, 1, 1, 2, 4, 4, 4, 5, 6, 8, 8, 11, 11, 16, 16, 18, 16, 19, 21, 25, 25, 25, 34, 30, 32, 35, 37, 40, 42, 45, 48, 51, 54, 57, 60, 63, 66, 70, 74, 77, 81},  // High
 };
 
+constexpr int16_t QrCode::DATA_CODEWORDS[4][41];
+
 
 QrCode::ReedSolomonGenerator::ReedSolomonGenerator(int degree) :
-		coefficients() {
-	if (degree < 1 || degree > 255)
+		degree(degree) {
+	if (degree < 1 || degree > MAX_DEGREE)
 		throw std::domain_error("Degree out of range");
 	
 	// Start with the monomial x^0
-	coefficients.resize(degree);
-	coefficients.at(degree - 1) = 1;
+	std::fill(coefficients, coefficients + degree, 0);
+	coefficients[degree - 1] = 1;
 	
 	// Compute the product polynomial (x - r^0) * (x - r^1) * (x - r^2) * ... * (x - r^{degree-1}),
 	// drop the highest term, and store the rest of the coefficients in order of descending powers.
@@ -602,40 +1018,92 @@ QrCode::ReedSolomonGenerator::ReedSolomonGenerator(int degree) :
 	uint8_t root = 1;
 	for (int i = 0; i < degree; i++) {
 		// Multiply the current product by (x - r^i)
-		for (size_t j = 0; j < coefficients.size(); j++) {
-			coefficients.at(j) = multiply(coefficients.at(j), root);
-			if (j + 1 < coefficients.size())
-				coefficients.at(j) ^= coefficients.at(j + 1);
+		for (int j = 0; j < degree; j++) {
+			coefficients[j] = multiply(coefficients[j], root);
+			if (j + 1 < degree)
+				coefficients[j] ^= coefficients[j + 1];
 		}
 		root = multiply(root, 0x02);
 	}
+	// No coefficient is 0 up to MAX_DEGREE, so all of them have a logarithm
+	for (int j = 0; j < degree; j++) {
+		if (coefficients[j] == 0)
+			throw std::logic_error("Assertion error");
+		logCoefficients[j] = getLogTable()[coefficients[j]];
+	}
+}
+
+
+const QrCode::ReedSolomonGenerator &QrCode::ReedSolomonGenerator::get(int degree) {
+	if (degree < 1 || degree > MAX_DEGREE)
+		throw std::domain_error("Degree out of range");
+	static const struct GeneratorTable {
+		std::vector<ReedSolomonGenerator> generators;
+		GeneratorTable() {
+			generators.reserve(MAX_DEGREE);
+			for (int i = 1; i <= MAX_DEGREE; i++)
+				generators.push_back(ReedSolomonGenerator(i));
+		}
+	} table;
+	return table.generators[degree - 1];
 }
 
 
-vector<uint8_t> QrCode::ReedSolomonGenerator::getRemainder(const vector<uint8_t> &data) const {
-	// Compute the remainder by performing polynomial division
-	vector<uint8_t> result(coefficients.size());
-	for (uint8_t b : data) {
-		uint8_t factor = b ^ result.at(0);
-		result.erase(result.begin());
-		result.push_back(0);
-		for (size_t j = 0; j < result.size(); j++)
-			result.at(j) ^= multiply(coefficients.at(j), factor);
+void QrCode::ReedSolomonGenerator::getRemainder(const uint8_t *data, size_t len, uint8_t *result) const {
+	// Compute the remainder by performing polynomial division, shifting the remainder
+	// by one codeword for each data codeword
+	const uint8_t *exp = getExpTable();
+	const uint8_t *log = getLogTable();
+	std::fill(result, result + degree, 0);
+	for (size_t i = 0; i < len; i++) {
+		uint8_t factor = data[i] ^ result[0];
+		std::copy(result + 1, result + degree, result);
+		result[degree - 1] = 0;
+		if (factor != 0) {
+			int logFactor = log[factor];
+			for (int j = 0; j < degree; j++)
+				result[j] ^= exp[logCoefficients[j] + logFactor];
+		}
 	}
-	return result;
 }
 
 
 uint8_t QrCode::ReedSolomonGenerator::multiply(uint8_t x, uint8_t y) {
-	// Russian peasant multiplication
-	int z = 0;
-	for (int i = 7; i >= 0; i--) {
-		z = (z << 1) ^ ((z >> 7) * 0x11D);
-		z ^= ((y >> i) & 1) * x;
+	if (x == 0 || y == 0)
+		return 0;
+	return getExpTable()[getLogTable()[x] + getLogTable()[y]];
+}
+
+
+// The powers of 2 in GF(2^8/0x11D), stored twice, and their discrete logarithms.
+// Computed once, on first use, by Russian peasant multiplication.
+struct FieldTables {
+	uint8_t exp[510];
+	uint8_t log[256];
+	FieldTables() {
+		int z = 1;
+		for (int i = 0; i < 255; i++) {
+			exp[i] = exp[i + 255] = static_cast<uint8_t>(z);
+			log[z] = static_cast<uint8_t>(i);
+			z = (z << 1) ^ ((z >> 7) * 0x11D);
+		}
+		log[0] = 0;
 	}
-	if (z >> 8 != 0)
-		throw std::logic_error("Assertion error");
-	return static_cast<uint8_t>(z);
+};
+
+static const FieldTables &getFieldTables() {
+	static const FieldTables tables;
+	return tables;
+}
+
+
+const uint8_t *QrCode::ReedSolomonGenerator::getExpTable() {
+	return getFieldTables().exp;
+}
+
+
+const uint8_t *QrCode::ReedSolomonGenerator::getLogTable() {
+	return getFieldTables().log;
 }
 
 
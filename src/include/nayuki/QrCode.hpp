@@ -68,6 +68,19 @@ class QrCode final {
 	private: static int getFormatBits(Ecc ecl);
 	
 	
+	/* 
+	 * How the mask is chosen when automatic masking is requested (mask = -1).
+	 * SERIAL and PARALLEL pick the lowest numbered mask among those with the lowest
+	 * penalty score, so they produce identical QR Codes. FAST picks by an estimate of
+	 * the score, the result is as valid but its mask may differ.
+	 */
+	public: enum class MaskSearch {
+		SERIAL  ,  // Score the 8 candidate masks one after another
+		PARALLEL,  // Score the 8 candidate masks concurrently, each on its own copy of the modules
+		FAST    ,  // Estimate the score of the 8 candidate masks with getSampledPenaltyScore()
+	};
+	
+	
 	
 	/*---- Static factory functions (high level) ----*/
 	
@@ -90,6 +103,34 @@ class QrCode final {
 	public: static QrCode encodeBinary(const std::vector<std::uint8_t> &data, Ecc ecl);
 	
 	
+	/*---- Static factory function (allocation-free) ----*/
+	
+	/* 
+	 * The result of the allocation-free encodeText().
+	 */
+	public: enum class Status {
+		OK              ,  // The QR Code was written to the result
+		DATA_TOO_LONG   ,  // The text does not fit any version in the given range
+		INVALID_ARGUMENT,  // The version range or the mask is out of range
+	};
+	
+	
+	/* 
+	 * Encodes the given text into result like encodeSegments(QrSegment::makeSegments(text), ecl,
+	 * minVersion, maxVersion, mask, boostEcl), but without heap allocations and exceptions.
+	 * Iff optimalSegments is true, the text is split into segments like by
+	 * QrSegment::makeSegmentsOptimally() for the version chosen, which may allow a smaller version.
+	 * QrCode objects hold their modules inline, sized for version 40, so result can be a local
+	 * variable. Returns Status::OK on success, otherwise result is left unchanged. The tables
+	 * shared by all QR Codes of a version are built on its first encode, only that encode allocates
+	 * (and may throw std::bad_alloc), as does MaskSearch::PARALLEL to start its threads.
+	 */
+	public: static Status encodeText(const char *text, Ecc ecl, QrCode &result,
+		int minVersion=1, int maxVersion=40, int mask=-1, bool boostEcl=true, bool optimalSegments=false,
+		MaskSearch maskSearch=MaskSearch::SERIAL);
+	
+	
+	
 	/*---- Static factory functions (mid level) ----*/
 	
 	/* 
@@ -98,13 +139,40 @@ class QrCode final {
 	 * chosen for the output. Iff boostEcl is true, then the ECC level of the result
 	 * may be higher than the ecl argument if it can be done without increasing the
 	 * version. The mask number is either between 0 to 7 (inclusive) to force that
-	 * mask, or -1 to automatically choose an appropriate mask (which may be slow).
+	 * mask, or -1 to automatically choose an appropriate mask (which may be slow,
+	 * see maskSearch).
 	 * This function allows the user to create a custom sequence of segments that switches
 	 * between modes (such as alphanumeric and byte) to encode text in less space.
 	 * This is a mid-level API; the high-level API is encodeText() and encodeBinary().
 	 */
 	public: static QrCode encodeSegments(const std::vector<QrSegment> &segs, Ecc ecl,
-		int minVersion=1, int maxVersion=40, int mask=-1, bool boostEcl=true);  // All optional parameters
+		int minVersion=1, int maxVersion=40, int mask=-1, bool boostEcl=true,
+		MaskSearch maskSearch=MaskSearch::SERIAL);  // All optional parameters
+	
+	
+	
+	/*---- Constants ----*/
+	
+	// The minimum version number supported in the QR Code Model 2 standard.
+	public: static constexpr int MIN_VERSION =  1;
+	
+	// The maximum version number supported in the QR Code Model 2 standard.
+	public: static constexpr int MAX_VERSION = 40;
+	
+	// The width and height of a QR Code of version 40.
+	public: static constexpr int MAX_SIZE = MAX_VERSION * 4 + 17;
+	
+	// The number of 64-bit words holding a row of modules of a QR Code of version 40.
+	private: static constexpr int MAX_STRIDE = (MAX_SIZE + 63) / 64;
+	
+	// The number of 64-bit words holding the modules of a QR Code of version 40.
+	private: static constexpr int MAX_WORDS = MAX_SIZE * MAX_STRIDE;
+	
+	// The number of data and error correction codewords of a QR Code of version 40.
+	private: static constexpr int MAX_RAW_CODEWORDS = 3706;
+	
+	// The longest text any QR Code holds, which is numeric at version 40 with low error correction.
+	private: static constexpr int MAX_TEXT_LENGTH = 7089;
 	
 	
 	
@@ -128,14 +196,20 @@ class QrCode final {
 	 * the resulting object still has a mask value between 0 and 7. */
 	private: int mask;
 	
-	// Private grids of modules/pixels, with dimensions of size*size:
+	// The number of 64-bit words that hold one row of modules, between 1 and MAX_STRIDE (inclusive).
+	private: int stride;
 	
-	// The modules of this QR Code (false = white, true = black).
+	// Private grids of modules/pixels, with dimensions of size*size, stored row-major with
+	// stride words per row. Module (x, y) is bit x % 64 of word y * stride + x / 64,
+	// the bits past the end of a row are always 0. Only the first size * stride words are used,
+	// the rest are 0:
+	
+	// The modules of this QR Code (0 = white, 1 = black).
 	// Immutable after constructor finishes. Accessed through getModule().
-	private: std::vector<std::vector<bool> > modules;
+	private: std::uint64_t modules[MAX_WORDS];
 	
-	// Indicates function modules that are not subjected to masking. Discarded when constructor finishes.
-	private: std::vector<std::vector<bool> > isFunction;
+	// Indicates function modules that are not subjected to masking. Only used by the constructor.
+	private: std::uint64_t isFunction[MAX_WORDS];
 	
 	
 	
@@ -147,7 +221,20 @@ class QrCode final {
 	 * This is a low-level API that most users should not use directly.
 	 * A mid-level API is the encodeSegments() function.
 	 */
-	public: QrCode(int ver, Ecc ecl, const std::vector<std::uint8_t> &dataCodewords, int mask);
+	public: QrCode(int ver, Ecc ecl, const std::vector<std::uint8_t> &dataCodewords, int mask,
+		MaskSearch maskSearch=MaskSearch::SERIAL);
+	
+	
+	/* 
+	 * Creates an all white QR Code of version 1 with low error correction and mask 0.
+	 * Meant to be overwritten by the allocation-free encodeText().
+	 */
+	public: QrCode();
+	
+	
+	// Creates a QR Code of the given version with only the function modules drawn and marked,
+	// which is used to build the function template of the version.
+	private: explicit QrCode(int ver);
 	
 	
 	
@@ -185,6 +272,20 @@ class QrCode final {
 	public: bool getModule(int x, int y) const;
 	
 	
+	/* 
+	 * Returns 64 modules of row y starting at x = i * 64, with module x at bit x % 64
+	 * (1 for black). Modules out of bounds are returned as 0 (white).
+	 */
+	public: std::uint64_t getRowWord(int y, int i) const;
+	
+	
+	/* 
+	 * Returns 64 modules of column x starting at y = i * 64, with module y at bit y % 64
+	 * (1 for black). Modules out of bounds are returned as 0 (white).
+	 */
+	public: std::uint64_t getColumnWord(int x, int i) const;
+	
+	
 	/* 
 	 * Returns a string of SVG code for an image depicting this QR Code, with the given number
 	 * of border modules. The string always uses Unix newlines (\n), regardless of the platform.
@@ -192,10 +293,43 @@ class QrCode final {
 	public: std::string toSvgString(int border) const;
 	
 	
+	/* 
+	 * Calculates and returns the penalty score based on state of this QR Code's current modules.
+	 * This is used by the automatic mask choice algorithm to find the mask pattern that yields the
+	 * lowest score. Runs are found 64 modules at a time from the transitions between neighbouring
+	 * modules, columns are scored on a transposed copy of the modules, and 2*2 blocks and dark
+	 * modules are counted with popcount.
+	 */
+	public: long getPenaltyScore() const;
+	
+	
+	/* 
+	 * Calculates the same penalty score as getPenaltyScore() one module at a time.
+	 * Slow, kept as the reference the word-level scorer is tested against.
+	 */
+	public: long getReferencePenaltyScore() const;
+	
+	
+	/* 
+	 * Estimates the penalty score from every 4th row and column and the balance of dark modules,
+	 * the scores of the lines are scaled up to the whole code. Used by MaskSearch::FAST, it reads
+	 * about a quarter of the modules that getPenaltyScore() does and needs no transposed copy.
+	 */
+	public: long getSampledPenaltyScore() const;
+	
+	
 	
 	/*---- Private helper methods for constructor: Drawing function modules ----*/
 	
+	private: struct FunctionTemplate;  // Defined with the private helper classes below
+	
+	
+	// Returns the function template of the given version, which is built on the first call.
+	private: static const FunctionTemplate &getFunctionTemplate(int ver);
+	
+	
 	// Reads this object's version field, and draws and marks all function modules.
+	// Only used to build the function templates.
 	private: void drawFunctionPatterns();
 	
 	
@@ -230,14 +364,21 @@ class QrCode final {
 	
 	/*---- Private helper methods for constructor: Codewords and masking ----*/
 	
-	// Returns a new byte string representing the given data with the appropriate error correction
-	// codewords appended to it, based on this object's version and error correction level.
-	private: std::vector<std::uint8_t> addEccAndInterleave(const std::vector<std::uint8_t> &data) const;
+	// Draws the QR Code for the given data codewords, which must be as many as this object's
+	// version and error correction level hold, and chooses the mask. The version, size, stride
+	// and error correction level must be set. Allocation-free once the tables of the version are built.
+	private: void drawQrCode(const std::uint8_t *dataCodewords, int mask, MaskSearch maskSearch);
+	
+	
+	// Writes the given data codewords with the appropriate error correction codewords to result,
+	// interleaved as drawn in the QR Code, based on this object's version and error correction level.
+	// Result must have room for getNumRawDataModules(version) / 8 bytes.
+	private: void addEccAndInterleave(const std::uint8_t *data, std::uint8_t *result) const;
 	
 	
 	// Draws the given sequence of 8-bit codewords (data and error correction) onto the entire
-	// data area of this QR Code. Function modules need to be marked off before this is called.
-	private: void drawCodewords(const std::vector<std::uint8_t> &data);
+	// data area of this QR Code, at the data module positions of the given template.
+	private: void drawCodewords(const std::uint8_t *data, const FunctionTemplate &tmpl);
 	
 	
 	// XORs the codeword modules in this QR Code with the given mask pattern.
@@ -248,9 +389,11 @@ class QrCode final {
 	private: void applyMask(int mask);
 	
 	
-	// Calculates and returns the penalty score based on state of this QR Code's current modules.
-	// This is used by the automatic mask choice algorithm to find the mask pattern that yields the lowest score.
-	private: long getPenaltyScore() const;
+	// Returns the penalty score of this QR Code with the given mask applied, computed on a copy
+	// of the modules. Function modules must be marked and codewords drawn before this is called.
+	private: long getMaskedPenaltyScore(int mask) const;
+	
+	
 	
 	
 	
@@ -258,7 +401,7 @@ class QrCode final {
 	
 	// Returns an ascending list of positions of alignment patterns for this version number.
 	// Each position is in the range [0,177), and are used on both the x and y axes.
-	// This could be implemented as lookup table of 40 variable-length lists of unsigned bytes.
+	// Only used to build the function templates, so it runs once per version.
 	private: std::vector<int> getAlignmentPatternPositions() const;
 	
 	
@@ -270,10 +413,21 @@ class QrCode final {
 	
 	// Returns the number of 8-bit data (i.e. not error correction) codewords contained in any
 	// QR Code of the given version number and error correction level, with remainder bits discarded.
-	// This stateless pure function could be implemented as a (40*4)-cell lookup table.
+	// Looked up in DATA_CODEWORDS.
 	private: static int getNumDataCodewords(int ver, Ecc ecl);
 	
 	
+	// Returns the smallest version number in the range [minVersion, maxVersion] whose data capacity
+	// at the given error correction level holds the given number of bits, or -1 if there is none.
+	// The capacity grows with the version, so this is a binary search in DATA_CODEWORDS.
+	private: static int getMinVersion(int dataUsedBits, Ecc ecl, int minVersion, int maxVersion);
+	
+	
+	// Returns the last version number that uses the same character count field widths as the given
+	// one, which is 9, 26 or 40. The total bits of a list of segments only change past these versions.
+	private: static int getCharCountRangeEnd(int ver);
+	
+	
 	// Inserts the given value to the front of the given array, which shifts over the
 	// existing values and deletes the last value. A helper function for getPenaltyScore().
 	private: static void addRunToHistory(int run, std::deque<int> &history);
@@ -285,19 +439,47 @@ class QrCode final {
 	private: static bool hasFinderLikePattern(const std::deque<int> &runHistory);
 	
 	
+	// Returns the penalty score of the adjacent modules having same color and of the finder-like
+	// patterns in one row or column of the given length, held in words as by getRowWord().
+	private: static long getLinePenaltyScore(const std::uint64_t *line, int length);
+	
+	
+	// Writes the modules transposed into result, with column x held in the stride words at
+	// x * stride, as by getColumnWord(). Result must hold size * stride words.
+	private: void getTransposedModules(std::uint64_t *result) const;
+	
+	
+	// Transposes the 64*64 bit matrix whose row i is a[i], so bit j of a[i] moves to bit i of a[j].
+	private: static void transpose64(std::uint64_t a[64]);
+	
+	
 	// Returns true iff the i'th bit of x is set to 1.
 	private: static bool getBit(long x, int i);
 	
 	
-	/*---- Constants and tables ----*/
+	// Returns the number of bits set to 1 in x.
+	private: static int popCount(std::uint64_t x);
 	
-	// The minimum version number supported in the QR Code Model 2 standard.
-	public: static constexpr int MIN_VERSION =  1;
 	
-	// The maximum version number supported in the QR Code Model 2 standard.
-	public: static constexpr int MAX_VERSION = 40;
+	// Returns the index of the lowest bit set to 1 in x, which must not be 0.
+	private: static int countTrailingZeros(std::uint64_t x);
+	
+	
+	// Appends the given number of low-order bits of the given value to the buffer, which is
+	// filled up to bitLen bits and zeroed beyond. Requires 0 <= len <= 31 and val < 2^len.
+	private: static void appendBits(std::uint32_t val, int len, std::uint8_t buffer[], int &bitLen);
+	
+	
+	// Returns the i'th word of row y of the given mask pattern, with the
+	// bit of column x set iff the module at (x, y) is inverted by the mask.
+	private: static std::uint64_t getMaskWord(int mask, int y, int i);
 	
 	
+	/*---- Constants and tables ----*/
+	
+	// Distance between the rows and columns scored by getSampledPenaltyScore().
+	private: static constexpr int PENALTY_SAMPLE_STEP = 4;
+	
 	// For use in getPenaltyScore(), when evaluating which mask is best.
 	private: static const int PENALTY_N1;
 	private: static const int PENALTY_N2;
@@ -308,9 +490,38 @@ class QrCode final {
 	private: static const std::int8_t ECC_CODEWORDS_PER_BLOCK[4][41];
 	private: static const std::int8_t NUM_ERROR_CORRECTION_BLOCKS[4][41];
 	
+	// The number of data codewords of each error correction level and version, as returned
+	// by getNumDataCodewords(). Index 0 is for padding, and is set to an illegal value.
+	private: static constexpr std::int16_t DATA_CODEWORDS[4][41] = {
+		{-1,   19,   34,   55,   80,  108,  136,  156,  194,  232,  274,  324,  370,  428,  461,  523,  589,  647,  721,  795,  861,  932, 1006, 1094, 1174, 1276, 1370, 1468, 1531, 1631, 1735, 1843, 1955, 2071, 2191, 2306, 2434, 2566, 2702, 2812, 2956},  // Low
+		{-1,   16,   28,   44,   64,   86,  108,  124,  154,  182,  216,  254,  290,  334,  365,  415,  453,  507,  563,  627,  669,  714,  782,  860,  914, 1000, 1062, 1128, 1193, 1267, 1373, 1455, 1541, 1631, 1725, 1812, 1914, 1992, 2102, 2216, 2334},  // Medium
+		{-1,   13,   22,   34,   48,   62,   76,   88,  110,  132,  154,  180,  206,  244,  261,  295,  325,  367,  397,  445,  485,  512,  568,  614,  664,  718,  754,  808,  871,  911,  985, 1033, 1115, 1171, 1231, 1286, 1354, 1426, 1502, 1582, 1666},  // Quartile
+		{-1,    9,   16,   26,   36,   46,   60,   66,   86,  100,  122,  140,  158,  180,  197,  223,  253,  283,  313,  341,  385,  406,  442,  464,  514,  538,  596,  628,  661,  701,  745,  793,  845,  901,  961,  986, 1054, 1096, 1142, 1222, 1276},  // High
+	};
+	
+	
+	
+	/*---- Private helper classes ----*/
 	
+	/* 
+	 * The parts of a QR Code that only depend on the version: the function modules and the
+	 * positions of the data modules. Computed once per version and shared by all QR Codes.
+	 */
+	private: struct FunctionTemplate final {
+		
+		// The modules with all function patterns drawn, laid out like QrCode::modules. The format bits
+		// are drawn for a dummy mask and error correction level, the constructor overwrites them.
+		std::vector<std::uint64_t> modules;
+		
+		// The function modules, laid out like QrCode::isFunction.
+		std::vector<std::uint64_t> isFunction;
+		
+		// The bit index y * stride * 64 + x of every data module (x, y), in the zigzag order the
+		// codeword bits are drawn in. Includes the remainder bits, which are left white.
+		std::vector<std::uint16_t> dataModules;
+		
+	};
 	
-	/*---- Private helper class ----*/
 	
 	/* 
 	 * Computes the Reed-Solomon error correction codewords for a sequence of data codewords
@@ -319,38 +530,66 @@ class QrCode final {
 	 */
 	private: class ReedSolomonGenerator final {
 		
-		/*-- Immutable field --*/
+		/*-- Constant --*/
+		
+		// The highest number of ECC codewords per block used by any version and ECC level.
+		public: static constexpr int MAX_DEGREE = 30;
+		
+		
+		/*-- Immutable fields --*/
+		
+		// The degree of the divisor polynomial, which is the number of ECC codewords per block.
+		private: int degree;
 		
 		// Coefficients of the divisor polynomial, stored from highest to lowest power, excluding the leading term which
 		// is always 1. For example the polynomial x^3 + 255x^2 + 8x + 93 is stored as the uint8 array {255, 8, 93}.
-		private: std::vector<std::uint8_t> coefficients;
+		// Only the first degree entries are used.
+		private: std::uint8_t coefficients[MAX_DEGREE];
+		
+		// The discrete logarithms of the coefficients, which are never 0.
+		private: std::uint8_t logCoefficients[MAX_DEGREE];
 		
 		
 		/*-- Constructor --*/
 		
 		/* 
-		 * Creates a Reed-Solomon ECC generator for the given degree. This could be implemented
-		 * as a lookup table over all possible parameter values, instead of as an algorithm.
+		 * Creates a Reed-Solomon ECC generator for the given degree, between 1 and MAX_DEGREE (inclusive).
 		 */
 		public: explicit ReedSolomonGenerator(int degree);
 		
 		
-		/*-- Method --*/
+		/*-- Methods --*/
 		
 		/* 
-		 * Computes and returns the Reed-Solomon error correction codewords for the given
-		 * sequence of data codewords. The returned object is always a new byte array.
-		 * This method does not alter this object's state (because it is immutable).
+		 * Returns the generator for the given degree, between 1 and MAX_DEGREE (inclusive). The generators
+		 * of all degrees are computed once, on the first call, and shared by all QR Codes and threads.
 		 */
-		public: std::vector<std::uint8_t> getRemainder(const std::vector<std::uint8_t> &data) const;
+		public: static const ReedSolomonGenerator &get(int degree);
 		
 		
-		/*-- Static function --*/
+		/* 
+		 * Computes the Reed-Solomon error correction codewords for the given sequence of data
+		 * codewords and writes them to result, which must have room for degree bytes.
+		 * This method does not allocate and does not alter this object's state (because it is immutable).
+		 */
+		public: void getRemainder(const std::uint8_t *data, std::size_t len, std::uint8_t *result) const;
+		
+		
+		/*-- Static functions --*/
 		
 		// Returns the product of the two given field elements modulo GF(2^8/0x11D).
-		// All inputs are valid. This could be implemented as a 256*256 lookup table.
+		// All inputs are valid. Looked up in the logarithm tables of the field.
 		private: static std::uint8_t multiply(std::uint8_t x, std::uint8_t y);
 		
+		
+		// Returns the table of the powers 2^i in GF(2^8/0x11D) for i between 0 and 509 (inclusive), so the
+		// sum of two logarithms can be looked up without reducing it modulo 255.
+		private: static const std::uint8_t *getExpTable();
+		
+		
+		// Returns the table of the discrete logarithms to the base 2 in GF(2^8/0x11D), the entry of 0 is unused.
+		private: static const std::uint8_t *getLogTable();
+		
 	};
 	
 };
@@ -24,6 +24,7 @@
 #include <climits>
 #include <cstring>
 #include <stdexcept>
+#include <string>
 #include <utility>
 #include "QrSegment.hpp"
 
@@ -63,8 +64,7 @@ QrSegment QrSegment::makeBytes(const vector<uint8_t> &data) {
 	if (data.size() > static_cast<unsigned int>(INT_MAX))
 		throw std::length_error("Data too long");
 	BitBuffer bb;
-	for (uint8_t b : data)
-		bb.appendBits(b, 8);
+	bb.appendBytes(data.data(), data.size());
 	return QrSegment(Mode::BYTE, static_cast<int>(data.size()), std::move(bb));
 }
 
@@ -133,6 +133,27 @@ vector<QrSegment> QrSegment::makeSegments(const char *text) {
 }
 
 
+vector<QrSegment> QrSegment::makeSegmentsOptimally(const char *text, int version) {
+	size_t len = std::strlen(text);
+	vector<uint8_t> modes(len);
+	computeOptimalModes(text, len, version, modes.data());
+	
+	// Make a segment of each run of characters in the same mode
+	vector<QrSegment> result;
+	for (size_t start = 0, end; start < len; start = end) {
+		for (end = start + 1; end < len && modes[end] == modes[start]; end++);
+		std::string run(text + start, end - start);
+		if (modes[start] == Mode::NUMERIC.getModeBits())
+			result.push_back(makeNumeric(run.c_str()));
+		else if (modes[start] == Mode::ALPHANUMERIC.getModeBits())
+			result.push_back(makeAlphanumeric(run.c_str()));
+		else
+			result.push_back(makeBytes(vector<uint8_t>(run.begin(), run.end())));
+	}
+	return result;
+}
+
+
 QrSegment QrSegment::makeEci(long assignVal) {
 	BitBuffer bb;
 	if (assignVal < 0)
@@ -151,7 +172,7 @@ QrSegment QrSegment::makeEci(long assignVal) {
 }
 
 
-QrSegment::QrSegment(Mode md, int numCh, const std::vector<bool> &dt) :
+QrSegment::QrSegment(Mode md, int numCh, const BitBuffer &dt) :
 		mode(md),
 		numChars(numCh),
 		data(dt) {
@@ -160,7 +181,7 @@ QrSegment::QrSegment(Mode md, int numCh, const std::vector<bool> &dt) :
 }
 
 
-QrSegment::QrSegment(Mode md, int numCh, std::vector<bool> &&dt) :
+QrSegment::QrSegment(Mode md, int numCh, BitBuffer &&dt) :
 		mode(md),
 		numChars(numCh),
 		data(std::move(dt)) {
@@ -186,6 +207,91 @@ int QrSegment::getTotalBits(const vector<QrSegment> &segs, int version) {
 }
 
 
+int QrSegment::getTotalBits(const uint8_t modes[], size_t len, int version) {
+	long result = 0;
+	for (size_t start = 0, end; start < len; start = end) {
+		for (end = start + 1; end < len && modes[end] == modes[start]; end++);
+		long numChars = static_cast<long>(end - start);
+		const Mode &mode = modes[start] == Mode::NUMERIC.getModeBits() ? Mode::NUMERIC :
+			modes[start] == Mode::ALPHANUMERIC.getModeBits() ? Mode::ALPHANUMERIC : Mode::BYTE;
+		int ccbits = mode.numCharCountBits(version);
+		if (numChars >= (1L << ccbits))
+			return -1;  // The segment's length doesn't fit the field's bit width
+		result += 4 + ccbits;
+		if (&mode == &Mode::NUMERIC)
+			result += numChars / 3 * 10 + (numChars % 3 == 0 ? 0 : numChars % 3 * 3 + 1);
+		else if (&mode == &Mode::ALPHANUMERIC)
+			result += numChars / 2 * 11 + numChars % 2 * 6;
+		else
+			result += numChars * 8;
+		if (result > INT_MAX)
+			return -1;  // The sum will overflow an int type
+	}
+	return static_cast<int>(result);
+}
+
+
+int QrSegment::computeOptimalModes(const char *text, size_t len, int version, uint8_t modes[]) {
+	// Dynamic programming over the characters, with one state per mode of the segment the
+	// text so far ends in. Costs are in 1/6 bits, so the 11 bits per 2 alphanumeric and the
+	// 10 bits per 3 numeric characters are whole per character; rounding a cost up to whole
+	// bits when its segment ends gives the exact length of the 1 or 2 leftover characters.
+	static const Mode *const MODES[] = {&Mode::BYTE, &Mode::ALPHANUMERIC, &Mode::NUMERIC};
+	const int numModes = 3;
+	const int IMPOSSIBLE = 3;
+	long headCosts[numModes];
+	long costs[numModes];
+	for (int j = 0; j < numModes; j++)
+		costs[j] = headCosts[j] = (4 + MODES[j]->numCharCountBits(version)) * 6L;
+	
+	// Until the traceback, modes[i] holds for each state j in bits 2j and 2j+1 the mode
+	// that character i is encoded in when the text up to character i ends in state j
+	for (size_t i = 0; i < len; i++) {
+		char c = text[i];
+		long extended[numModes];
+		bool canExtend[numModes] = {true, false, false};  // A byte segment can always be extended
+		extended[0] = costs[0] + 8 * 6;
+		if (c != '\0' && std::strchr(ALPHANUMERIC_CHARSET, c) != nullptr) {
+			extended[1] = costs[1] + 33;
+			canExtend[1] = true;
+		}
+		if ('0' <= c && c <= '9') {
+			extended[2] = costs[2] + 20;
+			canExtend[2] = true;
+		}
+		// Either extend the segment with this character, or end the segment after it
+		// and start one in another mode
+		int charModes[numModes];
+		for (int j = 0; j < numModes; j++) {
+			charModes[j] = canExtend[j] ? j : IMPOSSIBLE;
+			costs[j] = canExtend[j] ? extended[j] : LONG_MAX;
+			for (int k = 0; k < numModes; k++) {
+				if (k == j || !canExtend[k])
+					continue;
+				long newCost = (extended[k] + 5) / 6 * 6 + headCosts[j];
+				if (newCost < costs[j]) {
+					costs[j] = newCost;
+					charModes[j] = k;
+				}
+			}
+		}
+		modes[i] = static_cast<uint8_t>(charModes[0] | charModes[1] << 2 | charModes[2] << 4);
+	}
+	
+	// Trace back from the cheapest final state
+	int state = 0;
+	for (int j = 1; j < numModes; j++) {
+		if ((costs[j] + 5) / 6 < (costs[state] + 5) / 6)
+			state = j;
+	}
+	for (size_t i = len; i-- > 0; ) {
+		state = (modes[i] >> (state * 2)) & 3;
+		modes[i] = static_cast<uint8_t>(MODES[state]->getModeBits());
+	}
+	return getTotalBits(modes, len, version);
+}
+
+
 bool QrSegment::isAlphanumeric(const char *text) {
 	for (; *text != '\0'; text++) {
 		if (std::strchr(ALPHANUMERIC_CHARSET, *text) == nullptr)
@@ -215,7 +321,7 @@ int QrSegment::getNumChars() const {
 }
 
 
-const std::vector<bool> &QrSegment::getData() const {
+const BitBuffer &QrSegment::getData() const {
 	return data;
 }
 
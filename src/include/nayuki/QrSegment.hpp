@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 #include "BitBuffer.hpp"
@@ -121,6 +122,16 @@ class QrSegment final {
 	public: static std::vector<QrSegment> makeSegments(const char *text);
 	
 	
+	/* 
+	 * Returns a list of zero or more segments to represent the given text string, switching between
+	 * the byte, alphanumeric and numeric modes wherever it shortens the bit stream. The total length
+	 * is minimal for the character count field widths of the given version, which are the same for
+	 * the versions 1 to 9, 10 to 26 and 27 to 40. For example "https://example.com/DEVICE?code=123456"
+	 * is encoded as bytes up to "DEVICE", then in alphanumeric mode, and the digits in numeric mode.
+	 */
+	public: static std::vector<QrSegment> makeSegmentsOptimally(const char *text, int version);
+	
+	
 	/* 
 	 * Returns a segment representing an Extended Channel Interpretation
 	 * (ECI) designator with the given assignment value.
@@ -158,7 +169,7 @@ class QrSegment final {
 	private: int numChars;
 	
 	/* The data bits of this segment. Accessed through getData(). */
-	private: std::vector<bool> data;
+	private: BitBuffer data;
 	
 	
 	/*---- Constructors (low level) ----*/
@@ -168,7 +179,7 @@ class QrSegment final {
 	 * The character count (numCh) must agree with the mode and the bit buffer length,
 	 * but the constraint isn't checked. The given bit buffer is copied and stored.
 	 */
-	public: QrSegment(Mode md, int numCh, const std::vector<bool> &dt);
+	public: QrSegment(Mode md, int numCh, const BitBuffer &dt);
 	
 	
 	/* 
@@ -176,7 +187,7 @@ class QrSegment final {
 	 * The character count (numCh) must agree with the mode and the bit buffer length,
 	 * but the constraint isn't checked. The given bit buffer is moved and stored.
 	 */
-	public: QrSegment(Mode md, int numCh, std::vector<bool> &&dt);
+	public: QrSegment(Mode md, int numCh, BitBuffer &&dt);
 	
 	
 	/*---- Methods ----*/
@@ -196,7 +207,7 @@ class QrSegment final {
 	/* 
 	 * Returns the data bits of this segment.
 	 */
-	public: const std::vector<bool> &getData() const;
+	public: const BitBuffer &getData() const;
 	
 	
 	// (Package-private) Calculates the number of bits needed to encode the given segments at
@@ -205,11 +216,23 @@ class QrSegment final {
 	public: static int getTotalBits(const std::vector<QrSegment> &segs, int version);
 	
 	
+	// (Package-private) Calculates the number of bits needed to encode the segments formed by the runs
+	// of equal modes of the given characters at the given version, where modes holds the mode indicator
+	// (see Mode::getModeBits()) of each character. Returns -1 like the function above.
+	public: static int getTotalBits(const std::uint8_t modes[], std::size_t len, int version);
+	
+	
+	// (Package-private) Chooses the modes of the first len characters of the text that minimize
+	// the total bits at the given version, as used by makeSegmentsOptimally(). Writes the mode
+	// indicator of each character to modes and returns getTotalBits() of the result. Does not allocate.
+	public: static int computeOptimalModes(const char *text, std::size_t len, int version, std::uint8_t modes[]);
+	
+	
 	/*---- Private constant ----*/
 	
-	/* The set of all legal characters in alphanumeric mode, where
+	/* (Package-private) The set of all legal characters in alphanumeric mode, where
 	 * each character value maps to the index in the string. */
-	private: static const char *ALPHANUMERIC_CHARSET;
+	public: static const char *ALPHANUMERIC_CHARSET;
 	
 };
 
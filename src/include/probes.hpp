@@ -0,0 +1,43 @@
+#ifndef PAM_OAUTH2_DEVICE_PROBES_HPP
+#define PAM_OAUTH2_DEVICE_PROBES_HPP
+
+// USDT probes of provider pam_oauth2_device for bpftrace, perf and
+// SystemTap, built with `make USDT=1` and sys/sdt.h installed. Otherwise the
+// macros expand to nothing and their arguments are not evaluated.
+//
+// A probe is a nop until a tracer attaches. Arguments must be integers or
+// pointers: durations are microseconds, return codes are those of the
+// function or library called, sizes are bytes. The done probes of functions
+// that throw only fire when the function returns or after the request.
+//
+//   bpftrace -e 'usdt:/lib/security/pam_oauth2_device.so:poll__done
+//                { @rtt_us = hist(arg1); }'
+#ifdef PAM_OAUTH2_DEVICE_USDT
+
+#include <sys/sdt.h>
+
+#include <chrono>
+
+#define PROBE(...) STAP_PROBEV(pam_oauth2_device, __VA_ARGS__)
+// Declares the start time of a probed duration
+#define PROBE_START(start) \
+  const std::chrono::steady_clock::time_point start = \
+      std::chrono::steady_clock::now()
+#define PROBE_ELAPSED_US(start)                                  \
+  static_cast<long long>(                                        \
+      std::chrono::duration_cast<std::chrono::microseconds>(     \
+          std::chrono::steady_clock::now() - (start))            \
+          .count())
+
+#else
+
+#define PROBE(...) \
+  do {             \
+  } while (0)
+#define PROBE_START(start) \
+  do {                     \
+  } while (0)
+
+#endif  // PAM_OAUTH2_DEVICE_USDT
+
+#endif  // PAM_OAUTH2_DEVICE_PROBES_HPP
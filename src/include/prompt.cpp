@@ -0,0 +1,132 @@
+#include "prompt.hpp"
+
+#include <string>
+#include <vector>
+
+// Placeholder names in the order of the fields
+static const char *const kFields[] = {"uri", "code", "qr", "expires"};
+
+static int find_field(const std::string &name) {
+  for (int i = 0; i < 4; ++i) {
+    if (name == kFields[i]) return i;
+  }
+  return -1;
+}
+
+PromptTemplate::PromptTemplate(const std::string &text) {
+  std::vector<size_t> open;  // Sections without their end yet
+  size_t literal = 0;
+  for (size_t brace = text.find('{'); brace != std::string::npos;
+       brace = text.find('{', brace + 1)) {
+    size_t close = text.find('}', brace);
+    if (close == std::string::npos) break;
+    std::string name = text.substr(brace + 1, close - brace - 1);
+    Segment segment;
+    segment.end = 0;
+    if ((segment.field = find_field(name)) != -1) {
+      segment.kind = FIELD;
+    } else if (!name.empty() && name[0] == '#' &&
+               (segment.field = find_field(name.substr(1))) != -1) {
+      segment.kind = SECTION;
+    } else if (!name.empty() && name[0] == '/' && !open.empty() &&
+               segments[open.back()].field == find_field(name.substr(1))) {
+      segment.kind = END;
+      segment.field = segments[open.back()].field;
+    } else {
+      continue;
+    }
+    add_literal(text, literal, brace - literal);
+    if (segment.kind == END) {
+      segments[open.back()].end = segments.size();
+      open.pop_back();
+    }
+    if (segment.kind == SECTION) open.push_back(segments.size());
+    segments.push_back(segment);
+    literal = close + 1;
+    brace = close;
+  }
+  add_literal(text, literal, text.length() - literal);
+  for (auto section : open) segments[section].end = segments.size();
+}
+
+void PromptTemplate::add_literal(const std::string &text, size_t begin,
+                                 size_t length) {
+  if (length == 0) return;
+  if (segments.empty() || segments.back().kind != LITERAL) {
+    Segment segment;
+    segment.kind = LITERAL;
+    segment.field = -1;
+    segment.end = 0;
+    segments.push_back(segment);
+  }
+  segments.back().text.append(text, begin, length);
+}
+
+std::string PromptTemplate::render(const PromptValues &values) const {
+  const std::string *fields[] = {&values.uri, &values.code, &values.qr,
+                                 &values.expires};
+  // Measure first, then fill
+  size_t length = 0;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    const Segment &segment = segments[i];
+    if (segment.kind == SECTION && fields[segment.field]->empty()) {
+      i = segment.end;
+    } else if (segment.kind == LITERAL) {
+      length += segment.text.length();
+    } else if (segment.kind == FIELD) {
+      length += fields[segment.field]->length();
+    }
+  }
+  std::string result;
+  result.reserve(length);
+  for (size_t i = 0; i < segments.size(); ++i) {
+    const Segment &segment = segments[i];
+    if (segment.kind == SECTION && fields[segment.field]->empty()) {
+      i = segment.end;
+    } else if (segment.kind == LITERAL) {
+      result.append(segment.text);
+    } else if (segment.kind == FIELD) {
+      result.append(*fields[segment.field]);
+    }
+  }
+  return result;
+}
+
+void PromptTemplates::set(const std::string &locale, const std::string &text) {
+  templates.erase(locale);
+  templates.insert(std::make_pair(locale, PromptTemplate(text)));
+}
+
+const PromptTemplate &PromptTemplates::get(const std::string &locale) const {
+  static const PromptTemplate default_template;
+  // language[_territory][.codeset][@modifier]
+  std::string name = locale.substr(0, locale.find_first_of(".@"));
+  auto found = templates.find(name);
+  if (found == templates.end() && name.find('_') != std::string::npos) {
+    found = templates.find(name.substr(0, name.find('_')));
+  }
+  if (found == templates.end() || name.empty()) found = templates.find("");
+  return found != templates.end() ? found->second : default_template;
+}
+
+std::string escape_uri(const std::string &uri) {
+  static const char kHex[] = "0123456789ABCDEF";
+  size_t length = uri.length();
+  for (char c : uri) {
+    unsigned char u = static_cast<unsigned char>(c);
+    if (u <= ' ' || u == 0x7f) length += 2;
+  }
+  std::string result;
+  result.reserve(length);
+  for (char c : uri) {
+    unsigned char u = static_cast<unsigned char>(c);
+    if (u <= ' ' || u == 0x7f) {
+      result.push_back('%');
+      result.push_back(kHex[u >> 4]);
+      result.push_back(kHex[u & 15]);
+    } else {
+      result.push_back(c);
+    }
+  }
+  return result;
+}
@@ -0,0 +1,65 @@
+#ifndef PAM_OAUTH2_DEVICE_PROMPT_HPP
+#define PAM_OAUTH2_DEVICE_PROMPT_HPP
+
+#include <stddef.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// The prompt shown when no template is configured
+#define PROMPT_DEFAULT_TEMPLATE                                               \
+  "Authenticate at the identity provider using the following URL.\n\n"       \
+  "{#qr}Alternatively, to authenticate with a mobile device, scan the QR "   \
+  "code.\n\n{qr}\n{/qr}"                                                      \
+  "{uri}\n"                                                                   \
+  "{#code}With code: {code}\n{/code}"                                         \
+  "\nHit enter when you have authenticated.\n"
+
+// Values filled into a prompt template, empty when there is none
+struct PromptValues {
+  std::string uri, code, qr, expires;
+};
+
+// Prompt text compiled into literal text and placeholders. {uri}, {code},
+// {qr} and {expires} are replaced by the values, the text between {#name}
+// and {/name} is left out when the value is empty. Other braces are kept as
+// they are, a section without its end runs to the end of the text.
+class PromptTemplate {
+ public:
+  explicit PromptTemplate(const std::string &text = PROMPT_DEFAULT_TEMPLATE);
+  // Returns the prompt, built in a single allocation
+  std::string render(const PromptValues &values) const;
+
+ private:
+  enum Kind { LITERAL, FIELD, SECTION, END };
+  struct Segment {
+    Kind kind;
+    int field;
+    std::string text;
+    // Index of the END of a SECTION
+    size_t end;
+  };
+  void add_literal(const std::string &text, size_t begin, size_t length);
+
+  std::vector<Segment> segments;
+};
+
+// Prompt templates by locale
+class PromptTemplates {
+ public:
+  // locale "" sets the template of all other locales
+  void set(const std::string &locale, const std::string &text);
+  // Returns the template of the locale, e.g. "de_CH.UTF-8", looked up as
+  // language and territory, then as language alone
+  const PromptTemplate &get(const std::string &locale) const;
+
+ private:
+  std::map<std::string, PromptTemplate> templates;
+};
+
+// Percent-encodes the spaces and control characters of a URI, which would
+// end a link or reach the terminal as they are.
+std::string escape_uri(const std::string &uri);
+
+#endif  // PAM_OAUTH2_DEVICE_PROMPT_HPP
@@ -0,0 +1,143 @@
+#include "qrcache.hpp"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define QRCACHE_MAGIC 0x51524331
+// Larger files are not QR codes rendered by this module
+#define QRCACHE_MAX_FILE (1 << 20)
+
+QrCache::QrCache(const std::string &dir) : dir(dir) {}
+
+QrCache *QrCache::shared(const std::string &dir) {
+  static std::mutex caches_mutex;
+  static std::map<std::string, std::unique_ptr<QrCache>> caches;
+  std::lock_guard<std::mutex> lock(caches_mutex);
+  std::unique_ptr<QrCache> &cache = caches[dir];
+  if (!cache) cache.reset(new QrCache(dir));
+  return cache.get();
+}
+
+std::string QrCache::key(const std::string &text, int ecc, int border,
+                         const std::string &renderer,
+                         const std::string &mask) {
+  return std::to_string(ecc) + ' ' + std::to_string(border) + ' ' + renderer +
+         ' ' + mask + ' ' + text;
+}
+
+uint64_t QrCache::hash(const std::string &key) {
+  uint64_t result = 0xcbf29ce484222325;
+  for (char c : key) {
+    result ^= static_cast<unsigned char>(c);
+    result *= 0x100000001b3;
+  }
+  return result;
+}
+
+std::string QrCache::path(const std::string &key) const {
+  char name[32];
+  snprintf(name, sizeof(name), "/qr-%016" PRIx64, hash(key));
+  return dir + name;
+}
+
+bool QrCache::get(const std::string &key, std::string *rendered) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto entry = entries.find(key);
+    if (entry != entries.end()) {
+      *rendered = entry->second;
+      return true;
+    }
+  }
+  if (dir.empty() || !load(key, rendered)) return false;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (entries.size() >= QRCACHE_MAX_ENTRIES) entries.clear();
+  entries[key] = *rendered;
+  return true;
+}
+
+void QrCache::put(const std::string &key, const std::string &rendered) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entries.size() >= QRCACHE_MAX_ENTRIES) entries.clear();
+    entries[key] = rendered;
+  }
+  if (!dir.empty()) store(key, rendered);
+}
+
+bool QrCache::load(const std::string &key, std::string *rendered) const {
+  struct stat st;
+  int fd = ::open(path(key).c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (fd == -1) return false;
+  // The prompt is written to the terminal as it is, only trust files nobody
+  // else could have written
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+      (st.st_mode & (S_IWGRP | S_IWOTH)) != 0 ||
+      st.st_size < (off_t)sizeof(QrCacheHeader) ||
+      st.st_size > QRCACHE_MAX_FILE) {
+    close(fd);
+    return false;
+  }
+  std::string data(st.st_size, '\0');
+  size_t done = 0;
+  while (done < data.length()) {
+    ssize_t n = read(fd, &data[done], data.length() - done);
+    if (n <= 0) break;
+    done += n;
+  }
+  close(fd);
+  if (done != data.length()) return false;
+  QrCacheHeader header;
+  memcpy(&header, data.data(), sizeof(header));
+  if (header.magic != QRCACHE_MAGIC || header.key_length != key.length() ||
+      sizeof(header) + header.key_length + header.rendered_length !=
+          data.length() ||
+      data.compare(sizeof(header), key.length(), key) != 0) {
+    return false;
+  }
+  rendered->assign(data, sizeof(header) + key.length(), std::string::npos);
+  return true;
+}
+
+void QrCache::store(const std::string &key, const std::string &rendered) const {
+  QrCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = QRCACHE_MAGIC;
+  header.key_length = key.length();
+  header.rendered_length = rendered.length();
+  if (sizeof(header) + key.length() + rendered.length() > QRCACHE_MAX_FILE) {
+    return;
+  }
+  mkdir(dir.c_str(), 0700);
+
+  std::string file_path = path(key);
+  std::string tmp_path = file_path + ".XXXXXX";
+  std::vector<char> tmp_name(tmp_path.begin(), tmp_path.end());
+  tmp_name.push_back('\0');
+  int fd = mkstemp(tmp_name.data());
+  if (fd == -1) return;
+  FILE *file = fdopen(fd, "wb");
+  if (file == NULL) {
+    close(fd);
+    unlink(tmp_name.data());
+    return;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(key.data(), 1, key.length(), file) == key.length() &&
+            fwrite(rendered.data(), 1, rendered.length(), file) ==
+                rendered.length();
+  ok = fclose(file) == 0 && ok;
+  if (ok) ok = rename(tmp_name.data(), file_path.c_str()) == 0;
+  if (!ok) unlink(tmp_name.data());
+}
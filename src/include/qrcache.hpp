@@ -0,0 +1,52 @@
+#ifndef PAM_OAUTH2_DEVICE_QRCACHE_HPP
+#define PAM_OAUTH2_DEVICE_QRCACHE_HPP
+
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+
+// Entries kept in process memory, they are all dropped when it is full.
+#define QRCACHE_MAX_ENTRIES 16
+
+struct QrCacheHeader {
+  uint32_t magic;
+  uint32_t key_length;
+  uint64_t rendered_length;
+};
+
+// Rendered QR codes of texts that repeat across logins, such as the
+// verification URI when the provider sends no complete URI. Entries are kept
+// in process memory and, when a directory is set, in one file each, so the
+// processes forked for every login share them. A file is named after the
+// FNV-1a hash of its key and holds the key itself, a collision is a miss.
+class QrCache {
+ public:
+  // dir "" keeps the entries in memory only
+  explicit QrCache(const std::string &dir = "");
+  // Returns the cache of dir, shared by the process
+  static QrCache *shared(const std::string &dir);
+  // Returns the key of text drawn by the renderer called renderer with the
+  // other settings of getQr.
+  static std::string key(const std::string &text, int ecc, int border,
+                         const std::string &renderer, const std::string &mask);
+  static uint64_t hash(const std::string &key);
+  bool get(const std::string &key, std::string *rendered);
+  // Files are written to a temporary file and renamed, so the readers see
+  // either no entry or a complete one.
+  void put(const std::string &key, const std::string &rendered);
+
+ private:
+  QrCache(const QrCache &);
+  QrCache &operator=(const QrCache &);
+  std::string path(const std::string &key) const;
+  bool load(const std::string &key, std::string *rendered) const;
+  void store(const std::string &key, const std::string &rendered) const;
+
+  std::string dir;
+  std::map<std::string, std::string> entries;
+  std::mutex mutex;
+};
+
+#endif  // PAM_OAUTH2_DEVICE_QRCACHE_HPP
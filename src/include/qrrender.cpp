@@ -0,0 +1,278 @@
+#include "qrrender.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Pixels per module in Sixel images, one module row per band of 6 pixels
+#define QRRENDER_SIXEL_SCALE 6
+// Largest payload of one Kitty graphics escape sequence
+#define QRRENDER_KITTY_CHUNK 4096
+
+static char *append(char *out, const char *text) {
+  size_t length = strlen(text);
+  memcpy(out, text, length);
+  return out + length;
+}
+
+// Draws rows x columns modules per character in bright white on black, the
+// glyphs are indexed by the light modules, bit row * columns + column. In
+// reverse video the light modules become the dark ones, so each line switches
+// where that saves bytes: the cheapest switches are found by dynamic
+// programming over the cells.
+class TextRenderer : public QrRenderer {
+ public:
+  TextRenderer(const char *text_name, int columns, const char *const *glyphs)
+      : text_name(text_name), columns(columns), glyphs(glyphs) {}
+
+  const char *name() const { return text_name; }
+
+  std::string render(const qrcodegen::QrCode &qr, int border) const {
+    const int rows = 2;
+    const int last = (1 << (rows * columns)) - 1;
+    const int size = qr.getSize();
+    const int width = (size + 2 * border + columns - 1) / columns;
+    // Never longer than a line without switches
+    const size_t line_capacity =
+        strlen("\033[40;97m") + 3 * width + strlen("\033[0m\n");
+    std::string result(line_capacity * ((size + 2 * border + 1) / rows), '\0');
+    char *out = &result[0];
+    std::vector<unsigned char> cells(width), from_reverse(2 * width);
+    for (int y = -border; y < size + border; y += rows) {
+      // cost[v] is the length of the line so far ending in video v. Starting
+      // in reverse video takes 2 bytes, entering it later 4 and leaving it 5.
+      long cost[2] = {0, 2};
+      for (int x = 0; x < width; ++x) {
+        cells[x] = 0;
+        for (int bit = 0; bit < rows * columns; ++bit) {
+          if (!qr.getModule(x * columns + bit % columns - border,
+                            y + bit / columns)) {
+            cells[x] |= 1 << bit;
+          }
+        }
+        long next[2];
+        for (int v = 0; v < 2; ++v) {
+          long stay = cost[v], change = cost[1 - v] + (v ? 4 : 5);
+          from_reverse[2 * x + v] = (stay <= change) == (v == 1);
+          next[v] = std::min(stay, change) +
+                    strlen(glyphs[v ? last - cells[x] : cells[x]]);
+        }
+        cost[0] = next[0];
+        cost[1] = next[1];
+      }
+      // Trace the videos back into from_reverse[2 * x]
+      int video = cost[1] < cost[0];
+      for (int x = width - 1; x >= 0; --x) {
+        int previous = from_reverse[2 * x + video];
+        from_reverse[2 * x] = video;
+        video = previous;
+      }
+      out = append(out, from_reverse[0] ? "\033[40;97;7m" : "\033[40;97m");
+      for (int x = 0; x < width; ++x) {
+        bool reverse = from_reverse[2 * x];
+        if (x > 0 && reverse != from_reverse[2 * x - 2]) {
+          out = append(out, reverse ? "\033[7m" : "\033[27m");
+        }
+        out = append(out, glyphs[reverse ? last - cells[x] : cells[x]]);
+      }
+      out = append(out, "\033[0m\n");
+    }
+    result.resize(out - result.data());
+    return result;
+  }
+
+ private:
+  const char *text_name;
+  int columns;
+  const char *const *glyphs;
+};
+
+// Paints each band of 6 pixel rows white, then the dark modules of its
+// module row black, with runs of equal sixels compressed.
+class SixelRenderer : public QrRenderer {
+ public:
+  const char *name() const { return "sixel"; }
+
+  std::string render(const qrcodegen::QrCode &qr, int border) const {
+    const int size = qr.getSize();
+    const int width = size + 2 * border;
+    std::string result("\033Pq\"1;1;");
+    result.append(std::to_string(width * QRRENDER_SIXEL_SCALE) + ";" +
+                  std::to_string(width * QRRENDER_SIXEL_SCALE));
+    result.append("#0;2;0;0;0#1;2;100;100;100");
+    std::string white_band(
+        "#1!" + std::to_string(width * QRRENDER_SIXEL_SCALE) + "~$#0");
+    for (int y = -border; y < size + border; ++y) {
+      result.append(white_band);
+      for (int x = -border; x < size + border;) {
+        int end = x + 1;
+        while (end < size + border &&
+               qr.getModule(end, y) == qr.getModule(x, y)) {
+          ++end;
+        }
+        // Light pixels are left as painted, a light run ending the row
+        // needs no sixels at all
+        bool dark = qr.getModule(x, y);
+        if (dark || end < size + border) {
+          int pixels = (end - x) * QRRENDER_SIXEL_SCALE;
+          result.append("!" + std::to_string(pixels));
+          result.push_back(dark ? '~' : '?');
+        }
+        x = end;
+      }
+      if (y < size + border - 1) result.push_back('-');
+    }
+    result.append("\033\\\n");
+    return result;
+  }
+};
+
+static uint32_t crc32(const unsigned char *data, size_t length, uint32_t crc) {
+  crc = ~crc;
+  for (size_t i = 0; i < length; ++i) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+static void append_uint32(std::string *out, uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out->push_back(static_cast<char>((value >> shift) & 0xff));
+  }
+}
+
+static void append_png_chunk(std::string *png, const char *type,
+                             const std::string &data) {
+  std::string chunk(type);
+  chunk.append(data);
+  append_uint32(png, data.length());
+  png->append(chunk);
+  append_uint32(png,
+                crc32(reinterpret_cast<const unsigned char *>(chunk.data()),
+                      chunk.length(), 0));
+}
+
+// Returns a 1-bit grayscale PNG with one pixel per module. The image data is
+// stored without compression, the terminal scales it up.
+static std::string make_png(const qrcodegen::QrCode &qr, int border) {
+  const int size = qr.getSize();
+  const int width = size + 2 * border;
+  const size_t stride = 1 + (width + 7) / 8;  // Filter type and pixels
+  std::string pixels(stride * width, '\0');
+  for (int y = 0; y < width; ++y) {
+    for (int x = 0; x < width; ++x) {
+      if (!qr.getModule(x - border, y - border)) {
+        pixels[y * stride + 1 + x / 8] |= 0x80 >> (x % 8);
+      }
+    }
+  }
+  // zlib stream of stored deflate blocks
+  std::string zlib("\x78\x01", 2);
+  uint32_t adler_a = 1, adler_b = 0;
+  for (size_t i = 0; i < pixels.length(); ++i) {
+    adler_a = (adler_a + static_cast<unsigned char>(pixels[i])) % 65521;
+    adler_b = (adler_b + adler_a) % 65521;
+  }
+  for (size_t start = 0; start < pixels.length(); start += 65535) {
+    size_t length = std::min<size_t>(65535, pixels.length() - start);
+    zlib.push_back(start + length == pixels.length() ? 1 : 0);
+    zlib.push_back(static_cast<char>(length & 0xff));
+    zlib.push_back(static_cast<char>(length >> 8));
+    zlib.push_back(static_cast<char>(~length & 0xff));
+    zlib.push_back(static_cast<char>((~length >> 8) & 0xff));
+    zlib.append(pixels, start, length);
+  }
+  append_uint32(&zlib, adler_b << 16 | adler_a);
+
+  std::string header;
+  append_uint32(&header, width);
+  append_uint32(&header, width);
+  header.append("\x01\x00\x00\x00\x00", 5);  // 1 bit grayscale
+  std::string png("\x89PNG\r\n\x1a\n");
+  append_png_chunk(&png, "IHDR", header);
+  append_png_chunk(&png, "IDAT", zlib);
+  append_png_chunk(&png, "IEND", "");
+  return png;
+}
+
+static std::string base64(const std::string &data) {
+  static const char kAlphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string result;
+  result.reserve((data.length() + 2) / 3 * 4);
+  for (size_t i = 0; i < data.length(); i += 3) {
+    uint32_t group = static_cast<unsigned char>(data[i]) << 16;
+    if (i + 1 < data.length()) {
+      group |= static_cast<unsigned char>(data[i + 1]) << 8;
+    }
+    if (i + 2 < data.length()) group |= static_cast<unsigned char>(data[i + 2]);
+    result.push_back(kAlphabet[group >> 18]);
+    result.push_back(kAlphabet[(group >> 12) & 63]);
+    result.push_back(i + 1 < data.length() ? kAlphabet[(group >> 6) & 63]
+                                           : '=');
+    result.push_back(i + 2 < data.length() ? kAlphabet[group & 63] : '=');
+  }
+  return result;
+}
+
+// Transmits a PNG with one pixel per module and displays it over one column
+// per module, and half as many rows as the cells are about twice as high.
+// Responses from the terminal are suppressed, they would end up in the
+// prompt's input.
+class KittyRenderer : public QrRenderer {
+ public:
+  const char *name() const { return "kitty"; }
+
+  std::string render(const qrcodegen::QrCode &qr, int border) const {
+    const int width = qr.getSize() + 2 * border;
+    std::string payload = base64(make_png(qr, border));
+    std::string result("\033_Ga=T,f=100,q=2,c=" + std::to_string(width) +
+                       ",r=" + std::to_string((width + 1) / 2) + ",");
+    for (size_t start = 0; start < payload.length();
+         start += QRRENDER_KITTY_CHUNK) {
+      bool more = start + QRRENDER_KITTY_CHUNK < payload.length();
+      if (start > 0) result.append("\033_G");
+      result.append(more ? "m=1;" : "m=0;");
+      result.append(payload, start, QRRENDER_KITTY_CHUNK);
+      result.append("\033\\");
+    }
+    result.push_back('\n');
+    return result;
+  }
+};
+
+const QrRenderer *QrRenderer::get(const std::string &name,
+                                  const std::string &term) {
+  // Glyphs of the light modules: top and bottom
+  static const char *const kHalfBlocks[] = {" ", "\u2580", "\u2584",
+                                            "\u2588"};
+  // Top left, top right, bottom left and bottom right
+  static const char *const kQuadrants[] = {
+      " ",      "\u2598", "\u259d", "\u2580", "\u2596", "\u258c",
+      "\u259e", "\u259b", "\u2597", "\u259a", "\u2590", "\u259c",
+      "\u2584", "\u2599", "\u259f", "\u2588"};
+  static const TextRenderer halfblock("halfblock", 1, kHalfBlocks);
+  static const TextRenderer quadrant("quadrant", 2, kQuadrants);
+  static const SixelRenderer sixel;
+  static const KittyRenderer kitty;
+
+  if (name == "auto") {
+    if (term.find("kitty") != std::string::npos) return &kitty;
+    if (term.find("sixel") != std::string::npos || term == "mlterm" ||
+        term == "yaft-256color" || term == "foot" || term == "wezterm") {
+      return &sixel;
+    }
+    return &halfblock;
+  }
+  if (name == "halfblock") return &halfblock;
+  if (name == "quadrant") return &quadrant;
+  if (name == "sixel") return &sixel;
+  if (name == "kitty") return &kitty;
+  return NULL;
+}
@@ -0,0 +1,26 @@
+#ifndef PAM_OAUTH2_DEVICE_QRRENDER_HPP
+#define PAM_OAUTH2_DEVICE_QRRENDER_HPP
+
+#include <string>
+
+#include "nayuki/QrCode.hpp"
+
+// Draws QR codes for a terminal. The text renderers pack 2x1 or 2x2 modules
+// into a character, the graphics renderers send an image with the Sixel or
+// the Kitty graphics protocol.
+class QrRenderer {
+ public:
+  virtual ~QrRenderer() {}
+  // Returns the code with a quiet zone of border modules, ending in a newline
+  virtual std::string render(const qrcodegen::QrCode &qr,
+                             int border) const = 0;
+  // Returns the name get() knows the renderer by
+  virtual const char *name() const = 0;
+  // Returns the renderer called name, one of "halfblock", "quadrant", "sixel"
+  // and "kitty", or NULL if there is none. "auto" picks the densest renderer
+  // the terminal type term is known to support.
+  static const QrRenderer *get(const std::string &name,
+                               const std::string &term);
+};
+
+#endif  // PAM_OAUTH2_DEVICE_QRRENDER_HPP
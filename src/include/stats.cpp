@@ -0,0 +1,340 @@
+#include "stats.hpp"
+
+#include <fcntl.h>
+#include <math.h>
+#include <security/pam_appl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "metrics.hpp"
+
+// Change with the layout of StatsTable
+#define STATS_MAGIC 0x53544131
+
+static const char *const kHistogramNames[] = {
+    "total_ms",          "config_ms",
+    "get_user_ms",       "device_ms",
+    "qr_ms",             "conversation_ms",
+    "poll_ms",           "poll_rtt_ms",
+    "userinfo_ms",       "usermap_ms",
+    "ldap_index_ms",     "ldap_prefetch_wait_ms",
+    "ldap_prefetch_ms",  "ldap_ms",
+    "ldap_group_ms",     "polls"};
+static_assert(sizeof(kHistogramNames) / sizeof(kHistogramNames[0]) ==
+                  STATS_HISTOGRAMS,
+              "a name for every histogram");
+
+static const char *const kCounterNames[] = {
+    "logins_success",           "logins_auth_err",
+    "logins_other_err",         "bytes_sent",
+    "bytes_received",           "qr_cache_hits",
+    "qr_cache_misses",          "ldap_matches",
+    "ldap_misses",              "ldap_errors",
+    "authorized_usermap",       "authorized_ldap_prefetch",
+    "authorized_ldap_index",    "authorized_ldap",
+    "authorized_ldap_group"};
+static_assert(sizeof(kCounterNames) / sizeof(kCounterNames[0]) ==
+                  STATS_COUNTERS,
+              "a name for every counter");
+
+// Upper bounds of the Prometheus buckets, microseconds and polls
+static const uint64_t kSecondsBuckets[] = {
+    100,     250,     500,      1000,     2500,     5000,      10000,
+    25000,   50000,   100000,   250000,   500000,   1000000,   2500000,
+    5000000, 10000000, 30000000, 60000000, 120000000, 300000000};
+static const uint64_t kPollsBuckets[] = {1, 2, 3, 4, 5, 10, 20, 50, 100};
+
+static uint64_t load(const uint64_t *value) {
+  return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+static uint64_t microseconds(double ms) {
+  return ms > 0 ? static_cast<uint64_t>(ms * 1000 + 0.5) : 0;
+}
+
+static int find_histogram(const std::string &name) {
+  for (int i = 0; i < STATS_HISTOGRAMS; ++i) {
+    if (name == kHistogramNames[i]) return i;
+  }
+  return -1;
+}
+
+static int find_counter(const std::string &name) {
+  for (int i = 0; i < STATS_COUNTERS; ++i) {
+    if (name == kCounterNames[i]) return i;
+  }
+  return -1;
+}
+
+Stats::Stats() : fd(-1), writable(false), table(NULL) {}
+
+Stats::~Stats() {
+  if (table != NULL) munmap(table, sizeof(StatsTable));
+  if (fd != -1) close(fd);
+}
+
+bool Stats::open(const std::string &path, bool writable) {
+  if (table != NULL || path.empty()) return false;
+  this->writable = writable;
+  if (writable) {
+    std::string dir = path.substr(0, path.find_last_of('/'));
+    if (!dir.empty() && dir != path) mkdir(dir.c_str(), 0700);
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  } else {
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  }
+  if (fd == -1) return false;
+  struct stat st;
+  if (fstat(fd, &st) == 0 &&
+      (st.st_size >= (off_t)sizeof(StatsTable) ||
+       (writable && ftruncate(fd, sizeof(StatsTable)) == 0))) {
+    void *addr =
+        mmap(NULL, sizeof(StatsTable),
+             writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (addr != MAP_FAILED) {
+      table = static_cast<StatsTable *>(addr);
+      if (writable) {
+        flock(fd, LOCK_EX);
+        if (table->magic != STATS_MAGIC) {
+          memset(table, 0, sizeof(StatsTable));
+          __atomic_store_n(&table->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+        }
+        flock(fd, LOCK_UN);
+      }
+      if (__atomic_load_n(&table->magic, __ATOMIC_ACQUIRE) == STATS_MAGIC) {
+        return true;
+      }
+      munmap(table, sizeof(StatsTable));
+      table = NULL;
+    }
+  }
+  close(fd);
+  fd = -1;
+  return false;
+}
+
+int Stats::bucket(uint64_t value) {
+  if (value < STATS_SUB_BUCKETS) return static_cast<int>(value);
+  int exponent = 63 - __builtin_clzll(value);
+  if (exponent > STATS_MAX_EXPONENT) return STATS_BUCKETS - 1;
+  int shift = exponent - STATS_SUB_BUCKET_BITS;
+  return STATS_SUB_BUCKETS * (shift + 1) +
+         static_cast<int>((value >> shift) - STATS_SUB_BUCKETS);
+}
+
+uint64_t Stats::bucket_limit(int bucket) {
+  if (bucket < STATS_SUB_BUCKETS) return bucket;
+  int shift = bucket / STATS_SUB_BUCKETS - 1;
+  uint64_t lower = static_cast<uint64_t>(STATS_SUB_BUCKETS +
+                                         bucket % STATS_SUB_BUCKETS)
+                   << shift;
+  return lower + (static_cast<uint64_t>(1) << shift) - 1;
+}
+
+void Stats::observe(StatsHistogramId id, uint64_t value) {
+  if (table == NULL || !writable) return;
+  StatsHistogram *histogram = &table->histograms[id];
+  __atomic_fetch_add(&histogram->buckets[bucket(value)], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+  uint64_t max = load(&histogram->max);
+  while (value > max &&
+         !__atomic_compare_exchange_n(&histogram->max, &max, value, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+void Stats::add(StatsCounterId id, uint64_t value) {
+  if (table == NULL || !writable) return;
+  __atomic_fetch_add(&table->counters[id], value, __ATOMIC_RELAXED);
+}
+
+void Stats::record(const LoginMetrics &metrics, int rc) {
+  if (table == NULL || !writable) return;
+  observe(STATS_TOTAL_MS, microseconds(metrics.elapsed_ms()));
+  add(rc == PAM_SUCCESS
+          ? STATS_LOGINS_SUCCESS
+          : rc == PAM_AUTH_ERR ? STATS_LOGINS_AUTH_ERR : STATS_LOGINS_OTHER_ERR,
+      1);
+  for (auto &field : metrics.snapshot()) {
+    int id;
+    switch (field.kind) {
+      case LoginMetrics::MS:
+        id = find_histogram(field.key);
+        if (id != -1) {
+          observe(static_cast<StatsHistogramId>(id), microseconds(field.ms));
+        }
+        break;
+      case LoginMetrics::SAMPLES:
+        id = find_histogram(field.key);
+        if (id == -1) break;
+        for (auto &sample : field.samples) {
+          observe(static_cast<StatsHistogramId>(id),
+                  microseconds(sample.second));
+        }
+        break;
+      case LoginMetrics::COUNT:
+        if (field.count < 0) break;
+        if (field.key == "polls") {
+          observe(STATS_POLLS, field.count);
+        } else if ((id = find_counter(field.key)) != -1) {
+          add(static_cast<StatsCounterId>(id), field.count);
+        }
+        break;
+      case LoginMetrics::TEXT:
+        if (field.key == "authorized_by" &&
+            (id = find_counter("authorized_" + field.text)) != -1) {
+          add(static_cast<StatsCounterId>(id), 1);
+        }
+        break;
+    }
+  }
+}
+
+StatsHistogram Stats::histogram(StatsHistogramId id) const {
+  StatsHistogram result;
+  memset(&result, 0, sizeof(result));
+  if (table == NULL) return result;
+  const StatsHistogram *histogram = &table->histograms[id];
+  // Counted from the buckets read, which the sum and maximum may be ahead of
+  for (int i = 0; i < STATS_BUCKETS; ++i) {
+    result.buckets[i] = load(&histogram->buckets[i]);
+    result.count += result.buckets[i];
+  }
+  result.sum = load(&histogram->sum);
+  result.max = load(&histogram->max);
+  return result;
+}
+
+uint64_t Stats::counter(StatsCounterId id) const {
+  return table != NULL ? load(&table->counters[id]) : 0;
+}
+
+uint64_t Stats::quantile(const StatsHistogram &histogram, double q) {
+  if (histogram.count == 0) return 0;
+  uint64_t rank = static_cast<uint64_t>(ceil(q * histogram.count));
+  if (rank < 1) rank = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < STATS_BUCKETS; ++i) {
+    seen += histogram.buckets[i];
+    if (seen >= rank) {
+      uint64_t limit = bucket_limit(i);
+      return limit < histogram.max ? limit : histogram.max;
+    }
+  }
+  return histogram.max;
+}
+
+const char *Stats::histogram_name(StatsHistogramId id) {
+  return kHistogramNames[id];
+}
+
+const char *Stats::counter_name(StatsCounterId id) { return kCounterNames[id]; }
+
+std::string Stats::text() const {
+  static const double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+  static const char *const kLabels[] = {"p50", "p90", "p99", "p999"};
+  std::string result;
+  char buffer[64];
+  for (int i = 0; i < STATS_COUNTERS; ++i) {
+    StatsCounterId id = static_cast<StatsCounterId>(i);
+    snprintf(buffer, sizeof(buffer), "%s=%llu\n", counter_name(id),
+             static_cast<unsigned long long>(counter(id)));
+    result.append(buffer);
+  }
+  for (int i = 0; i < STATS_HISTOGRAMS; ++i) {
+    StatsHistogramId id = static_cast<StatsHistogramId>(i);
+    StatsHistogram values = histogram(id);
+    if (values.count == 0) continue;
+    // Microseconds are shown as milliseconds
+    double scale = id == STATS_POLLS ? 1 : 1000;
+    snprintf(buffer, sizeof(buffer), "%s count=%llu mean=%.3f",
+             histogram_name(id), static_cast<unsigned long long>(values.count),
+             values.sum / scale / values.count);
+    result.append(buffer);
+    for (int j = 0; j < 4; ++j) {
+      snprintf(buffer, sizeof(buffer), " %s=%.3f", kLabels[j],
+               quantile(values, kQuantiles[j]) / scale);
+      result.append(buffer);
+    }
+    snprintf(buffer, sizeof(buffer), " max=%.3f\n", values.max / scale);
+    result.append(buffer);
+  }
+  return result;
+}
+
+// Appends the buckets, sum and count of a histogram in the Prometheus text
+// format. Each limit is lowered to the upper bound of the last histogram
+// bucket below it, so that every le counts exactly the values up to it.
+static void append_prometheus(const std::string &name,
+                              const std::string &labels,
+                              const StatsHistogram &values,
+                              const uint64_t *limits, size_t count,
+                              double scale, std::string *result) {
+  char buffer[256];
+  std::string prefix = labels.empty() ? "" : labels + ",";
+  uint64_t cumulative = 0;
+  int bucket = 0, exported = 0;
+  for (size_t i = 0; i < count; ++i) {
+    while (bucket < STATS_BUCKETS && Stats::bucket_limit(bucket) <= limits[i]) {
+      cumulative += values.buckets[bucket++];
+    }
+    // Limits within one histogram bucket share its bound
+    if (bucket == exported) continue;
+    exported = bucket;
+    snprintf(buffer, sizeof(buffer), "%s_bucket{%sle=\"%.15g\"} %llu\n",
+             name.c_str(), prefix.c_str(),
+             Stats::bucket_limit(bucket - 1) / scale,
+             static_cast<unsigned long long>(cumulative));
+    result->append(buffer);
+  }
+  std::string braces = labels.empty() ? "" : "{" + labels + "}";
+  snprintf(buffer, sizeof(buffer),
+           "%s_bucket{%sle=\"+Inf\"} %llu\n%s_sum%s %.6f\n%s_count%s %llu\n",
+           name.c_str(), prefix.c_str(),
+           static_cast<unsigned long long>(values.count), name.c_str(),
+           braces.c_str(), values.sum / scale, name.c_str(), braces.c_str(),
+           static_cast<unsigned long long>(values.count));
+  result->append(buffer);
+}
+
+std::string Stats::prometheus() const {
+  std::string result;
+  for (int i = 0; i < STATS_COUNTERS; ++i) {
+    StatsCounterId id = static_cast<StatsCounterId>(i);
+    std::string name =
+        std::string("pam_oauth2_device_") + counter_name(id) + "_total";
+    result += "# TYPE " + name + " counter\n" + name + " " +
+              std::to_string(counter(id)) + "\n";
+  }
+  result +=
+      "# HELP pam_oauth2_device_phase_seconds Duration of the login "
+      "phases.\n"
+      "# TYPE pam_oauth2_device_phase_seconds histogram\n";
+  for (int i = 0; i < STATS_HISTOGRAMS; ++i) {
+    StatsHistogramId id = static_cast<StatsHistogramId>(i);
+    if (id == STATS_POLLS) continue;
+    std::string phase(histogram_name(id));
+    phase.resize(phase.length() - 3);
+    append_prometheus("pam_oauth2_device_phase_seconds",
+                      "phase=\"" + phase + "\"", histogram(id),
+                      kSecondsBuckets,
+                      sizeof(kSecondsBuckets) / sizeof(kSecondsBuckets[0]),
+                      1e6, &result);
+  }
+  result +=
+      "# HELP pam_oauth2_device_polls Token polls of a login.\n"
+      "# TYPE pam_oauth2_device_polls histogram\n";
+  append_prometheus("pam_oauth2_device_polls", "", histogram(STATS_POLLS),
+                    kPollsBuckets,
+                    sizeof(kPollsBuckets) / sizeof(kPollsBuckets[0]), 1,
+                    &result);
+  return result;
+}
@@ -0,0 +1,111 @@
+#ifndef PAM_OAUTH2_DEVICE_STATS_HPP
+#define PAM_OAUTH2_DEVICE_STATS_HPP
+
+#include <stdint.h>
+
+#include <string>
+
+#include "metrics.hpp"
+
+// Histogram buckets: values below STATS_SUB_BUCKETS have their own bucket,
+// larger ones STATS_SUB_BUCKETS per power of two, a precision of about 6%,
+// up to 2^STATS_MAX_EXPONENT. Durations are microseconds, up to 12 days.
+#define STATS_SUB_BUCKET_BITS 4
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BUCKET_BITS)
+#define STATS_MAX_EXPONENT 40
+#define STATS_BUCKETS \
+  (STATS_SUB_BUCKETS * (STATS_MAX_EXPONENT - STATS_SUB_BUCKET_BITS + 2))
+
+// Histograms of the phases in LoginMetrics, plus the polls per login
+enum StatsHistogramId {
+  STATS_TOTAL_MS = 0,
+  STATS_CONFIG_MS,
+  STATS_GET_USER_MS,
+  STATS_DEVICE_MS,
+  STATS_QR_MS,
+  STATS_CONVERSATION_MS,
+  STATS_POLL_MS,
+  STATS_POLL_RTT_MS,
+  STATS_USERINFO_MS,
+  STATS_USERMAP_MS,
+  STATS_LDAP_INDEX_MS,
+  STATS_LDAP_PREFETCH_WAIT_MS,
+  STATS_LDAP_PREFETCH_MS,
+  STATS_LDAP_MS,
+  STATS_LDAP_GROUP_MS,
+  STATS_POLLS,
+  STATS_HISTOGRAMS
+};
+
+enum StatsCounterId {
+  STATS_LOGINS_SUCCESS = 0,
+  STATS_LOGINS_AUTH_ERR,
+  STATS_LOGINS_OTHER_ERR,
+  STATS_BYTES_SENT,
+  STATS_BYTES_RECEIVED,
+  STATS_QR_CACHE_HITS,
+  STATS_QR_CACHE_MISSES,
+  STATS_LDAP_MATCHES,
+  STATS_LDAP_MISSES,
+  STATS_LDAP_ERRORS,
+  STATS_AUTHORIZED_USERMAP,
+  STATS_AUTHORIZED_LDAP_PREFETCH,
+  STATS_AUTHORIZED_LDAP_INDEX,
+  STATS_AUTHORIZED_LDAP,
+  STATS_AUTHORIZED_LDAP_GROUP,
+  STATS_COUNTERS
+};
+
+struct StatsHistogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[STATS_BUCKETS];
+};
+
+struct StatsTable {
+  uint32_t magic;
+  uint32_t reserved;
+  StatsHistogram histograms[STATS_HISTOGRAMS];
+  uint64_t counters[STATS_COUNTERS];
+};
+
+// Latency histograms and counters of all logins, kept in a memory mapped
+// file that every process running the module updates with atomic adds, so
+// no daemon has to collect them. Read by pam_oauth2_device-stats.
+class Stats {
+ public:
+  Stats();
+  ~Stats();
+  // Maps the file, created when writable. A read-only Stats never changes it.
+  bool open(const std::string &path, bool writable = true);
+  // Adds the phases, polls and counts of a login and the PAM return code
+  void record(const LoginMetrics &metrics, int rc);
+  void observe(StatsHistogramId id, uint64_t value);
+  void add(StatsCounterId id, uint64_t value);
+  // Return a copy of a histogram, which other processes may be updating,
+  // a counter, and the q quantile of a histogram: the highest value of its
+  // bucket, at most the maximum
+  StatsHistogram histogram(StatsHistogramId id) const;
+  uint64_t counter(StatsCounterId id) const;
+  static uint64_t quantile(const StatsHistogram &histogram, double q);
+
+  static const char *histogram_name(StatsHistogramId id);
+  static const char *counter_name(StatsCounterId id);
+  static int bucket(uint64_t value);
+  // Returns the highest value in the bucket
+  static uint64_t bucket_limit(int bucket);
+  // Dumps the table as key=value lines, or in the Prometheus text format
+  std::string text() const;
+  std::string prometheus() const;
+
+ private:
+  Stats(const Stats &);
+  Stats &operator=(const Stats &);
+
+  int fd;
+  bool writable;
+  StatsTable *table;
+};
+
+#endif  // PAM_OAUTH2_DEVICE_STATS_HPP
@@ -0,0 +1,248 @@
+#include "trace.hpp"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+// OTLP span kinds and status codes
+#define TRACE_KIND_INTERNAL 1
+#define TRACE_KIND_CLIENT 3
+#define TRACE_STATUS_UNSET 0
+#define TRACE_STATUS_ERROR 2
+
+// Returns random hex digits, two per byte, not all zero. Read from the
+// system for every id, forked processes do not share a generator state.
+static std::string random_hex(size_t bytes) {
+  static const char hex[] = "0123456789abcdef";
+  std::random_device random;
+  std::string result;
+  do {
+    result.clear();
+    for (size_t i = 0; i < bytes; i += 4) {
+      unsigned int value = random();
+      for (size_t j = 0; j < 4 && i + j < bytes; ++j) {
+        result.push_back(hex[(value >> 4) & 0xf]);
+        result.push_back(hex[value & 0xf]);
+        value >>= 8;
+      }
+    }
+  } while (result.find_first_not_of('0') == std::string::npos);
+  return result;
+}
+
+static json attribute_list(
+    const std::vector<std::pair<std::string, std::string>> &attributes) {
+  json result = json::array();
+  for (auto &attribute : attributes) {
+    result.push_back({{"key", attribute.first},
+                      {"value", {{"stringValue", attribute.second}}}});
+  }
+  return result;
+}
+
+LoginTrace::LoginTrace()
+    : trace(random_hex(16)),
+      root(random_hex(8)),
+      start(std::chrono::steady_clock::now()),
+      wall_start(std::chrono::system_clock::now()) {}
+
+const std::string &LoginTrace::trace_id() const { return trace; }
+
+std::string LoginTrace::new_span_id() { return random_hex(8); }
+
+std::string LoginTrace::traceparent(const std::string &span_id) const {
+  return "00-" + trace + "-" + span_id + "-01";
+}
+
+void LoginTrace::add(const TraceSpan &span) {
+  std::lock_guard<std::mutex> lock(mutex);
+  spans.push_back(span);
+}
+
+std::string LoginTrace::resource_spans(
+    const std::string &name,
+    const std::vector<std::pair<std::string, std::string>> &attributes,
+    bool error) const {
+  auto unix_nano = [this](std::chrono::steady_clock::time_point time) {
+    auto wall = wall_start + std::chrono::duration_cast<
+                                 std::chrono::system_clock::duration>(
+                                 time - start);
+    return std::to_string(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              wall.time_since_epoch())
+                              .count());
+  };
+  json result_spans = json::array();
+  result_spans.push_back(
+      {{"traceId", trace},
+       {"spanId", root},
+       {"name", name},
+       {"kind", TRACE_KIND_INTERNAL},
+       {"startTimeUnixNano", unix_nano(start)},
+       {"endTimeUnixNano", unix_nano(std::chrono::steady_clock::now())},
+       {"attributes", attribute_list(attributes)},
+       {"status",
+        {{"code", error ? TRACE_STATUS_ERROR : TRACE_STATUS_UNSET}}}});
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &span : spans) {
+      result_spans.push_back(
+          {{"traceId", trace},
+           {"spanId", span.span_id},
+           {"parentSpanId", root},
+           {"name", span.name},
+           {"kind", span.client ? TRACE_KIND_CLIENT : TRACE_KIND_INTERNAL},
+           {"startTimeUnixNano", unix_nano(span.start)},
+           {"endTimeUnixNano", unix_nano(span.end)},
+           {"attributes", attribute_list(span.attributes)},
+           {"status",
+            {{"code", span.error ? TRACE_STATUS_ERROR : TRACE_STATUS_UNSET}}}});
+    }
+  }
+
+  char host[HOST_NAME_MAX + 1] = "";
+  gethostname(host, sizeof(host) - 1);
+  std::vector<std::pair<std::string, std::string>> resource = {
+      {"service.name", "pam_oauth2_device"},
+      {"host.name", host},
+      {"process.pid", std::to_string(getpid())}};
+  json result = {
+      {"resource", {{"attributes", attribute_list(resource)}}},
+      {"scopeSpans",
+       {{{"scope", {{"name", "pam_oauth2_device"}}},
+         {"spans", result_spans}}}}};
+  return result.dump();
+}
+
+SpanExporter *SpanExporter::get(const std::string &destination) {
+  static std::mutex exporters_mutex;
+  static std::map<std::string, std::unique_ptr<SpanExporter>> exporters;
+  std::lock_guard<std::mutex> lock(exporters_mutex);
+  std::unique_ptr<SpanExporter> &exporter = exporters[destination];
+  // A forked process has the exporter but not its thread, and maybe a mutex
+  // locked for good, so the exporter is left alone
+  if (exporter && exporter->owner() != getpid()) exporter.release();
+  if (!exporter) exporter.reset(new SpanExporter(destination));
+  return exporter.get();
+}
+
+SpanExporter::SpanExporter(const std::string &destination)
+    : destination(destination),
+      pid(getpid()),
+      stopping(false),
+      writing(false),
+      thread(&SpanExporter::run, this) {}
+
+SpanExporter::~SpanExporter() {
+  if (pid != getpid()) {
+    thread.detach();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  ready.notify_all();
+  thread.join();
+}
+
+pid_t SpanExporter::owner() const { return pid; }
+
+bool SpanExporter::enqueue(const std::string &resource_spans) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (queue.size() >= TRACE_MAX_QUEUED) return false;
+    queue.push_back(resource_spans);
+  }
+  ready.notify_all();
+  return true;
+}
+
+void SpanExporter::flush() {
+  std::unique_lock<std::mutex> lock(mutex);
+  written.wait(lock, [this]() { return queue.empty() && !writing; });
+}
+
+void SpanExporter::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    ready.wait(lock, [this]() { return stopping || !queue.empty(); });
+    if (queue.empty()) break;
+    // Lets concurrent logins join the batch
+    ready.wait_for(lock, std::chrono::milliseconds(TRACE_BATCH_DELAY_MS),
+                   [this]() {
+                     return stopping || queue.size() >= TRACE_MAX_BATCH;
+                   });
+    std::string line("{\"resourceSpans\":[");
+    for (int i = 0; i < TRACE_MAX_BATCH && !queue.empty(); ++i) {
+      if (i > 0) line.push_back(',');
+      line.append(queue.front());
+      queue.pop_front();
+    }
+    line.append("]}\n");
+    writing = true;
+    lock.unlock();
+    if (!write(line)) {
+      syslog(LOG_WARNING, "cannot export spans to %s", destination.c_str());
+    }
+    lock.lock();
+    writing = false;
+    written.notify_all();
+  }
+}
+
+bool SpanExporter::write(const std::string &line) {
+  int fd;
+  bool socket_fd = destination.compare(0, 5, "unix:") == 0;
+  if (socket_fd) {
+    std::string path = destination.substr(5);
+    struct sockaddr_un address;
+    if (path.length() >= sizeof(address.sun_path)) return false;
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return false;
+    struct timeval timeout;
+    timeout.tv_sec = TRACE_SEND_TIMEOUT_MS / 1000;
+    timeout.tv_usec = TRACE_SEND_TIMEOUT_MS % 1000 * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.length() + 1);
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&address),
+                sizeof(address)) != 0) {
+      close(fd);
+      return false;
+    }
+  } else {
+    fd = open(destination.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+              0600);
+    if (fd == -1) return false;
+  }
+  size_t done = 0;
+  while (done < line.length()) {
+    // A collector closing the socket must not kill the process with SIGPIPE
+    ssize_t n =
+        socket_fd
+            ? send(fd, line.data() + done, line.length() - done, MSG_NOSIGNAL)
+            : ::write(fd, line.data() + done, line.length() - done);
+    if (n <= 0) break;
+    done += n;
+  }
+  close(fd);
+  return done == line.length();
+}
@@ -0,0 +1,91 @@
+#ifndef PAM_OAUTH2_DEVICE_TRACE_HPP
+#define PAM_OAUTH2_DEVICE_TRACE_HPP
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Logins waiting to be exported, more are dropped
+#define TRACE_MAX_QUEUED 1024
+// Logins written in one ExportTraceServiceRequest
+#define TRACE_MAX_BATCH 64
+// Time the exporter waits for more logins to batch
+#define TRACE_BATCH_DELAY_MS 100
+// Time a write to the collector socket may block
+#define TRACE_SEND_TIMEOUT_MS 1000
+
+struct TraceSpan {
+  std::string name, span_id;
+  std::chrono::steady_clock::time_point start, end;
+  std::vector<std::pair<std::string, std::string>> attributes;
+  // A request to a server, otherwise internal
+  bool client;
+  bool error;
+};
+
+// Spans of one login under a root span covering the login, in a trace with
+// a random W3C trace context id. Safe to use from several threads.
+class LoginTrace {
+ public:
+  LoginTrace();
+  const std::string &trace_id() const;
+  // Returns a random span id, 16 hex digits
+  static std::string new_span_id();
+  // Returns the W3C traceparent header value of a span of the trace
+  std::string traceparent(const std::string &span_id) const;
+  void add(const TraceSpan &span);
+  // Returns the spans, the root span named name ending now, as one
+  // resourceSpans element of an OTLP/JSON ExportTraceServiceRequest
+  std::string resource_spans(
+      const std::string &name,
+      const std::vector<std::pair<std::string, std::string>> &attributes,
+      bool error) const;
+
+ private:
+  std::string trace, root;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::system_clock::time_point wall_start;
+  std::vector<TraceSpan> spans;
+  mutable std::mutex mutex;
+};
+
+// Writes the resourceSpans of logins from a background thread, batched into
+// one ExportTraceServiceRequest per line, appended to a file or, with a
+// destination unix:PATH, sent to a stream socket of a collector. Logins
+// never wait for the export.
+class SpanExporter {
+ public:
+  // Returns the exporter of the destination, shared by the process
+  static SpanExporter *get(const std::string &destination);
+  explicit SpanExporter(const std::string &destination);
+  // Writes what is queued
+  ~SpanExporter();
+  // Queues the resourceSpans of a login, false when the queue is full
+  bool enqueue(const std::string &resource_spans);
+  // Waits until everything queued has been written
+  void flush();
+  pid_t owner() const;
+
+ private:
+  SpanExporter(const SpanExporter &);
+  SpanExporter &operator=(const SpanExporter &);
+  void run();
+  bool write(const std::string &line);
+
+  std::string destination;
+  pid_t pid;
+  std::deque<std::string> queue;
+  bool stopping, writing;
+  std::mutex mutex;
+  std::condition_variable ready, written;
+  std::thread thread;
+};
+
+#endif  // PAM_OAUTH2_DEVICE_TRACE_HPP
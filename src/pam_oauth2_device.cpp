@@ -1,19 +1,39 @@
 #include "pam_oauth2_device.hpp"
 
+#include <ctype.h>
 #include <curl/curl.h>
 #include <security/pam_appl.h>
 #include <security/pam_modules.h>
+#include <stdlib.h>
+#include <string.h>
 #include <syslog.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
-#include <regex>
+#include <future>
+#include <memory>
+#include <set>
 #include <sstream>
+#include <system_error>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include "include/config.hpp"
+#include "include/ldapgroups.hpp"
+#include "include/ldaphealth.hpp"
+#include "include/ldapindex.hpp"
 #include "include/ldapquery.hpp"
+#include "include/metrics.hpp"
 #include "include/nayuki/QrCode.hpp"
 #include "include/nlohmann/json.hpp"
+#include "include/probes.hpp"
+#include "include/prompt.hpp"
+#include "include/qrcache.hpp"
+#include "include/qrrender.hpp"
+#include "include/stats.hpp"
+#include "include/trace.hpp"
 
 using json = nlohmann::json;
 
@@ -42,7 +62,25 @@ class ResponseError : public NetworkError {
   const char *what() const throw() { return "Response Error"; }
 };
 
-std::string getQr(const char *text, const int ecc = 0, const int border = 1) {
+std::string uppercase_scheme_host(const std::string &uri) {
+  std::string result(uri);
+  auto authority = result.find("://");
+  if (authority == std::string::npos) return result;
+  authority += 3;
+  auto path = result.find_first_of("/?#", authority);
+  if (path == std::string::npos) path = result.length();
+  // User information is case-sensitive
+  if (result.find('@', authority) < path) return result;
+  for (size_t i = 0; i < path; ++i) {
+    result[i] = toupper(static_cast<unsigned char>(result[i]));
+  }
+  return result;
+}
+
+std::string getQr(const char *text, const int ecc, const int border,
+                  const QrRenderer *renderer, const std::string &mask) {
+  PROBE_START(start);
+  PROBE(qr__start, text, ecc);
   qrcodegen::QrCode::Ecc error_correction_level;
   switch (ecc) {
     case 1:
@@ -55,71 +93,152 @@ std::string getQr(const char *text, const int ecc = 0, const int border = 1) {
       error_correction_level = qrcodegen::QrCode::Ecc::LOW;
       break;
   }
-  qrcodegen::QrCode qr =
-      qrcodegen::QrCode::encodeText(text, error_correction_level);
-
-  std::ostringstream oss;
-  int i, j, size, top, bottom;
-  size = qr.getSize();
-  for (j = -border; j < size + border; j += 2) {
-    for (i = -border; i < size + border; ++i) {
-      top = qr.getModule(i, j);
-      bottom = qr.getModule(i, j + 1);
-      if (top && bottom) {
-        oss << "\033[40;97m \033[0m";
-      } else if (top && !bottom) {
-        oss << "\033[40;97m\u2584\033[0m";
-      } else if (!top && bottom) {
-        oss << "\033[40;97m\u2580\033[0m";
-      } else {
-        oss << "\033[40;97m\u2588\033[0m";
-      }
-    }
-    oss << std::endl;
+  // Any mask scans, "fast" estimates the penalties of the masks instead of
+  // scoring all of them
+  int mask_number = -1;
+  qrcodegen::QrCode::MaskSearch mask_search =
+      qrcodegen::QrCode::MaskSearch::SERIAL;
+  if (mask == "fast") {
+    mask_search = qrcodegen::QrCode::MaskSearch::FAST;
+  } else if (mask.length() == 1 && mask[0] >= '0' && mask[0] <= '7') {
+    mask_number = mask[0] - '0';
   }
-  return oss.str();
+  // Encoded without heap allocations, a URL too long for any QR Code is
+  // shown without one. Mixing the segment modes keeps the version low.
+  qrcodegen::QrCode qr;
+  if (qrcodegen::QrCode::encodeText(text, error_correction_level, qr, 1, 40,
+                                    mask_number, true, true, mask_search) !=
+      qrcodegen::QrCode::Status::OK) {
+    PROBE(qr__done, text, 0, 0, PROBE_ELAPSED_US(start));
+    return "";
+  }
+
+  if (renderer == NULL) renderer = QrRenderer::get("halfblock", "");
+  std::string rendered = renderer->render(qr, border);
+  PROBE(qr__done, text, qr.getVersion(), rendered.length(),
+        PROBE_ELAPSED_US(start));
+  return rendered;
 }
 
-std::string DeviceAuthResponse::get_prompt(const int qr_ecc = 0,
-                                           const bool qr_show = true) {
+std::string DeviceAuthResponse::get_prompt(
+    const int qr_ecc = 0, const bool qr_show = true,
+    const bool qr_uppercase_host = false,
+    const QrRenderer *qr_renderer = NULL, const std::string &qr_mask = "auto",
+    QrCache *qr_cache = NULL, const PromptTemplate *prompt_template = NULL,
+    LoginMetrics *metrics) {
+  static const PromptTemplate default_template;
   bool complete_url = !verification_uri_complete.empty();
-  std::string prompt_uri(complete_url ? verification_uri_complete
-                                      : verification_uri);
-  std::ostringstream prompt;
-  prompt << "Authenticate at the identity provider using the following URL."
-         << std::endl
-         << std::endl;
+  const std::string &prompt_uri(complete_url ? verification_uri_complete
+                                             : verification_uri);
+  PromptValues values;
+  values.uri = escape_uri(prompt_uri);
+  if (!complete_url) values.code = user_code;
+  // Minutes, rounded up
+  if (expires_in > 0) values.expires = std::to_string((expires_in + 59) / 60);
   if (qr_show) {
-    prompt << "Alternatively, to authenticate with a mobile device, scan the "
-              "QR code."
-           << std::endl
-           << std::endl
-           << getQr(
-                  (complete_url ? verification_uri_complete : verification_uri)
-                      .c_str(),
-                  qr_ecc)
-           << std::endl;
-  }
-  prompt << std::regex_replace(prompt_uri, std::regex("\\s"), "%20")
-         << std::endl;
-  if (!complete_url) {
-    prompt << "With code: " << user_code << std::endl;
-  }
-  prompt << std::endl << "Hit enter when you have authenticated." << std::endl;
-  return prompt.str();
+    std::string qr_text(qr_uppercase_host ? uppercase_scheme_host(prompt_uri)
+                                          : prompt_uri);
+    // Without the user code the URI is the same for every login, so is its
+    // QR code
+    std::string key;
+    if (!complete_url && qr_cache != NULL) {
+      key = QrCache::key(
+          qr_text, qr_ecc, 1,
+          qr_renderer != NULL ? qr_renderer->name() : "halfblock", qr_mask);
+    }
+    bool cached = !key.empty() && qr_cache->get(key, &values.qr);
+    if (!key.empty() && metrics != NULL) {
+      metrics->add_count(cached ? "qr_cache_hits" : "qr_cache_misses", 1);
+    }
+    if (!cached) {
+      values.qr = getQr(qr_text.c_str(), qr_ecc, 1, qr_renderer, qr_mask);
+      if (!key.empty() && !values.qr.empty()) qr_cache->put(key, values.qr);
+    }
+  }
+  return (prompt_template != NULL ? prompt_template : &default_template)
+      ->render(values);
 }
 
-static size_t WriteCallback(void *contents, size_t size, size_t nmemb,
-                            void *userp) {
+size_t WriteCallback(void *contents, size_t size, size_t nmemb, void *userp) {
   ((std::string *)userp)
       ->append(reinterpret_cast<char *>(contents), size * nmemb);
   return size * nmemb;
 }
 
+void parse_authorization_response(const std::string &body,
+                                  DeviceAuthResponse *response) {
+  auto data = json::parse(body);
+  response->user_code = data.at("user_code");
+  response->device_code = data.at("device_code");
+  response->verification_uri = data.at("verification_uri");
+  if (data.find("verification_uri_complete") != data.end()) {
+    response->verification_uri_complete = data.at("verification_uri_complete");
+  }
+  if (data.find("expires_in") != data.end()) {
+    response->expires_in = data.at("expires_in");
+  }
+}
+
+std::string parse_token_response(const std::string &body,
+                                 std::string *token) {
+  auto data = json::parse(body);
+  if (!data["error"].empty()) return data["error"];
+  token->assign(data.at("access_token"));
+  return "";
+}
+
+void parse_userinfo_response(const std::string &body,
+                             const char *username_attribute,
+                             Userinfo *userinfo) {
+  auto data = json::parse(body);
+  userinfo->sub = data.at("sub");
+  userinfo->username = data.at(username_attribute);
+  userinfo->name = data.at("name");
+  userinfo->acr =
+      "urn:oasis:names:tc:SAML:2.0:ac:classes:PasswordProtectedTransport";
+  if (data.find("acr") != data.end()) {
+    userinfo->acr = data.at("acr");
+  }
+}
+
+// Counts the outcome of an LDAP query
+static void count_ldap(LoginMetrics *metrics, int rc) {
+  if (metrics == NULL) return;
+  metrics->add_count(rc == LDAPQUERY_ERROR  ? "ldap_errors"
+                     : rc == LDAPQUERY_TRUE ? "ldap_matches"
+                                            : "ldap_misses",
+                     1);
+}
+
+// Counts the bodies of a request and its response
+static void count_bytes(LoginMetrics *metrics, size_t sent, size_t received) {
+  if (metrics == NULL) return;
+  metrics->add_count("bytes_sent", sent);
+  metrics->add_count("bytes_received", received);
+}
+
+// Adds the traceparent header of a traced request to headers
+static struct curl_slist *add_traceparent(struct curl_slist *headers,
+                                          const std::string &traceparent) {
+  if (traceparent.empty()) return headers;
+  return curl_slist_append(headers, ("traceparent: " + traceparent).c_str());
+}
+
+// Adds the outcome of a request to its span
+static void end_request(PhaseTimer *span, const char *url, CURLcode res) {
+  span->attribute("url.full", url);
+  span->attribute("curl.code", std::to_string(res));
+  if (res != CURLE_OK) span->fail();
+}
+
 void make_authorization_request(const char *client_id,
                                 const char *client_secret, const char *scope,
                                 const char *device_endpoint, bool require_mfa,
-                                DeviceAuthResponse *response) {
+                                DeviceAuthResponse *response,
+                                LoginMetrics *metrics) {
+  PhaseTimer timer(metrics, "device_ms");
+  PROBE_START(start);
+  PROBE(device__start, device_endpoint);
   CURL *curl;
   CURLcode res;
   std::string readBuffer;
@@ -142,21 +261,21 @@ void make_authorization_request(const char *client_id,
   curl_easy_setopt(curl, CURLOPT_POSTFIELDS, params.c_str());
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
+  struct curl_slist *headers = add_traceparent(NULL, timer.client());
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
   res = curl_easy_perform(curl);
   curl_easy_cleanup(curl);
+  curl_slist_free_all(headers);
+  end_request(&timer, device_endpoint, res);
+  count_bytes(metrics, params.length(), readBuffer.length());
+  PROBE(device__done, device_endpoint, res, readBuffer.length(),
+        PROBE_ELAPSED_US(start));
   if (res != CURLE_OK) {
     syslog(LOG_ERR, "make_authorization_request: curl failed, rc=%d", res);
     throw NetworkError();
   }
   try {
-    auto data = json::parse(readBuffer);
-    response->user_code = data.at("user_code");
-    response->device_code = data.at("device_code");
-    response->verification_uri = data.at("verification_uri");
-    if (data.find("verification_uri_complete") != data.end()) {
-      response->verification_uri_complete =
-          data.at("verification_uri_complete");
-    }
+    parse_authorization_response(readBuffer, response);
   } catch (json::exception &e) {
     syslog(LOG_ERR, "make_authorization_request: json parse failed, error=%s",
            e.what());
@@ -166,11 +285,11 @@ void make_authorization_request(const char *client_id,
 
 void poll_for_token(const char *client_id, const char *client_secret,
                     const char *token_endpoint, const char *device_code,
-                    std::string *token) {
+                    std::string *token, LoginMetrics *metrics) {
+  PhaseTimer timer(metrics, "poll_ms");
   int timeout = 300, interval = 3;
   CURL *curl;
   CURLcode res;
-  json data;
   std::ostringstream oss;
   std::string params;
 
@@ -178,7 +297,7 @@ void poll_for_token(const char *client_id, const char *client_secret,
       << "&device_code=" << device_code << "&client_id=" << client_id;
   params = oss.str();
 
-  while (true) {
+  for (int poll = 1;; ++poll) {
     timeout -= interval;
     if (timeout < 0) {
       syslog(LOG_ERR, "poll_for_token: timeout %ds exceeded", timeout);
@@ -198,24 +317,38 @@ void poll_for_token(const char *client_id, const char *client_secret,
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
 
+    PROBE(poll__start, poll, interval);
+    PhaseTimer request(metrics, "", "token");
+    request.attribute("poll", std::to_string(poll));
+    struct curl_slist *headers = add_traceparent(NULL, request.client());
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
     res = curl_easy_perform(curl);
     curl_easy_cleanup(curl);
+    curl_slist_free_all(headers);
+    end_request(&request, token_endpoint, res);
+    double elapsed = request.stop();
+    if (metrics != NULL) {
+      metrics->add_count("polls", 1);
+      metrics->add_sample("poll_rtt_ms", "", elapsed);
+    }
+    count_bytes(metrics, params.length(), readBuffer.length());
+    PROBE(poll__done, poll, res, readBuffer.length(),
+          static_cast<long long>(elapsed * 1000));
     if (res != CURLE_OK) {
       syslog(LOG_ERR, "poll_for_token: curl failed, rc=%d", res);
       throw NetworkError();
     }
     try {
-      data = json::parse(readBuffer);
-      if (data["error"].empty()) {
-        token->assign(data.at("access_token"));
+      std::string error = parse_token_response(readBuffer, token);
+      if (error.empty()) {
         break;
-      } else if (data["error"] == "authorization_pending") {
+      } else if (error == "authorization_pending") {
         // Do nothing
-      } else if (data["error"] == "slow_down") {
+      } else if (error == "slow_down") {
         ++interval;
       } else {
         syslog(LOG_ERR, "poll_for_token: unknown response '%s'",
-               ((std::string)data["error"]).c_str());
+               error.c_str());
         throw ResponseError();
       }
     } catch (json::exception &e) {
@@ -226,7 +359,11 @@ void poll_for_token(const char *client_id, const char *client_secret,
 }
 
 void get_userinfo(const char *userinfo_endpoint, const char *token,
-                  const char *username_attribute, Userinfo *userinfo) {
+                  const char *username_attribute, Userinfo *userinfo,
+                  LoginMetrics *metrics) {
+  PhaseTimer timer(metrics, "userinfo_ms");
+  PROBE_START(start);
+  PROBE(userinfo__start, userinfo_endpoint);
   CURL *curl;
   CURLcode res;
   std::string readBuffer;
@@ -244,32 +381,50 @@ void get_userinfo(const char *userinfo_endpoint, const char *token,
   auth_header += token;
   struct curl_slist *headers = NULL;
   headers = curl_slist_append(headers, auth_header.c_str());
+  headers = add_traceparent(headers, timer.client());
   curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
   res = curl_easy_perform(curl);
   curl_easy_cleanup(curl);
+  curl_slist_free_all(headers);
+  end_request(&timer, userinfo_endpoint, res);
+  count_bytes(metrics, 0, readBuffer.length());
+  PROBE(userinfo__done, userinfo_endpoint, res, readBuffer.length(),
+        PROBE_ELAPSED_US(start));
   if (res != CURLE_OK) {
     syslog(LOG_ERR, "get_userinfo: curl failed, rc=%d", res);
     throw NetworkError();
   }
   try {
-    auto data = json::parse(readBuffer);
-    userinfo->sub = data.at("sub");
-    userinfo->username = data.at(username_attribute);
-    userinfo->name = data.at("name");
-    userinfo->acr =
-        "urn:oasis:names:tc:SAML:2.0:ac:classes:PasswordProtectedTransport";
-    if (data.find("acr") != data.end()) {
-      userinfo->acr = data.at("acr");
-    }
+    parse_userinfo_response(readBuffer, username_attribute, userinfo);
   } catch (json::exception &e) {
     syslog(LOG_ERR, "get_userinfo: json parse failed, error=%s", e.what());
     throw ResponseError();
   }
 }
 
+// Returns the locale of messages from the PAM environment or the service,
+// "" when none is set
+static std::string get_locale(pam_handle_t *pamh) {
+  static const char *const kVariables[] = {"LC_ALL", "LC_MESSAGES", "LANG"};
+  for (auto variable : kVariables) {
+    const char *value = pam_getenv(pamh, variable);
+    if (value != NULL && *value != '\0') return value;
+  }
+  for (auto variable : kVariables) {
+    const char *value = getenv(variable);
+    if (value != NULL && *value != '\0') return value;
+  }
+  return "";
+}
+
 void show_prompt(pam_handle_t *pamh, const int qr_error_correction_level,
-                 const bool qr_show, DeviceAuthResponse *device_auth_response) {
+                 const bool qr_show, const bool qr_uppercase_host,
+                 const std::string &qr_renderer, const std::string &qr_mask,
+                 const std::string &qr_cache_dir,
+                 const PromptTemplates &prompt_templates,
+                 DeviceAuthResponse *device_auth_response,
+                 LoginMetrics *metrics) {
   int pam_err;
   char *response;
   struct pam_conv *conv;
@@ -278,17 +433,41 @@ void show_prompt(pam_handle_t *pamh, const int qr_error_correction_level,
   struct pam_response *resp;
   std::string prompt;
 
+  PROBE_START(start);
+  PROBE(prompt__start);
   pam_err = pam_get_item(pamh, PAM_CONV, (const void **)&conv);
   if (pam_err != PAM_SUCCESS) {
     syslog(LOG_ERR, "show_prompt: pam_get_item failed, rc=%d", pam_err);
     throw PamError();
   }
-  prompt = device_auth_response->get_prompt(qr_error_correction_level, qr_show);
+  // The terminal type is passed in the PAM environment by some services,
+  // sshd only sets it in the session
+  const char *term = pam_getenv(pamh, "TERM");
+  if (term == NULL) term = getenv("TERM");
+  const QrRenderer *renderer =
+      QrRenderer::get(qr_renderer, term != NULL ? term : "");
+  if (renderer == NULL) {
+    syslog(LOG_WARNING, "unknown QR renderer %s, using halfblock",
+           qr_renderer.c_str());
+  }
+  PhaseTimer qr_timer(metrics, "qr_ms");
+  prompt = device_auth_response->get_prompt(qr_error_correction_level, qr_show,
+                                            qr_uppercase_host, renderer,
+                                            qr_mask,
+                                            QrCache::shared(qr_cache_dir),
+                                            &prompt_templates.get(
+                                                get_locale(pamh)),
+                                            metrics);
+  qr_timer.stop();
+  PROBE(prompt__rendered, prompt.length(), PROBE_ELAPSED_US(start));
   msg.msg_style = PAM_PROMPT_ECHO_OFF;
   msg.msg = prompt.c_str();
   msgp = &msg;
   response = NULL;
+  PhaseTimer conversation_timer(metrics, "conversation_ms");
   pam_err = (*conv->conv)(1, &msgp, &resp, conv->appdata_ptr);
+  conversation_timer.stop();
+  PROBE(prompt__done, pam_err, PROBE_ELAPSED_US(start));
   if (resp != NULL) {
     if (pam_err == PAM_SUCCESS) {
       response = resp->resp;
@@ -300,9 +479,60 @@ void show_prompt(pam_handle_t *pamh, const int qr_error_correction_level,
   if (response) free(response);
 }
 
+std::string prefetch_filter(const Config &config,
+                            const std::string &username_local) {
+  std::string filter = config.ldap_filter;
+  auto pos = filter.find("%s");
+  if (pos != std::string::npos) filter.replace(pos, 2, "*");
+  return "(&" + filter + "(" + config.ldap_attr + "=" +
+         ldap_escape_filter(username_local) + "))";
+}
+
+// Looks up the remote users that LDAP maps to the local account. Runs while
+// the user authenticates at the identity provider, so that the final
+// authorization does not wait for LDAP. Gives up after the current LDAP
+// request once cancel is set.
+std::set<std::string> prefetch_ldap_users(const Config &config,
+                                          const std::string &username_local,
+                                          LoginMetrics *metrics,
+                                          const std::atomic<bool> *cancel) {
+  std::set<std::string> remote_users;
+  std::string filter = prefetch_filter(config, username_local);
+
+  LdapHealth health;
+  health.open(config.ldap_health_file);
+  for (auto ldap_host : health.order(config.ldap_hosts)) {
+    if (*cancel) break;
+    std::map<std::string, std::set<std::string>> mapping;
+    auto start = std::chrono::steady_clock::now();
+    int rc = ldap_get_mapping(ldap_host, config.ldap_basedn, config.ldap_user,
+                              config.ldap_passwd, filter, config.ldap_key_attr,
+                              config.ldap_attr, &mapping, metrics, cancel);
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    // An interrupted mapping says nothing about the host
+    if (*cancel) break;
+    health.record(ldap_host, rc != LDAPQUERY_ERROR, elapsed.count());
+    if (metrics != NULL) {
+      metrics->add_sample("ldap_prefetch_ms", ldap_host, elapsed.count());
+    }
+    count_ldap(metrics, rc);
+    if (rc == LDAPQUERY_ERROR) continue;
+    for (auto &element : mapping) {
+      if (element.second.count(username_local) > 0) {
+        remote_users.insert(element.first);
+      }
+    }
+    break;
+  }
+  return remote_users;
+}
+
 bool is_authorized(const Config &config, const std::string &username_local,
                    const std::string &username_remote,
-                   const std::string &user_acr) {
+                   const std::string &user_acr,
+                   const std::set<std::string> *ldap_users,
+                   LoginMetrics *metrics) {
   // Check performing MFA
   if (config.require_mfa) {
     if (strstr(user_acr.c_str(), "https://refeds.org/profile/mfa") != NULL) {
@@ -312,12 +542,39 @@ bool is_authorized(const Config &config, const std::string &username_local,
     }
   }
   // Try to authorize against local config
-  if (config.usermap.count(username_remote) > 0) {
-    if (config.usermap.find(username_remote)->second.count(username_local) >
-        0) {
-      syslog(LOG_INFO, "user %s mapped to %s", username_remote.c_str(),
-             username_local.c_str());
-      return true;
+  PhaseTimer usermap_timer(metrics, "usermap_ms");
+  auto usermap = config.usermap.find(username_remote);
+  bool mapped = usermap != config.usermap.end() &&
+                usermap->second.count(username_local) > 0;
+  usermap_timer.stop();
+  if (mapped) {
+    if (metrics != NULL) metrics->set("authorized_by", "usermap");
+    syslog(LOG_INFO, "user %s mapped to %s", username_remote.c_str(),
+           username_local.c_str());
+    return true;
+  }
+  // Try to authorize against the prefetched LDAP mapping, otherwise fall
+  // through to the slower lookups
+  if (ldap_users != NULL && ldap_users->count(username_remote) > 0) {
+    if (metrics != NULL) metrics->set("authorized_by", "ldap_prefetch");
+    syslog(LOG_INFO, "user %s mapped to %s via LDAP", username_remote.c_str(),
+           username_local.c_str());
+    return true;
+  }
+  // Try to authorize against the local snapshot of LDAP
+  if (!config.ldap_index_file.empty()) {
+    PhaseTimer index_timer(metrics, "ldap_index_ms");
+    LdapIndex index;
+    if (index.open(config.ldap_index_file, config.ldap_index_max_age)) {
+      if (index.contains(username_remote, username_local)) {
+        if (metrics != NULL) metrics->set("authorized_by", "ldap_index");
+        syslog(LOG_INFO, "user %s mapped to %s via LDAP index",
+               username_remote.c_str(), username_local.c_str());
+        return true;
+      }
+    } else {
+      syslog(LOG_WARNING, "cannot use LDAP index %s",
+             config.ldap_index_file.c_str());
     }
   }
   // Try to authorize against LDAP
@@ -333,15 +590,75 @@ bool is_authorized(const Config &config, const std::string &username_local,
     filter = filter_buffer;
     delete[] filter_buffer;
 
-    for (auto ldap_host : config.ldap_hosts) {
+    LdapHealth health;
+    if (!health.open(config.ldap_health_file)) {
+      syslog(LOG_DEBUG, "cannot map LDAP health file %s",
+             config.ldap_health_file.c_str());
+    }
+    // Replicas hold the same data, the first host that answers decides
+    for (auto ldap_host : health.order(config.ldap_hosts)) {
+      auto start = std::chrono::steady_clock::now();
       int rc = ldap_check_attr(ldap_host, config.ldap_basedn, config.ldap_user,
                                config.ldap_passwd, filter, config.ldap_attr,
-                               username_local);
+                               username_local, metrics);
+      std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      health.record(ldap_host, rc != LDAPQUERY_ERROR, elapsed.count());
+      if (metrics != NULL) {
+        metrics->add_sample("ldap_ms", ldap_host, elapsed.count());
+      }
+      count_ldap(metrics, rc);
+      if (rc == LDAPQUERY_ERROR) {
+        syslog(LOG_WARNING, "LDAP host %s failed", ldap_host.c_str());
+        continue;
+      }
       if (rc == LDAPQUERY_TRUE) {
+        if (metrics != NULL) metrics->set("authorized_by", "ldap");
         syslog(LOG_INFO, "user %s mapped to %s via LDAP",
                username_remote.c_str(), username_local.c_str());
         return true;
       }
+      break;
+    }
+
+    // Try to authorize through nested membership of the configured groups
+    std::set<std::string> groups;
+    for (auto &element : config.ldap_groups) {
+      if (element.second.count(username_local) > 0) {
+        groups.insert(element.first);
+      }
+    }
+    if (!groups.empty()) {
+      GroupGraph graph(config.ldap_group_cache_ttl);
+      if (!graph.open(config.ldap_group_cache_file)) {
+        syslog(LOG_DEBUG, "cannot map LDAP group cache file %s",
+               config.ldap_group_cache_file.c_str());
+      }
+      for (auto ldap_host : health.order(config.ldap_hosts)) {
+        auto start = std::chrono::steady_clock::now();
+        int rc = ldap_check_group(ldap_host, config.ldap_basedn,
+                                  config.ldap_user, config.ldap_passwd, filter,
+                                  config.ldap_group_attr, groups,
+                                  config.ldap_group_in_chain, &graph, metrics);
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        health.record(ldap_host, rc != LDAPQUERY_ERROR, elapsed.count());
+        if (metrics != NULL) {
+          metrics->add_sample("ldap_group_ms", ldap_host, elapsed.count());
+        }
+        count_ldap(metrics, rc);
+        if (rc == LDAPQUERY_ERROR) {
+          syslog(LOG_WARNING, "LDAP host %s failed", ldap_host.c_str());
+          continue;
+        }
+        if (rc == LDAPQUERY_TRUE) {
+          if (metrics != NULL) metrics->set("authorized_by", "ldap_group");
+          syslog(LOG_INFO, "user %s mapped to %s via LDAP group",
+                 username_remote.c_str(), username_local.c_str());
+          return true;
+        }
+        break;
+      }
     }
   }
   syslog(LOG_WARNING,
@@ -350,7 +667,45 @@ bool is_authorized(const Config &config, const std::string &username_local,
   return false;
 }
 
-int safe_return(int rc) {
+// Stops the prefetch of LDAP users of a failed login. The future cannot be
+// left behind, its destructor waits for the thread, so this waits too, but
+// only for the LDAP request in progress, e.g. the current page of the
+// mapping, and times the wait as ldap_prefetch_wait_ms.
+static void abandon_prefetch(std::future<std::set<std::string>> *ldap_users,
+                             std::atomic<bool> *cancel,
+                             LoginMetrics *metrics) {
+  if (!ldap_users->valid()) return;
+  *cancel = true;
+  PhaseTimer timer(metrics, "ldap_prefetch_wait_ms");
+  ldap_users->wait();
+}
+
+// Logs the metrics of the login as one record of key=value fields, adds
+// them to the shared stats and queues the spans of a traced login for export
+int safe_return(int rc, LoginMetrics *metrics = NULL,
+                const Config *config = NULL) {
+  if (metrics != NULL) {
+    syslog(LOG_INFO, "login rc=%d total_ms=%.3f %s", rc, metrics->elapsed_ms(),
+           metrics->record().c_str());
+    Stats stats;
+    if (config != NULL && stats.open(config->stats_file)) {
+      stats.record(*metrics, rc);
+    }
+    if (config != NULL && metrics->trace() != NULL) {
+      std::vector<std::pair<std::string, std::string>> attributes = {
+          {"pam.rc", std::to_string(rc)}};
+      for (auto &field : metrics->snapshot()) {
+        if (field.kind == LoginMetrics::TEXT) {
+          attributes.push_back(std::make_pair(field.key, field.text));
+        }
+      }
+      if (!SpanExporter::get(config->trace_export)
+               ->enqueue(metrics->trace()->resource_spans(
+                   "login", attributes, rc != PAM_SUCCESS))) {
+        syslog(LOG_WARNING, "span export queue full, dropping login trace");
+      }
+    }
+  }
   closelog();
   return rc;
 }
@@ -374,15 +729,22 @@ PAM_EXTERN int pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc,
   // stored in the buffer is unavailable to the subsequent PAM modules.
   // For more information see issue #27.
   const char *buffer;
+  // Outlive the prefetch of LDAP users, which adds to them
+  std::unique_ptr<LoginTrace> trace;
+  LoginMetrics metrics;
   std::string username_local;
   std::string token;
   Config config;
   DeviceAuthResponse device_auth_response;
   Userinfo userinfo;
+  std::atomic<bool> cancel_prefetch(false);
+  std::future<std::set<std::string>> ldap_users;
+  std::set<std::string> ldap_users_prefetched;
 
   openlog("pam_oauth2_device", LOG_PID | LOG_NDELAY, LOG_AUTH);
 
   try {
+    PhaseTimer timer(&metrics, "config_ms");
     (argc > 0) ? config.load(argv[0])
                : config.load("/etc/pam_oauth2_device/config.json");
   } catch (json::exception &e) {
@@ -390,41 +752,73 @@ PAM_EXTERN int pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc,
            "cannot load configuration file from parameter or from config file "
            "/etc/pam_oauth2_device/config.json");
     syslog(LOG_DEBUG, "error message: %s", e.what());
-    return safe_return(PAM_AUTH_ERR);
+    return safe_return(PAM_AUTH_ERR, &metrics, &config);
+  }
+  if (!config.trace_export.empty()) {
+    trace.reset(new LoginTrace());
+    metrics.set_trace(trace.get());
   }
 
   try {
+    PhaseTimer get_user_timer(&metrics, "get_user_ms");
     if (int rc = pam_get_user(pamh, &buffer, "Username: ") != PAM_SUCCESS) {
       syslog(LOG_ERR, "pam_get_user failed, rc=%d", rc);
       throw PamError();
     }
+    get_user_timer.stop();
+    username_local = buffer;
+    if (!config.ldap_hosts.empty() && !config.ldap_key_attr.empty()) {
+      try {
+        ldap_users = std::async(std::launch::async, prefetch_ldap_users,
+                                std::cref(config), username_local, &metrics,
+                                &cancel_prefetch);
+      } catch (std::system_error &e) {
+        syslog(LOG_DEBUG, "cannot prefetch LDAP mapping: %s", e.what());
+      }
+    }
 
     make_authorization_request(
         config.client_id.c_str(), config.client_secret.c_str(),
         config.scope.c_str(), config.device_endpoint.c_str(),
-        config.require_mfa, &device_auth_response);
+        config.require_mfa, &device_auth_response, &metrics);
     show_prompt(pamh, config.qr_error_correction_level, config.qr_show,
-                &device_auth_response);
+                config.qr_uppercase_host, config.qr_renderer, config.qr_mask,
+                config.qr_cache_dir, config.prompt_templates,
+                &device_auth_response, &metrics);
     poll_for_token(config.client_id.c_str(), config.client_secret.c_str(),
                    config.token_endpoint.c_str(),
-                   device_auth_response.device_code.c_str(), &token);
+                   device_auth_response.device_code.c_str(), &token, &metrics);
     get_userinfo(config.userinfo_endpoint.c_str(), token.c_str(),
-                 config.username_attribute.c_str(), &userinfo);
+                 config.username_attribute.c_str(), &userinfo, &metrics);
   } catch (PamError &e) {
-    return safe_return(PAM_SYSTEM_ERR);
+    abandon_prefetch(&ldap_users, &cancel_prefetch, &metrics);
+    return safe_return(PAM_SYSTEM_ERR, &metrics, &config);
   } catch (TimeoutError &e) {
-    return safe_return(PAM_AUTH_ERR);
+    abandon_prefetch(&ldap_users, &cancel_prefetch, &metrics);
+    return safe_return(PAM_AUTH_ERR, &metrics, &config);
   } catch (NetworkError &e) {
-    return safe_return(PAM_AUTH_ERR);
+    abandon_prefetch(&ldap_users, &cancel_prefetch, &metrics);
+    return safe_return(PAM_AUTH_ERR, &metrics, &config);
   }
 
-  username_local = buffer;
-  if (is_authorized(config, username_local, userinfo.username, userinfo.acr)) {
+  if (ldap_users.valid()) {
+    PhaseTimer timer(&metrics, "ldap_prefetch_wait_ms");
+    // The prefetch only saves a round trip, a failed one leaves the check to
+    // the live LDAP queries
+    try {
+      ldap_users_prefetched = ldap_users.get();
+    } catch (std::exception &e) {
+      syslog(LOG_WARNING, "LDAP mapping prefetch failed: %s", e.what());
+      ldap_users_prefetched.clear();
+    }
+  }
+  if (is_authorized(config, username_local, userinfo.username, userinfo.acr,
+                    &ldap_users_prefetched, &metrics)) {
     syslog(LOG_INFO, "authentication succeeded: %s -> %s",
            userinfo.username.c_str(), username_local.c_str());
-    return safe_return(PAM_SUCCESS);
+    return safe_return(PAM_SUCCESS, &metrics, &config);
   }
   syslog(LOG_INFO, "authentication failed: %s -> %s", userinfo.username.c_str(),
          username_local.c_str());
-  return safe_return(PAM_AUTH_ERR);
+  return safe_return(PAM_AUTH_ERR, &metrics, &config);
 }
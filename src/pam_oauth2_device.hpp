@@ -1,9 +1,18 @@
 #ifndef PAM_OAUTH2_DEVICE_HPP
 #define PAM_OAUTH2_DEVICE_HPP
 
+#include <stddef.h>
+
+#include <set>
 #include <string>
 #include <vector>
 
+class Config;
+class LoginMetrics;
+class PromptTemplate;
+class QrCache;
+class QrRenderer;
+
 class Userinfo {
  public:
   std::string sub, username, name, acr;
@@ -14,19 +23,72 @@ class DeviceAuthResponse {
  public:
   std::string user_code, verification_uri, verification_uri_complete,
       device_code;
-  std::string get_prompt(const int qr_ecc, const bool qr_show);
+  // Seconds the codes are valid, 0 when the provider does not tell
+  int expires_in = 0;
+  // Fills the template, the default prompt when it is NULL. Counts the hits
+  // and misses of the cache in the metrics unless they are NULL.
+  std::string get_prompt(const int qr_ecc, const bool qr_show,
+                         const bool qr_uppercase_host,
+                         const QrRenderer *qr_renderer,
+                         const std::string &qr_mask, QrCache *qr_cache,
+                         const PromptTemplate *prompt_template,
+                         LoginMetrics *metrics = NULL);
 };
 
+// Uppercases the scheme and host of the URI, which are case-insensitive, so a
+// QR code can hold them in alphanumeric mode.
+std::string uppercase_scheme_host(const std::string &uri);
+
+// Returns the text encoded in a QR code drawn by the renderer, half blocks by
+// default, with a quiet zone of border modules. ecc 0, 1 and 2 select LOW,
+// MEDIUM and HIGH error correction. mask is "auto" to search all masks, "fast"
+// to estimate the best one, or a mask number from "0" to "7"; anything else
+// is taken as "auto". Returns "" when the text is too long for any QR code.
+std::string getQr(const char *text, const int ecc = 0, const int border = 1,
+                  const QrRenderer *renderer = NULL,
+                  const std::string &mask = "auto");
+
+// Appends the data curl received to the std::string at userp
+size_t WriteCallback(void *contents, size_t size, size_t nmemb, void *userp);
+
+// Parse the JSON responses of the provider, throw a json::exception when a
+// response is malformed. parse_token_response returns the error, such as
+// "authorization_pending", or "" with the token.
+void parse_authorization_response(const std::string &body,
+                                  DeviceAuthResponse *response);
+std::string parse_token_response(const std::string &body, std::string *token);
+void parse_userinfo_response(const std::string &body,
+                             const char *username_attribute,
+                             Userinfo *userinfo);
+
+// The requests below and is_authorized add their timings, poll counts and
+// bytes transferred to the metrics unless they are NULL.
 void make_authorization_request(const char *client_id,
                                 const char *client_secret, const char *scope,
                                 const char *device_endpoint, bool request_mfa,
-                                DeviceAuthResponse *response);
+                                DeviceAuthResponse *response,
+                                LoginMetrics *metrics = NULL);
 
 void poll_for_token(const char *client_id, const char *client_secret,
                     const char *token_endpoint, const char *device_code,
-                    std::string *token);
+                    std::string *token, LoginMetrics *metrics = NULL);
 
 void get_userinfo(const char *userinfo_endpoint, const char *token,
-                  const char *username_attribute, Userinfo *userinfo);
+                  const char *username_attribute, Userinfo *userinfo,
+                  LoginMetrics *metrics = NULL);
+
+// Returns the filter of the LDAP entries that may map remote users to the
+// local account: ldap.filter matching any user, and ldap.attr the escaped
+// local username.
+std::string prefetch_filter(const Config &config,
+                            const std::string &username_local);
+
+// Returns true when the remote user may log in as the local user, by the
+// usermap, the prefetched LDAP users, the LDAP snapshot or the LDAP hosts.
+bool is_authorized(const Config &config, const std::string &username_local,
+                   const std::string &username_remote,
+                   const std::string &user_acr,
+                   const std::set<std::string> *ldap_users = NULL,
+                   LoginMetrics *metrics = NULL);
 
 #endif  // PAM_OAUTH2_DEVICE_HPP
@@ -0,0 +1,74 @@
+// Dumps the LDAP mapping used for authorization into a local index file,
+// see `ldap.index_file`. Meant to be run periodically, e.g. from a timer.
+
+#include <stdio.h>
+#include <syslog.h>
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+
+#include "include/config.hpp"
+#include "include/ldaphealth.hpp"
+#include "include/ldapindex.hpp"
+#include "include/ldapquery.hpp"
+#include "include/nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+int main(int argc, char **argv) {
+  Config config;
+  const char *path =
+      (argc > 1) ? argv[1] : "/etc/pam_oauth2_device/config.json";
+
+  openlog("pam_oauth2_device-ldapsync", LOG_PID | LOG_PERROR, LOG_AUTH);
+  try {
+    config.load(path);
+  } catch (json::exception &e) {
+    syslog(LOG_ERR, "cannot load configuration file %s: %s", path, e.what());
+    return 1;
+  }
+  if (config.ldap_hosts.empty() || config.ldap_index_file.empty()) {
+    syslog(LOG_ERR, "ldap.hosts and ldap.index_file must be configured");
+    return 1;
+  }
+  if (config.ldap_key_attr.empty()) {
+    syslog(LOG_ERR,
+           "cannot find the key attribute in filter %s, set ldap.key_attr",
+           config.ldap_filter.c_str());
+    return 1;
+  }
+
+  // Match every entry the per-login filter could match
+  std::string filter = config.ldap_filter;
+  auto pos = filter.find("%s");
+  if (pos != std::string::npos) filter.replace(pos, 2, "*");
+
+  LdapHealth health;
+  health.open(config.ldap_health_file);
+  for (auto ldap_host : health.order(config.ldap_hosts)) {
+    std::map<std::string, std::set<std::string>> mapping;
+    auto start = std::chrono::steady_clock::now();
+    int rc = ldap_get_mapping(ldap_host, config.ldap_basedn, config.ldap_user,
+                              config.ldap_passwd, filter, config.ldap_key_attr,
+                              config.ldap_attr, &mapping);
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    health.record(ldap_host, rc != LDAPQUERY_ERROR, elapsed.count());
+    if (rc == LDAPQUERY_ERROR) {
+      syslog(LOG_WARNING, "LDAP host %s failed", ldap_host.c_str());
+      continue;
+    }
+    if (!LdapIndex::write(config.ldap_index_file, mapping)) {
+      syslog(LOG_ERR, "cannot write LDAP index %s",
+             config.ldap_index_file.c_str());
+      return 1;
+    }
+    syslog(LOG_INFO, "synced %zu users from %s into %s", mapping.size(),
+           ldap_host.c_str(), config.ldap_index_file.c_str());
+    return 0;
+  }
+  syslog(LOG_ERR, "no LDAP host could be synced");
+  return 1;
+}
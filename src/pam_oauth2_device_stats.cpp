@@ -0,0 +1,64 @@
+// Prints the login stats the module keeps in `stats.file` as key=value lines,
+// or with -p in the Prometheus text format, e.g. for the textfile collector
+// of the node exporter.
+
+#include <getopt.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "include/config.hpp"
+#include "include/nlohmann/json.hpp"
+#include "include/stats.hpp"
+
+using json = nlohmann::json;
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-p] [-f stats_file | config]\n", name);
+}
+
+int main(int argc, char **argv) {
+  bool prometheus = false;
+  std::string path;
+  int opt;
+  while ((opt = getopt(argc, argv, "pf:")) != -1) {
+    switch (opt) {
+      case 'p':
+        prometheus = true;
+        break;
+      case 'f':
+        path = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+
+  if (path.empty()) {
+    Config config;
+    const char *config_path = (optind < argc)
+                                  ? argv[optind]
+                                  : "/etc/pam_oauth2_device/config.json";
+    try {
+      config.load(config_path);
+    } catch (json::exception &e) {
+      fprintf(stderr, "cannot load configuration file %s: %s\n", config_path,
+              e.what());
+      return 1;
+    }
+    if (config.stats_file.empty()) {
+      fprintf(stderr, "stats.file is not set in %s\n", config_path);
+      return 1;
+    }
+    path = config.stats_file;
+  }
+
+  Stats stats;
+  if (!stats.open(path, false)) {
+    fprintf(stderr, "cannot read stats file %s\n", path.c_str());
+    return 1;
+  }
+  fputs((prometheus ? stats.prometheus() : stats.text()).c_str(), stdout);
+  return 0;
+}
@@ -0,0 +1,323 @@
+#!/usr/bin/env python3
+"""Mock OpenID Connect provider for load tests of the device flow.
+
+Serves the device authorization, token, userinfo, discovery and JWKS
+endpoints with asyncio, so thousands of device flows can run at once.
+Every device request starts a flow with its own codes. Its token polls
+are answered with slow_down and authorization_pending a given number of
+times before the token is issued.
+
+Latency and errors are injected per endpoint:
+
+    --latency token=uniform:5:20 --latency '*=2' --error-rate device=0.01
+
+Latencies are in milliseconds: N, uniform:MIN:MAX, normal:MEAN:SD or
+exp:MEAN. The random draws of the n-th request to an endpoint only
+depend on --seed, so runs with the same order of requests are repeated
+exactly. --tls DIR serves HTTPS with a certificate signed by a local CA,
+both generated into DIR with openssl on first use. Clients have to
+trust DIR/ca.pem. GET /stats returns the number of requests and errors
+per endpoint.
+"""
+
+import argparse
+import asyncio
+import base64
+import itertools
+import json
+import os
+import random
+import ssl
+import subprocess
+import sys
+import time
+from urllib.parse import parse_qs
+
+ENDPOINTS = {
+    ('POST', '/devicecode'): 'device',
+    ('POST', '/token'): 'token',
+    ('GET', '/userinfo'): 'userinfo',
+    ('GET', '/.well-known/openid-configuration'): 'discovery',
+    ('GET', '/jwks'): 'jwks',
+}
+
+# Public key published in the JWKS, nothing is signed with it
+JWK = {
+    'kty': 'RSA', 'use': 'sig', 'alg': 'RS256', 'kid': 'mock', 'e': 'AQAB',
+    'n': 'r3WtcoU5yQYnAbSbu60eh9q4uu2kr6vA1a12zdHdhDUsYs7Q34uS0A1GP4yuppOAY'
+         'MgG4UDbKgIerSfI5CdI2briVGI-iKKKTJiAKcoZ-jKiE4_5KjqUGxjkm-KdjiFoCR'
+         'QUqBIvk10pQs73eS33djoL4RsftO7dJfuAWLYFUSPBtVFsZGEH8digYxJ0NvK8q5'
+         'kwM7Y6qFoXjx6WkfxTdbD0YnTlFUxbFJoxo-tulc_hwlqayAJ56ujF1ebLZu8WrBF'
+         'bXUqPgSBrRUiFHLR5-At04BMRqIhgOlSRRO_92O4kyKm3m-RyrquHt6OWdaDqLmPG'
+         '3wS9XdEKKELXhxqUFQ',
+}
+
+REASONS = {200: 'OK', 400: 'Bad Request', 401: 'Unauthorized',
+           404: 'Not Found', 500: 'Internal Server Error'}
+
+
+def parse_distribution(spec):
+    """Returns a function drawing a latency in seconds from a random.Random."""
+    kind, _, args = spec.partition(':')
+    try:
+        if not args:
+            value = float(kind) / 1000
+            return lambda rng: value
+        values = [float(arg) / 1000 for arg in args.split(':')]
+        if kind == 'uniform':
+            low, high = values
+            return lambda rng: rng.uniform(low, high)
+        if kind == 'normal':
+            mean, sd = values
+            return lambda rng: max(0.0, rng.gauss(mean, sd))
+        if kind == 'exp':
+            mean, = values
+            return lambda rng: rng.expovariate(1 / mean)
+    except ValueError:
+        pass
+    raise argparse.ArgumentTypeError('bad latency {}'.format(spec))
+
+
+def per_endpoint(parse):
+    def parse_setting(text):
+        endpoint, sep, value = text.partition('=')
+        names = set(ENDPOINTS.values()) | {'*'}
+        if not sep or endpoint not in names:
+            raise argparse.ArgumentTypeError(
+                'expected ENDPOINT=VALUE with ENDPOINT one of {}'.format(
+                    ', '.join(sorted(names))))
+        return endpoint, parse(value)
+    return parse_setting
+
+
+def make_certificates(directory):
+    """Generates a local CA and a certificate for localhost it signed."""
+    os.makedirs(directory, exist_ok=True)
+    path = lambda name: os.path.join(directory, name)
+    if os.path.exists(path('server.pem')):
+        return path('server.pem'), path('server.key')
+    openssl = lambda *args: subprocess.run(
+        ('openssl',) + args, check=True, stdout=subprocess.DEVNULL,
+        stderr=subprocess.DEVNULL)
+    openssl('req', '-x509', '-newkey', 'rsa:2048', '-nodes', '-days', '365',
+            '-subj', '/CN=pam_oauth2_device mock CA',
+            '-keyout', path('ca.key'), '-out', path('ca.pem'))
+    openssl('req', '-newkey', 'rsa:2048', '-nodes', '-subj', '/CN=localhost',
+            '-keyout', path('server.key'), '-out', path('server.csr'))
+    with open(path('server.ext'), 'w') as f:
+        f.write('subjectAltName=DNS:localhost,IP:127.0.0.1\n')
+    openssl('x509', '-req', '-in', path('server.csr'), '-days', '365',
+            '-CA', path('ca.pem'), '-CAkey', path('ca.key'),
+            '-CAcreateserial', '-extfile', path('server.ext'),
+            '-out', path('server.pem'))
+    return path('server.pem'), path('server.key')
+
+
+class Flow:
+
+    def __init__(self, number, options):
+        self.device_code = 'device-code-{:08d}'.format(number)
+        self.user_code = 'USER-{:04d}'.format(number % 10000)
+        self.access_token = 'access-token-{:08d}'.format(number)
+        self.created = time.monotonic()
+        self.slow_downs = options.slow_down
+        self.pending = options.pending
+
+
+class MockIdp:
+
+    def __init__(self, options):
+        self.options = options
+        scheme = 'https' if options.tls else 'http'
+        self.base = '{}://localhost:{}'.format(scheme, options.port)
+        self.latency = dict(options.latency)
+        self.error_rate = dict(options.error_rate)
+        self.flows = {}
+        self.tokens = {}
+        self.flow_numbers = itertools.count(1)
+        self.requests = {name: 0 for name in ENDPOINTS.values()}
+        self.errors = {name: 0 for name in ENDPOINTS.values()}
+
+    def setting(self, settings, endpoint):
+        return settings.get(endpoint, settings.get('*'))
+
+    async def handle(self, reader, writer):
+        try:
+            while await self.handle_request(reader, writer):
+                pass
+        except (ConnectionError, ssl.SSLError, asyncio.IncompleteReadError,
+                ValueError):
+            pass
+        finally:
+            writer.close()
+
+    async def handle_request(self, reader, writer):
+        request_line = await reader.readline()
+        if not request_line:
+            return False
+        method, target, version = request_line.decode('latin-1').split()
+        headers = {}
+        while True:
+            line = (await reader.readline()).decode('latin-1').strip()
+            if not line:
+                break
+            name, _, value = line.partition(':')
+            headers[name.strip().lower()] = value.strip()
+        length = int(headers.get('content-length', 0))
+        body = (await reader.readexactly(length)).decode() if length else ''
+        path = target.split('?')[0]
+
+        endpoint = ENDPOINTS.get((method, path))
+        if path == '/stats' and method == 'GET':
+            status, data = 200, {'requests': self.requests,
+                                 'errors': self.errors,
+                                 'flows': len(self.flows)}
+        elif endpoint is None:
+            status, data = 404, {'error': 'not_found'}
+        else:
+            number = self.requests[endpoint]
+            self.requests[endpoint] += 1
+            # The n-th request to an endpoint always draws the same numbers
+            rng = random.Random('{}:{}:{}'.format(
+                self.options.seed, endpoint, number))
+            latency = self.setting(self.latency, endpoint)
+            if latency is not None:
+                await asyncio.sleep(latency(rng))
+            error_rate = self.setting(self.error_rate, endpoint) or 0.0
+            if rng.random() < error_rate:
+                self.errors[endpoint] += 1
+                status, data = 500, {'error': 'server_error'}
+            else:
+                status, data = getattr(self, endpoint)(
+                    parse_qs(body), headers)
+
+        payload = json.dumps(data).encode()
+        keep_alive = (version == 'HTTP/1.1' and
+                      headers.get('connection', '').lower() != 'close')
+        writer.write('{} {} {}\r\nContent-Type: application/json\r\n'
+                     'Content-Length: {}\r\nConnection: {}\r\n\r\n'.format(
+                         version, status, REASONS[status], len(payload),
+                         'keep-alive' if keep_alive else 'close').encode())
+        writer.write(payload)
+        await writer.drain()
+        return keep_alive
+
+    def client_authenticated(self, form, headers):
+        if form.get('client_id') != [self.options.client_id]:
+            return False
+        auth = headers.get('authorization', '').split()
+        if len(auth) != 2 or auth[0] != 'Basic':
+            return True  # Public client
+        return base64.b64decode(auth[1]).decode() == '{}:{}'.format(
+            self.options.client_id, self.options.client_secret)
+
+    def device(self, form, headers):
+        if not self.client_authenticated(form, headers):
+            return 401, {'error': 'invalid_client'}
+        flow = Flow(next(self.flow_numbers), self.options)
+        self.flows[flow.device_code] = flow
+        uri = self.base + '/device'
+        return 200, {
+            'device_code': flow.device_code,
+            'user_code': flow.user_code,
+            'verification_uri': uri,
+            'verification_uri_complete': '{}?user_code={}'.format(
+                uri, flow.user_code),
+            'expires_in': self.options.expires_in,
+            'interval': 5,
+        }
+
+    def token(self, form, headers):
+        if not self.client_authenticated(form, headers):
+            return 401, {'error': 'invalid_client'}
+        if form.get('grant_type') != [
+                'urn:ietf:params:oauth:grant-type:device_code']:
+            return 400, {'error': 'unsupported_grant_type'}
+        flow = self.flows.get((form.get('device_code') or [''])[0])
+        if flow is None:
+            return 400, {'error': 'invalid_grant'}
+        if time.monotonic() - flow.created > self.options.expires_in:
+            del self.flows[flow.device_code]
+            return 400, {'error': 'expired_token'}
+        if flow.slow_downs > 0:
+            flow.slow_downs -= 1
+            return 400, {'error': 'slow_down'}
+        if flow.pending > 0:
+            flow.pending -= 1
+            return 400, {'error': 'authorization_pending'}
+        del self.flows[flow.device_code]
+        self.tokens[flow.access_token] = flow
+        return 200, {'access_token': flow.access_token, 'token_type': 'Bearer',
+                     'expires_in': 3600, 'scope': 'openid profile'}
+
+    def userinfo(self, form, headers):
+        auth = headers.get('authorization', '').split()
+        if len(auth) != 2 or auth[0] != 'Bearer':
+            return 401, {'error': 'invalid_token'}
+        if self.tokens.pop(auth[1], None) is None:
+            return 401, {'error': 'invalid_token'}
+        return 200, {'sub': base64.b64encode(auth[1].encode()).decode(),
+                     'preferred_username': self.options.username,
+                     'name': 'Joe Doe'}
+
+    def discovery(self, form, headers):
+        return 200, {
+            'issuer': self.base,
+            'device_authorization_endpoint': self.base + '/devicecode',
+            'token_endpoint': self.base + '/token',
+            'userinfo_endpoint': self.base + '/userinfo',
+            'jwks_uri': self.base + '/jwks',
+            'grant_types_supported': [
+                'urn:ietf:params:oauth:grant-type:device_code'],
+            'id_token_signing_alg_values_supported': ['RS256'],
+        }
+
+    def jwks(self, form, headers):
+        return 200, {'keys': [JWK]}
+
+
+async def serve(options):
+    context = None
+    if options.tls:
+        context = ssl.create_default_context(ssl.Purpose.CLIENT_AUTH)
+        context.load_cert_chain(*make_certificates(options.tls))
+    idp = MockIdp(options)
+    server = await asyncio.start_server(idp.handle, 'localhost', options.port,
+                                        ssl=context, backlog=4096)
+    async with server:
+        await server.serve_forever()
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawTextHelpFormatter)
+    parser.add_argument('--port', type=int, default=8042)
+    parser.add_argument('--client-id', default='client_id')
+    parser.add_argument('--client-secret',
+                        default='NDVmODY1ZDczMGIyMTM1MWFlYWM2NmYw')
+    parser.add_argument('--username', default='jdoe',
+                        help='preferred_username of every user')
+    parser.add_argument('--pending', type=int, default=0,
+                        help='authorization_pending answers of each flow')
+    parser.add_argument('--slow-down', type=int, default=0,
+                        help='slow_down answers of each flow, sent first')
+    parser.add_argument('--expires-in', type=int, default=1800,
+                        help='seconds a device code is valid')
+    parser.add_argument('--latency', action='append', default=[],
+                        type=per_endpoint(parse_distribution),
+                        metavar='ENDPOINT=DIST')
+    parser.add_argument('--error-rate', action='append', default=[],
+                        type=per_endpoint(float), metavar='ENDPOINT=RATE')
+    parser.add_argument('--seed', type=int, default=0)
+    parser.add_argument('--tls', metavar='DIR',
+                        help='serve HTTPS with certificates kept in DIR')
+    options = parser.parse_args()
+    try:
+        asyncio.run(serve(options))
+    except KeyboardInterrupt:
+        print()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
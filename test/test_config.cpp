@@ -38,6 +38,25 @@ TEST(ConfigTest, Full) {
   EXPECT_EQ(config.usermap["provider_user_id_1"].count("root"), 1);
   EXPECT_EQ(config.usermap.size(), 2);
   EXPECT_EQ(config.qr_error_correction_level, 0);
+  EXPECT_FALSE(config.qr_uppercase_host);
+  EXPECT_EQ(config.qr_renderer, "auto");
+  EXPECT_EQ(config.qr_mask, "auto");
+  EXPECT_EQ(config.qr_cache_dir, "/run/pam_oauth2_device");
+  EXPECT_EQ(config.ldap_group_cache_file,
+            "/run/pam_oauth2_device/ldap_groups");
+  EXPECT_EQ(config.stats_file, "/run/pam_oauth2_device/stats");
+  EXPECT_EQ(config.trace_export, "");
+  PromptValues values;
+  values.uri = "https://provider.com/device";
+  values.expires = "5";
+  EXPECT_EQ(0, config.prompt_templates.get("de_DE.UTF-8")
+                   .render(values)
+                   .find("Melden Sie sich"));
+  EXPECT_NE(std::string::npos, config.prompt_templates.get("de")
+                                   .render(values)
+                                   .find("Der Code ist 5 Minuten"));
+  EXPECT_EQ(PromptTemplate().render(values),
+            config.prompt_templates.get("en_US.UTF-8").render(values));
 }
 
 }  // namespace
@@ -0,0 +1,185 @@
+#include <unistd.h>
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "include/ldapgroups.hpp"
+#include "include/ldapquery.hpp"
+
+#define CACHE_FILE "test_ldapgroups_cache"
+
+namespace {
+
+class GroupGraphTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // staff -> engineering -> employees, with a cycle back to staff
+    directory["cn=staff,dc=example"] = {"cn=engineering,dc=example"};
+    directory["cn=engineering,dc=example"] = {"CN=Employees,DC=example"};
+    directory["cn=employees,dc=example"] = {"cn=staff,dc=example"};
+    directory["cn=guests,dc=example"] = {};
+    // memberOf of contractors still lists a deleted group
+    directory["cn=contractors,dc=example"] = {"cn=deleted,dc=example",
+                                              "cn=staff,dc=example"};
+    directory["cn=deleted,dc=example"] = {};
+    fetches = 0;
+    fetch = [this](const std::string &dn, std::set<std::string> *parents) {
+      ++fetches;
+      auto node = directory.find(dn);
+      if (node == directory.end()) return LDAPQUERY_ERROR;
+      if (node->first.find("deleted") != std::string::npos) {
+        return LDAPQUERY_FALSE;
+      }
+      *parents = node->second;
+      return LDAPQUERY_TRUE;
+    };
+  }
+  std::map<std::string, std::set<std::string>> directory;
+  GroupGraph::Fetch fetch;
+  int fetches;
+};
+
+TEST_F(GroupGraphTest, Direct) {
+  GroupGraph graph;
+  EXPECT_EQ(graph.is_member({"cn=staff,dc=example"}, {"cn=staff,dc=example"},
+                            fetch),
+            LDAPQUERY_TRUE);
+  EXPECT_EQ(fetches, 0);
+}
+
+TEST_F(GroupGraphTest, Nested) {
+  GroupGraph graph;
+  EXPECT_EQ(graph.is_member({"cn=staff,dc=example"},
+                            {"cn=employees,dc=example"}, fetch),
+            LDAPQUERY_TRUE);
+  EXPECT_EQ(graph.is_member({"cn=guests,dc=example"},
+                            {"cn=employees,dc=example"}, fetch),
+            LDAPQUERY_FALSE);
+}
+
+TEST_F(GroupGraphTest, Cycle) {
+  GroupGraph graph;
+  EXPECT_EQ(graph.is_member({"cn=staff,dc=example"}, {"cn=admins,dc=example"},
+                            fetch),
+            LDAPQUERY_FALSE);
+  EXPECT_EQ(fetches, 3);
+}
+
+TEST_F(GroupGraphTest, Memoized) {
+  GroupGraph graph;
+  graph.is_member({"cn=staff,dc=example"}, {"cn=admins,dc=example"}, fetch);
+  fetches = 0;
+  EXPECT_EQ(graph.is_member({"cn=engineering,dc=example"},
+                            {"cn=staff,dc=example"}, fetch),
+            LDAPQUERY_TRUE);
+  EXPECT_EQ(fetches, 0);
+  EXPECT_EQ(graph.size(), 3);
+}
+
+TEST_F(GroupGraphTest, Expired) {
+  GroupGraph graph(0);
+  graph.is_member({"cn=staff,dc=example"}, {"cn=admins,dc=example"}, fetch);
+  fetches = 0;
+  graph.is_member({"cn=staff,dc=example"}, {"cn=admins,dc=example"}, fetch);
+  EXPECT_EQ(fetches, 3);
+}
+
+TEST_F(GroupGraphTest, Shared) {
+  unlink(CACHE_FILE);
+  {
+    GroupGraph graph;
+    ASSERT_TRUE(graph.open(CACHE_FILE));
+    graph.is_member({"cn=staff,dc=example"}, {"cn=admins,dc=example"}, fetch);
+  }
+  // A login in another process reuses the edges
+  fetches = 0;
+  GroupGraph graph;
+  ASSERT_TRUE(graph.open(CACHE_FILE));
+  EXPECT_EQ(graph.is_member({"cn=engineering,dc=example"},
+                            {"cn=staff,dc=example"}, fetch),
+            LDAPQUERY_TRUE);
+  EXPECT_EQ(fetches, 0);
+  EXPECT_EQ(graph.size(), 3);
+  // unless its configuration expires them sooner
+  GroupGraph expired(0);
+  ASSERT_TRUE(expired.open(CACHE_FILE));
+  expired.is_member({"cn=staff,dc=example"}, {"cn=admins,dc=example"}, fetch);
+  EXPECT_EQ(fetches, 3);
+  unlink(CACHE_FILE);
+}
+
+TEST_F(GroupGraphTest, Grow) {
+  unlink(CACHE_FILE);
+  // A chain of more groups than a new table has slots
+  const int count = 3 * LDAPGROUPS_SLOTS;
+  for (int i = 0; i < count; ++i) {
+    directory["cn=group-" + std::to_string(i) + ",dc=example"] = {
+        "cn=group-" + std::to_string(i + 1) + ",dc=example"};
+  }
+  directory["cn=group-" + std::to_string(count) + ",dc=example"] = {};
+  // Opened before another login grows the table
+  GroupGraph reader;
+  ASSERT_TRUE(reader.open(CACHE_FILE));
+  {
+    GroupGraph graph;
+    ASSERT_TRUE(graph.open(CACHE_FILE));
+    graph.is_member({"cn=group-0,dc=example"}, {"cn=admins,dc=example"},
+                    fetch);
+  }
+  fetches = 0;
+  EXPECT_EQ(reader.is_member({"cn=group-0,dc=example"},
+                             {"cn=admins,dc=example"}, fetch),
+            LDAPQUERY_FALSE);
+  EXPECT_EQ(fetches, 0);
+  EXPECT_EQ(reader.size(), count + 1);
+  unlink(CACHE_FILE);
+}
+
+TEST_F(GroupGraphTest, LongParents) {
+  GroupGraph graph;
+  std::set<std::string> parents;
+  for (int i = 0; i < 100; ++i) {
+    parents.insert("cn=group-" + std::to_string(i) + ",ou=groups,dc=example");
+  }
+  parents.insert("cn=admins,dc=example");
+  directory["cn=many,dc=example"] = parents;
+  EXPECT_EQ(graph.is_member({"cn=many,dc=example"}, {"cn=admins,dc=example"},
+                            fetch),
+            LDAPQUERY_TRUE);
+  // Too many to share, but kept by the graph
+  EXPECT_EQ(graph.size(), 0);
+  fetches = 0;
+  graph.is_member({"cn=many,dc=example"}, {"cn=other,dc=example"}, fetch);
+  EXPECT_EQ(fetches, 101);
+}
+
+TEST_F(GroupGraphTest, FetchError) {
+  GroupGraph graph;
+  EXPECT_EQ(graph.is_member({"cn=missing,dc=example"},
+                            {"cn=admins,dc=example"}, fetch),
+            LDAPQUERY_ERROR);
+  directory["cn=missing,dc=example"] = {"cn=admins,dc=example"};
+  EXPECT_EQ(graph.is_member({"cn=missing,dc=example"},
+                            {"cn=admins,dc=example"}, fetch),
+            LDAPQUERY_TRUE);
+}
+
+TEST_F(GroupGraphTest, DanglingParent) {
+  GroupGraph graph;
+  EXPECT_EQ(graph.is_member({"cn=contractors,dc=example"},
+                            {"cn=admins,dc=example"}, fetch),
+            LDAPQUERY_FALSE);
+  EXPECT_EQ(graph.is_member({"cn=contractors,dc=example"},
+                            {"cn=employees,dc=example"}, fetch),
+            LDAPQUERY_TRUE);
+  // The deleted group is memoized like any other
+  fetches = 0;
+  EXPECT_EQ(graph.is_member({"cn=deleted,dc=example"},
+                            {"cn=admins,dc=example"}, fetch),
+            LDAPQUERY_FALSE);
+  EXPECT_EQ(fetches, 0);
+}
+
+}  // namespace
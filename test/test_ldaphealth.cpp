@@ -0,0 +1,78 @@
+#include <unistd.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "include/ldaphealth.hpp"
+
+#define HEALTH_FILE "test_ldap_health"
+#define HOST_A "ldaps://ldap-a:636"
+#define HOST_B "ldaps://ldap-b:636"
+#define HOST_C "ldaps://ldap-c:636"
+
+namespace {
+
+class LdapHealthTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    unlink(HEALTH_FILE);
+    hosts = {HOST_A, HOST_B, HOST_C};
+  }
+  void TearDown() override { unlink(HEALTH_FILE); }
+  std::set<std::string> hosts;
+};
+
+TEST_F(LdapHealthTest, UnknownHostsKeepConfigOrder) {
+  LdapHealth health;
+  ASSERT_TRUE(health.open(HEALTH_FILE));
+  std::vector<std::string> expected = {HOST_A, HOST_B, HOST_C};
+  EXPECT_EQ(health.order(hosts), expected);
+}
+
+TEST_F(LdapHealthTest, FastestFirst) {
+  LdapHealth health;
+  ASSERT_TRUE(health.open(HEALTH_FILE));
+  health.record(HOST_A, true, 40.0);
+  health.record(HOST_B, true, 5.0);
+  health.record(HOST_C, true, 20.0);
+  std::vector<std::string> expected = {HOST_B, HOST_C, HOST_A};
+  EXPECT_EQ(health.order(hosts), expected);
+}
+
+TEST_F(LdapHealthTest, BreakerOpensAfterErrors) {
+  LdapHealth health;
+  ASSERT_TRUE(health.open(HEALTH_FILE));
+  for (int i = 0; i < LDAPHEALTH_FAILURE_THRESHOLD - 1; ++i) {
+    health.record(HOST_A, false, 1.0);
+  }
+  EXPECT_EQ(health.order(hosts).size(), 3);
+  health.record(HOST_A, false, 1.0);
+  std::vector<std::string> expected = {HOST_B, HOST_C};
+  EXPECT_EQ(health.order(hosts), expected);
+}
+
+TEST_F(LdapHealthTest, SharedBetweenInstances) {
+  {
+    LdapHealth health;
+    ASSERT_TRUE(health.open(HEALTH_FILE));
+    for (int i = 0; i < LDAPHEALTH_FAILURE_THRESHOLD; ++i) {
+      health.record(HOST_B, false, 1.0);
+    }
+  }
+  LdapHealth health;
+  ASSERT_TRUE(health.open(HEALTH_FILE));
+  std::vector<std::string> expected = {HOST_A, HOST_C};
+  EXPECT_EQ(health.order(hosts), expected);
+}
+
+TEST_F(LdapHealthTest, PrivateFallback) {
+  LdapHealth health;
+  EXPECT_FALSE(health.open("/nonexistent/dir/health"));
+  health.record(HOST_C, true, 1.0);
+  health.record(HOST_A, true, 2.0);
+  health.record(HOST_B, true, 3.0);
+  std::vector<std::string> expected = {HOST_C, HOST_A, HOST_B};
+  EXPECT_EQ(health.order(hosts), expected);
+}
+
+}  // namespace
@@ -0,0 +1,70 @@
+#include <unistd.h>
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "include/ldapindex.hpp"
+
+#define INDEX_FILE "test_ldap_index"
+
+namespace {
+
+class LdapIndexTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    mapping["jdoe"] = {"john", "root"};
+    mapping["asmith"] = {"alice"};
+    ASSERT_TRUE(LdapIndex::write(INDEX_FILE, mapping));
+  }
+  void TearDown() override { unlink(INDEX_FILE); }
+  std::map<std::string, std::set<std::string>> mapping;
+};
+
+TEST_F(LdapIndexTest, Missing) {
+  LdapIndex index;
+  EXPECT_FALSE(index.open("data/missing_index"));
+  EXPECT_FALSE(index.contains("jdoe", "john"));
+}
+
+TEST_F(LdapIndexTest, WrongFormat) {
+  LdapIndex index;
+  EXPECT_FALSE(index.open("data/template_noldap.json"));
+}
+
+TEST_F(LdapIndexTest, Lookup) {
+  LdapIndex index;
+  ASSERT_TRUE(index.open(INDEX_FILE));
+  EXPECT_EQ(index.size(), 3);
+  EXPECT_TRUE(index.contains("jdoe", "john"));
+  EXPECT_TRUE(index.contains("jdoe", "root"));
+  EXPECT_TRUE(index.contains("asmith", "alice"));
+  EXPECT_FALSE(index.contains("asmith", "root"));
+  EXPECT_FALSE(index.contains("jdo", "john"));
+  EXPECT_FALSE(index.contains("mike", "mike"));
+}
+
+TEST_F(LdapIndexTest, Replace) {
+  LdapIndex old_index;
+  ASSERT_TRUE(old_index.open(INDEX_FILE));
+  mapping.erase("jdoe");
+  ASSERT_TRUE(LdapIndex::write(INDEX_FILE, mapping));
+  LdapIndex new_index;
+  ASSERT_TRUE(new_index.open(INDEX_FILE));
+  // Readers keep the snapshot they mapped
+  EXPECT_TRUE(old_index.contains("jdoe", "john"));
+  EXPECT_FALSE(new_index.contains("jdoe", "john"));
+  EXPECT_TRUE(new_index.contains("asmith", "alice"));
+}
+
+TEST_F(LdapIndexTest, Empty) {
+  mapping.clear();
+  ASSERT_TRUE(LdapIndex::write(INDEX_FILE, mapping));
+  LdapIndex index;
+  ASSERT_TRUE(index.open(INDEX_FILE, 60));
+  EXPECT_EQ(index.size(), 0);
+  EXPECT_FALSE(index.contains("jdoe", "john"));
+}
+
+}  // namespace
@@ -1,4 +1,13 @@
+#include <string>
+#include <vector>
+
 #include "gtest/gtest.h"
+#include "include/config.hpp"
+#include "include/ldapquery.hpp"
+#include "include/nayuki/QrCode.hpp"
+#include "include/prompt.hpp"
+#include "include/qrcache.hpp"
+#include "include/qrrender.hpp"
 #include "pam_oauth2_device.hpp"
 
 #define DEVICE_ENDPOINT "http://localhost:8042/devicecode"
@@ -24,6 +33,123 @@ TEST(PamTest, Device) {
   EXPECT_EQ(response.verification_uri, VERIFICATION_URL);
   EXPECT_EQ(response.verification_uri_complete,
             std::string(VERIFICATION_URL) + "?user_code=" + DEVICE_CODE);
+  EXPECT_EQ(response.expires_in, 1800);
+  PromptTemplate prompt("{uri} {#code}{code} {/code}{expires}");
+  EXPECT_EQ(std::string(VERIFICATION_URL) + "?user_code=" + DEVICE_CODE + " 30",
+            response.get_prompt(0, false, false, NULL, "auto", NULL, &prompt));
+}
+
+TEST(PamTest, UppercaseSchemeHost) {
+  EXPECT_EQ(uppercase_scheme_host(VERIFICATION_URL),
+            "HTTP://LOCALHOST:8042/oidc/device");
+  EXPECT_EQ(uppercase_scheme_host("https://Example.com?user_code=abc"),
+            "HTTPS://EXAMPLE.COM?user_code=abc");
+  EXPECT_EQ(uppercase_scheme_host("https://example.com"),
+            "HTTPS://EXAMPLE.COM");
+  EXPECT_EQ(uppercase_scheme_host("https://user@example.com/device"),
+            "https://user@example.com/device");
+  EXPECT_EQ(uppercase_scheme_host("example.com/device"), "example.com/device");
+}
+
+TEST(PamTest, QrRendering) {
+  // Replays the escape sequences like a terminal and compares the cells with
+  // the modules, including the quiet zone
+  const int border = 1;
+  for (auto text :
+       {VERIFICATION_URL,
+        "https://provider.com/oidc/device?user_code=" DEVICE_CODE}) {
+    qrcodegen::QrCode qr;
+    ASSERT_EQ(qrcodegen::QrCode::Status::OK,
+              qrcodegen::QrCode::encodeText(text, qrcodegen::QrCode::Ecc::LOW,
+                                            qr, 1, 40, -1, true, true));
+    std::string rendered = getQr(text, 0, border);
+    std::vector<std::vector<bool>> dark;
+    std::vector<bool> top, bottom;
+    bool reverse = false;
+    for (size_t i = 0; i < rendered.length();) {
+      if (rendered.compare(i, 1, "\033") == 0) {
+        size_t end = rendered.find('m', i);
+        ASSERT_NE(std::string::npos, end);
+        std::string code = rendered.substr(i + 2, end - i - 2);
+        if (code == "7" || code == "40;97;7") reverse = true;
+        if (code == "27" || code == "40;97" || code == "0") reverse = false;
+        i = end + 1;
+      } else if (rendered[i] == '\n') {
+        dark.push_back(top);
+        dark.push_back(bottom);
+        top.clear();
+        bottom.clear();
+        ++i;
+      } else {
+        // The glyphs draw the light parts, or the dark ones in reverse video
+        bool full = rendered.compare(i, 3, "\u2588") == 0;
+        bool upper = full || rendered.compare(i, 3, "\u2580") == 0;
+        bool lower = full || rendered.compare(i, 3, "\u2584") == 0;
+        ASSERT_TRUE(rendered[i] == ' ' || upper || lower);
+        top.push_back(upper == reverse);
+        bottom.push_back(lower == reverse);
+        i += rendered[i] == ' ' ? 1 : 3;
+      }
+    }
+    int width = qr.getSize() + 2 * border;
+    ASSERT_EQ((width + 1) / 2 * 2, dark.size());
+    for (int y = 0; y < width; ++y) {
+      ASSERT_EQ(width, dark[y].size());
+      for (int x = 0; x < width; ++x) {
+        EXPECT_EQ(qr.getModule(x - border, y - border), dark[y][x]);
+      }
+    }
+    // A color change around each cell took 13 to 15 bytes per cell
+    EXPECT_LT(rendered.length(), dark.size() / 2 * width * 3);
+  }
+  EXPECT_EQ("", getQr(std::string(8000, 'x').c_str()));
+}
+
+TEST(PamTest, QrMask) {
+  const QrRenderer *renderer = QrRenderer::get("halfblock", "");
+  for (int mask = 0; mask < 8; ++mask) {
+    qrcodegen::QrCode qr;
+    ASSERT_EQ(qrcodegen::QrCode::Status::OK,
+              qrcodegen::QrCode::encodeText(VERIFICATION_URL,
+                                            qrcodegen::QrCode::Ecc::LOW, qr, 1,
+                                            40, mask, true, true));
+    EXPECT_EQ(renderer->render(qr, 1),
+              getQr(VERIFICATION_URL, 0, 1, renderer, std::to_string(mask)));
+  }
+  qrcodegen::QrCode qr;
+  ASSERT_EQ(qrcodegen::QrCode::Status::OK,
+            qrcodegen::QrCode::encodeText(
+                VERIFICATION_URL, qrcodegen::QrCode::Ecc::LOW, qr, 1, 40, -1,
+                true, true, qrcodegen::QrCode::MaskSearch::FAST));
+  EXPECT_EQ(renderer->render(qr, 1),
+            getQr(VERIFICATION_URL, 0, 1, renderer, "fast"));
+  EXPECT_EQ(getQr(VERIFICATION_URL), getQr(VERIFICATION_URL, 0, 1, NULL, "8"));
+}
+
+TEST(PamTest, PromptCache) {
+  DeviceAuthResponse response;
+  response.user_code = USER_CODE;
+  response.verification_uri = VERIFICATION_URL;
+  QrCache cache;
+  std::string prompt =
+      response.get_prompt(0, true, false, NULL, "auto", NULL, NULL);
+  EXPECT_NE(std::string::npos, prompt.find(getQr(VERIFICATION_URL)));
+  EXPECT_EQ(prompt,
+            response.get_prompt(0, true, false, NULL, "auto", &cache, NULL));
+  std::string rendered;
+  ASSERT_TRUE(cache.get(
+      QrCache::key(VERIFICATION_URL, 0, 1, "halfblock", "auto"), &rendered));
+  EXPECT_EQ(getQr(VERIFICATION_URL), rendered);
+  EXPECT_EQ(prompt,
+            response.get_prompt(0, true, false, NULL, "auto", &cache, NULL));
+  // The complete URI differs for every login
+  std::string complete_uri =
+      std::string(VERIFICATION_URL) + "?user_code=" + USER_CODE;
+  response.verification_uri_complete = complete_uri;
+  QrCache complete_cache;
+  response.get_prompt(0, true, false, NULL, "auto", &complete_cache, NULL);
+  EXPECT_FALSE(complete_cache.get(
+      QrCache::key(complete_uri, 0, 1, "halfblock", "auto"), &rendered));
 }
 
 TEST(PamTest, Token) {
@@ -32,6 +158,29 @@ TEST(PamTest, Token) {
   EXPECT_EQ(token, ACCESS_TOKEN);
 }
 
+TEST(PamTest, LdapEscapeFilter) {
+  EXPECT_EQ(ldap_escape_filter("jdoe"), "jdoe");
+  EXPECT_EQ(ldap_escape_filter("*"), "\\2a");
+  EXPECT_EQ(ldap_escape_filter("a(b)c"), "a\\28b\\29c");
+  EXPECT_EQ(ldap_escape_filter("a\\b"), "a\\5cb");
+  EXPECT_EQ(ldap_escape_filter(std::string("a\0b", 3)), "a\\00b");
+  EXPECT_EQ(ldap_escape_filter("*)(uid=*"), "\\2a\\29\\28uid=\\2a");
+}
+
+TEST(PamTest, PrefetchFilter) {
+  Config config;
+  config.ldap_filter = "(&(objectClass=user)(fedid=%s))";
+  config.ldap_attr = "uid";
+  EXPECT_EQ(prefetch_filter(config, "root"),
+            "(&(&(objectClass=user)(fedid=*))(uid=root))");
+  // The local username cannot widen the filter
+  EXPECT_EQ(prefetch_filter(config, "*)(uid=*"),
+            "(&(&(objectClass=user)(fedid=*))(uid=\\2a\\29\\28uid=\\2a))");
+  config.ldap_filter = "(objectClass=user)";
+  EXPECT_EQ(prefetch_filter(config, "root"),
+            "(&(objectClass=user)(uid=root))");
+}
+
 TEST(PamTest, Userinfo) {
   Userinfo userinfo;
   get_userinfo(USERINFO_ENDPOINT, ACCESS_TOKEN, USERNAME_ATTRIBUTE, &userinfo);
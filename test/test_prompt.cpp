@@ -0,0 +1,74 @@
+#include <string>
+
+#include "gtest/gtest.h"
+#include "include/prompt.hpp"
+
+#define VERIFICATION_URL "https://provider.com/oidc/device"
+#define USER_CODE "QWERTY"
+
+namespace {
+
+TEST(PromptTest, DefaultTemplate) {
+  PromptValues values;
+  values.uri = VERIFICATION_URL;
+  values.code = USER_CODE;
+  values.qr = "QR\n";
+  EXPECT_EQ(
+      "Authenticate at the identity provider using the following URL.\n\n"
+      "Alternatively, to authenticate with a mobile device, scan the QR "
+      "code.\n\nQR\n\n" VERIFICATION_URL "\nWith code: " USER_CODE "\n"
+      "\nHit enter when you have authenticated.\n",
+      PromptTemplate().render(values));
+  values.code.clear();
+  values.qr.clear();
+  EXPECT_EQ(
+      "Authenticate at the identity provider using the following URL.\n\n"
+      VERIFICATION_URL "\n\nHit enter when you have authenticated.\n",
+      PromptTemplate().render(values));
+}
+
+TEST(PromptTest, Placeholders) {
+  PromptValues values;
+  values.uri = VERIFICATION_URL;
+  values.expires = "10";
+  PromptTemplate prompt(
+      "{uri}{#code} code {code}{/code}{#expires}, {expires} min{/expires}");
+  EXPECT_EQ(VERIFICATION_URL ", 10 min", prompt.render(values));
+  values.code = USER_CODE;
+  values.expires.clear();
+  EXPECT_EQ(VERIFICATION_URL " code " USER_CODE, prompt.render(values));
+  // Nested sections, unknown and unbalanced braces
+  EXPECT_EQ("{x} a b {/qr}}{",
+            PromptTemplate("{x} {#code}a{#uri} b{/uri}{/code} {/qr}}{")
+                .render(values));
+  EXPECT_EQ(" ", PromptTemplate("{#qr}a{/code}{/qr} ").render(values));
+  EXPECT_EQ("", PromptTemplate("{#qr}runs to the end").render(values));
+  EXPECT_EQ("", PromptTemplate("").render(values));
+}
+
+TEST(PromptTest, Locales) {
+  PromptTemplates templates;
+  PromptValues values;
+  values.code = USER_CODE;
+  EXPECT_EQ(PromptTemplate().render(values),
+            templates.get("de_DE.UTF-8").render(values));
+  templates.set("", "default {code}");
+  templates.set("de", "de {code}");
+  templates.set("de_CH", "de_CH {code}");
+  EXPECT_EQ("de_CH " USER_CODE,
+            templates.get("de_CH.UTF-8@euro").render(values));
+  EXPECT_EQ("de " USER_CODE, templates.get("de_AT.UTF-8").render(values));
+  EXPECT_EQ("de " USER_CODE, templates.get("de").render(values));
+  EXPECT_EQ("default " USER_CODE, templates.get("fr_FR").render(values));
+  EXPECT_EQ("default " USER_CODE, templates.get("").render(values));
+  EXPECT_EQ("default " USER_CODE, templates.get("C").render(values));
+}
+
+TEST(PromptTest, EscapeUri) {
+  EXPECT_EQ(VERIFICATION_URL, escape_uri(VERIFICATION_URL));
+  EXPECT_EQ("https://a.b/c%20d%09e%0A%1B[0m%7F",
+            escape_uri("https://a.b/c d\te\n\033[0m\x7f"));
+  EXPECT_EQ("https://a.b/é", escape_uri("https://a.b/é"));
+}
+
+}  // namespace
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "include/qrcache.hpp"
+
+#define CACHE_DIR "test_qr_cache"
+#define VERIFICATION_URL "https://provider.com/oidc/device"
+
+namespace {
+
+class QrCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    key = QrCache::key(VERIFICATION_URL, 0, 1, "halfblock", "auto");
+    file = std::string(CACHE_DIR) + "/qr-";
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx",
+             static_cast<unsigned long long>(QrCache::hash(key)));
+    file += hash;
+    TearDown();
+  }
+  void TearDown() override {
+    unlink(file.c_str());
+    rmdir(CACHE_DIR);
+  }
+  std::string key, file;
+};
+
+TEST_F(QrCacheTest, Memory) {
+  QrCache cache;
+  std::string rendered;
+  EXPECT_FALSE(cache.get(key, &rendered));
+  cache.put(key, "qr");
+  ASSERT_TRUE(cache.get(key, &rendered));
+  EXPECT_EQ("qr", rendered);
+  EXPECT_FALSE(cache.get(
+      QrCache::key(VERIFICATION_URL, 1, 1, "halfblock", "auto"), &rendered));
+  EXPECT_FALSE(cache.get(
+      QrCache::key(VERIFICATION_URL, 0, 1, "quadrant", "auto"), &rendered));
+  EXPECT_FALSE(cache.get(
+      QrCache::key(VERIFICATION_URL, 0, 1, "halfblock", "fast"), &rendered));
+  EXPECT_EQ(access(CACHE_DIR, F_OK), -1);
+  // A full cache starts over
+  for (int i = 0; i < QRCACHE_MAX_ENTRIES; ++i) {
+    cache.put(std::to_string(i), "qr");
+  }
+  EXPECT_FALSE(cache.get(key, &rendered));
+  EXPECT_TRUE(cache.get(std::to_string(QRCACHE_MAX_ENTRIES - 1), &rendered));
+}
+
+TEST_F(QrCacheTest, SharedBetweenInstances) {
+  std::string qr("\033[40;97m \u2580\033[0m\n");
+  QrCache(CACHE_DIR).put(key, qr);
+  struct stat st;
+  ASSERT_EQ(0, stat(file.c_str(), &st));
+  EXPECT_EQ(0600, st.st_mode & 0777);
+  std::string rendered;
+  ASSERT_TRUE(QrCache(CACHE_DIR).get(key, &rendered));
+  EXPECT_EQ(qr, rendered);
+  // The hash names the file, the key in it must match as well
+  EXPECT_FALSE(QrCache(CACHE_DIR).get(key + " ", &rendered));
+}
+
+TEST_F(QrCacheTest, SharedByDirectory) {
+  QrCache *cache = QrCache::shared(CACHE_DIR);
+  EXPECT_EQ(cache, QrCache::shared(CACHE_DIR));
+  // A config without a directory does not use the files of another
+  cache->put(key, "qr");
+  std::string rendered;
+  EXPECT_FALSE(QrCache::shared("")->get(key, &rendered));
+  EXPECT_EQ(0, access(file.c_str(), F_OK));
+}
+
+TEST_F(QrCacheTest, RejectsUntrustedFiles) {
+  QrCache(CACHE_DIR).put(key, "qr");
+  std::string rendered;
+  ASSERT_EQ(0, chmod(file.c_str(), 0622));
+  EXPECT_FALSE(QrCache(CACHE_DIR).get(key, &rendered));
+  ASSERT_EQ(0, chmod(file.c_str(), 0600));
+  ASSERT_EQ(0, truncate(file.c_str(), sizeof(QrCacheHeader) + key.length()));
+  EXPECT_FALSE(QrCache(CACHE_DIR).get(key, &rendered));
+}
+
+}  // namespace
@@ -0,0 +1,581 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "include/nayuki/BitBuffer.hpp"
+#include "include/nayuki/QrCode.hpp"
+#include "include/nayuki/QrSegment.hpp"
+
+#define VERIFICATION_URL "http://localhost:8042/oidc/device"
+
+using qrcodegen::BitBuffer;
+using qrcodegen::QrCode;
+using qrcodegen::QrSegment;
+
+namespace {
+
+std::atomic<long> allocations(0);
+
+}  // namespace
+
+// Counts the heap allocations of the whole test binary. Every form of new
+// and delete is replaced, so that none pairs with the library's own, and
+// they are not inlined, so that GCC does not pair new with free.
+__attribute__((noinline)) void *operator new(std::size_t size) {
+  ++allocations;
+  void *pointer = std::malloc(size == 0 ? 1 : size);
+  if (pointer == nullptr) throw std::bad_alloc();
+  return pointer;
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+__attribute__((noinline)) void operator delete(void *pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept { operator delete(pointer); }
+
+void operator delete(void *pointer, std::size_t) noexcept {
+  operator delete(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept {
+  operator delete(pointer);
+}
+
+namespace {
+
+// A QR Code reader for the symbols of this library, independent of it. It
+// checks the format bits and the Reed-Solomon codewords, so it fails on
+// anything a scanner would have to correct.
+const int8_t kEccCodewordsPerBlock[4][41] = {
+    {-1, 7,  10, 15, 20, 26, 18, 20, 24, 30, 18, 20, 24, 26,
+     30, 22, 24, 28, 30, 28, 28, 28, 28, 30, 30, 26, 28, 30,
+     30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},
+    {-1, 10, 16, 26, 18, 24, 16, 18, 22, 22, 26, 30, 22, 22,
+     24, 24, 28, 28, 26, 26, 26, 26, 28, 28, 28, 28, 28, 28,
+     28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28},
+    {-1, 13, 22, 18, 26, 18, 24, 18, 22, 20, 24, 28, 26, 24,
+     20, 30, 24, 28, 28, 26, 30, 28, 30, 30, 30, 30, 28, 30,
+     30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},
+    {-1, 17, 28, 22, 16, 22, 28, 26, 26, 24, 28, 24, 28, 22,
+     24, 24, 30, 28, 28, 26, 28, 30, 24, 30, 30, 30, 30, 30,
+     30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30}};
+const int8_t kErrorCorrectionBlocks[4][41] = {
+    {-1, 1,  1,  1,  1,  1,  2,  2,  2,  2,  4,  4,  4,  4,
+     4,  6,  6,  6,  6,  7,  8,  8,  9,  9,  10, 12, 12, 12,
+     13, 14, 15, 16, 17, 18, 19, 19, 20, 21, 22, 24, 25},
+    {-1, 1,  1,  1,  2,  2,  4,  4,  4,  5,  5,  5,  8,  9,
+     9,  10, 10, 11, 13, 14, 16, 17, 17, 18, 20, 21, 23, 25,
+     26, 28, 29, 31, 33, 35, 37, 38, 40, 43, 45, 47, 49},
+    {-1, 1,  1,  2,  2,  4,  4,  6,  6,  8,  8,  8,  10, 12,
+     16, 12, 17, 16, 18, 21, 20, 23, 23, 25, 27, 29, 34, 34,
+     35, 38, 40, 43, 45, 48, 51, 53, 56, 59, 62, 65, 68},
+    {-1, 1,  1,  2,  4,  4,  4,  5,  6,  8,  8,  11, 11, 16,
+     16, 18, 16, 19, 21, 25, 25, 25, 34, 30, 32, 35, 37, 40,
+     42, 45, 48, 51, 54, 57, 60, 63, 66, 70, 74, 77, 81}};
+
+bool masked(int mask, int x, int y) {
+  switch (mask) {
+    case 0: return (x + y) % 2 == 0;
+    case 1: return y % 2 == 0;
+    case 2: return x % 3 == 0;
+    case 3: return (x + y) % 3 == 0;
+    case 4: return (x / 3 + y / 2) % 2 == 0;
+    case 5: return x * y % 2 + x * y % 3 == 0;
+    case 6: return (x * y % 2 + x * y % 3) % 2 == 0;
+    default: return ((x + y) % 2 + x * y % 3) % 2 == 0;
+  }
+}
+
+uint8_t gf_multiply(uint8_t x, uint8_t y) {
+  int z = 0;
+  for (int i = 7; i >= 0; --i) {
+    z = (z << 1) ^ ((z >> 7) * 0x11d);
+    z ^= ((y >> i) & 1) * x;
+  }
+  return static_cast<uint8_t>(z);
+}
+
+// Returns the decoded text, or "" with a failure recorded
+std::string decode(const QrCode &qr) {
+  int size = qr.getSize();
+  int version = (size - 17) / 4;
+
+  // Format bits of the first copy, around the top left finder
+  int format = 0;
+  for (int i = 0; i <= 5; ++i) format |= qr.getModule(8, i) << i;
+  format |= qr.getModule(8, 7) << 6 | qr.getModule(8, 8) << 7 |
+            qr.getModule(7, 8) << 8;
+  for (int i = 9; i < 15; ++i) format |= qr.getModule(14 - i, 8) << i;
+  int ecc = -1, mask = -1;
+  const int kEccBits[4] = {1, 0, 3, 2};  // LOW, MEDIUM, QUARTILE, HIGH
+  for (int e = 0; e < 4; ++e) {
+    for (int m = 0; m < 8; ++m) {
+      int data = kEccBits[e] << 3 | m, rem = data;
+      for (int i = 0; i < 10; ++i) rem = (rem << 1) ^ ((rem >> 9) * 0x537);
+      if (((data << 10 | rem) ^ 0x5412) == format) {
+        ecc = e;
+        mask = m;
+      }
+    }
+  }
+  EXPECT_NE(-1, ecc) << "format bits " << format;
+  if (ecc == -1) return "";
+
+  // Function modules: finders with separators and format bits, timing
+  // patterns, alignment patterns and version information
+  std::vector<std::vector<bool>> function(size, std::vector<bool>(size));
+  auto mark = [&](int left, int top, int width, int height) {
+    for (int y = top; y < top + height; ++y) {
+      for (int x = left; x < left + width; ++x) function[y][x] = true;
+    }
+  };
+  mark(0, 0, 9, 9);
+  mark(size - 8, 0, 8, 9);
+  mark(0, size - 8, 9, 8);
+  mark(6, 0, 1, size);
+  mark(0, 6, size, 1);
+  if (version >= 2) {
+    int count = version / 7 + 2;
+    int step = version == 32
+                   ? 26
+                   : (version * 4 + count * 2 + 1) / (count * 2 - 2) * 2;
+    std::vector<int> positions(1, 6);
+    for (int i = count - 2; i >= 0; --i) {
+      positions.push_back(size - 7 - i * step);
+    }
+    for (size_t i = 0; i < positions.size(); ++i) {
+      for (size_t j = 0; j < positions.size(); ++j) {
+        bool corner = (i == 0 && j == 0) ||
+                      (i == 0 && j == positions.size() - 1) ||
+                      (i == positions.size() - 1 && j == 0);
+        if (!corner) mark(positions[i] - 2, positions[j] - 2, 5, 5);
+      }
+    }
+  }
+  if (version >= 7) {
+    mark(size - 11, 0, 3, 6);
+    mark(0, size - 11, 6, 3);
+  }
+
+  // Unmasked codewords in zigzag order
+  std::vector<uint8_t> codewords;
+  int bits = 0;
+  for (int right = size - 1; right >= 1; right -= 2) {
+    if (right == 6) right = 5;
+    for (int vert = 0; vert < size; ++vert) {
+      for (int j = 0; j < 2; ++j) {
+        int x = right - j;
+        bool upward = ((right + 1) & 2) == 0;
+        int y = upward ? size - 1 - vert : vert;
+        if (function[y][x]) continue;
+        if (bits % 8 == 0) codewords.push_back(0);
+        codewords.back() |= (qr.getModule(x, y) ^ masked(mask, x, y))
+                            << (7 - bits % 8);
+        ++bits;
+      }
+    }
+  }
+  if (bits % 8 != 0) codewords.pop_back();  // Remainder bits
+
+  // Deinterleave the blocks and check their syndromes
+  int blocks = kErrorCorrectionBlocks[ecc][version];
+  int ecc_length = kEccCodewordsPerBlock[ecc][version];
+  int total = codewords.size();
+  int short_blocks = blocks - total % blocks;
+  int short_length = total / blocks;
+  std::vector<std::vector<uint8_t>> block(blocks);
+  for (int i = 0, k = 0; i <= short_length; ++i) {
+    for (int j = 0; j < blocks; ++j) {
+      if (i != short_length - ecc_length || j >= short_blocks) {
+        block[j].push_back(codewords[k++]);
+      }
+    }
+  }
+  std::vector<uint8_t> data;
+  for (auto &b : block) {
+    uint8_t root = 1;
+    for (int k = 0; k < ecc_length; ++k, root = gf_multiply(root, 2)) {
+      uint8_t syndrome = 0;
+      for (uint8_t c : b) syndrome = gf_multiply(syndrome, root) ^ c;
+      EXPECT_EQ(0, syndrome) << "block syndrome " << k;
+      if (syndrome != 0) return "";
+    }
+    data.insert(data.end(), b.begin(), b.end() - ecc_length);
+  }
+
+  // Segments until the terminator
+  size_t position = 0;
+  auto read = [&](int length) {
+    int value = 0;
+    for (int i = 0; i < length; ++i, ++position) {
+      if (position >= data.size() * 8) return -1;
+      value = value << 1 | ((data[position / 8] >> (7 - position % 8)) & 1);
+    }
+    return value;
+  };
+  const char *alphanumeric = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+  int range = version <= 9 ? 0 : version <= 26 ? 1 : 2;
+  std::string text;
+  for (int mode; (mode = read(4)) > 0;) {
+    if (mode == 1) {
+      const int kCountBits[] = {10, 12, 14};
+      for (int n = read(kCountBits[range]); n > 0; n -= 3) {
+        int digits = n >= 3 ? 3 : n;
+        std::string group = std::to_string(read(digits * 3 + 1));
+        text += std::string(digits - group.length(), '0') + group;
+      }
+    } else if (mode == 2) {
+      const int kCountBits[] = {9, 11, 13};
+      for (int n = read(kCountBits[range]); n > 0; n -= 2) {
+        if (n >= 2) {
+          int pair = read(11);
+          text += alphanumeric[pair / 45];
+          text += alphanumeric[pair % 45];
+        } else {
+          text += alphanumeric[read(6)];
+        }
+      }
+    } else if (mode == 4) {
+      const int kCountBits[] = {8, 16, 16};
+      for (int n = read(kCountBits[range]); n > 0; --n) text += read(8);
+    } else {
+      ADD_FAILURE() << "mode " << mode;
+      return "";
+    }
+  }
+  return text;
+}
+
+TEST(QrCodeTest, RowAndColumnWords) {
+  std::string text(VERIFICATION_URL);
+  text += "?user_code=e1e9b7be-e720-467e-bbe1-5c382356e4a9";
+  for (int length : {1, 100, 700}) {
+    QrCode qr = QrCode::encodeText(text.substr(0, length).c_str(),
+                                   QrCode::Ecc::MEDIUM);
+    int size = qr.getSize();
+    for (int y = -1; y <= size; ++y) {
+      for (int x = -1; x <= size; ++x) {
+        int i = x < 0 ? -1 : x / 64;
+        int j = y < 0 ? -1 : y / 64;
+        bool row_bit = (qr.getRowWord(y, i) >> (x & 63)) & 1;
+        bool column_bit = (qr.getColumnWord(x, j) >> (y & 63)) & 1;
+        ASSERT_EQ(row_bit, qr.getModule(x, y));
+        ASSERT_EQ(column_bit, qr.getModule(x, y));
+      }
+    }
+    // Bits past the end of the grid are white
+    EXPECT_EQ(qr.getRowWord(0, (size - 1) / 64) >> (size % 64), 0u);
+    EXPECT_EQ(qr.getRowWord(0, (size + 63) / 64), 0u);
+  }
+}
+
+TEST(QrCodeTest, ParallelMaskSearch) {
+  std::string text(VERIFICATION_URL);
+  for (int version : {5, 10, 40}) {
+    for (auto ecc : {QrCode::Ecc::LOW, QrCode::Ecc::HIGH}) {
+      std::vector<QrSegment> segs = QrSegment::makeSegments(text.c_str());
+      QrCode serial = QrCode::encodeSegments(segs, ecc, version, version, -1,
+                                             false, QrCode::MaskSearch::SERIAL);
+      QrCode parallel =
+          QrCode::encodeSegments(segs, ecc, version, version, -1, false,
+                                 QrCode::MaskSearch::PARALLEL);
+      ASSERT_EQ(serial.getMask(), parallel.getMask());
+      for (int y = 0; y < serial.getSize(); ++y) {
+        for (int x = 0; x < serial.getSize(); ++x) {
+          ASSERT_EQ(serial.getModule(x, y), parallel.getModule(x, y));
+        }
+      }
+    }
+  }
+}
+
+TEST(QrCodeTest, PenaltyScoreMatchesReference) {
+  std::mt19937 rng(42);
+  for (int iteration = 0; iteration < 400; ++iteration) {
+    int version = 1 + rng() % QrCode::MAX_VERSION;
+    auto ecc = static_cast<QrCode::Ecc>(rng() % 4);
+    int mask = rng() % 8;
+    // Random bytes fill the grid with arbitrary runs, the function patterns
+    // add finder-like patterns to every code
+    std::vector<std::uint8_t> data(rng() % 40);
+    for (auto &byte : data) byte = rng();
+    std::vector<QrSegment> segs(1, QrSegment::makeBytes(data));
+    QrCode qr = QrCode::encodeSegments(segs, ecc, version, QrCode::MAX_VERSION,
+                                       mask, false);
+    ASSERT_EQ(qr.getReferencePenaltyScore(), qr.getPenaltyScore())
+        << "version " << qr.getVersion() << " mask " << mask;
+  }
+}
+
+TEST(QrCodeTest, FunctionTemplatesSharedAcrossThreads) {
+  // Every thread races to build the templates of the same versions
+  std::vector<QrCode> codes[4];
+  std::vector<std::thread> threads;
+  for (auto &result : codes) {
+    threads.emplace_back([&result]() {
+      for (int version = 1; version <= QrCode::MAX_VERSION; ++version) {
+        std::vector<QrSegment> segs = QrSegment::makeSegments("PAM");
+        result.push_back(QrCode::encodeSegments(segs, QrCode::Ecc::LOW, version,
+                                                version, 3, false));
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+  for (int i = 0; i < QrCode::MAX_VERSION; ++i) {
+    const QrCode &expected = codes[0][i];
+    for (auto &result : codes) {
+      for (int y = 0; y < expected.getSize(); ++y) {
+        for (int x = 0; x < expected.getSize(); ++x) {
+          ASSERT_EQ(expected.getModule(x, y), result[i].getModule(x, y));
+        }
+      }
+    }
+  }
+}
+
+TEST(BitBufferTest, MatchesBitList) {
+  // Mixes appends of every kind at random offsets and compares with the bits
+  // appended one at a time
+  std::mt19937 rng(11);
+  for (int iteration = 0; iteration < 200; ++iteration) {
+    BitBuffer bb;
+    std::vector<bool> expected;
+    for (int step = rng() % 20; step > 0; --step) {
+      if (rng() % 3 == 0) {
+        std::vector<std::uint8_t> bytes(rng() % 20);
+        for (auto &b : bytes) b = rng();
+        bb.appendBytes(bytes.data(), bytes.size());
+        for (auto b : bytes) {
+          for (int i = 7; i >= 0; --i) expected.push_back((b >> i) & 1);
+        }
+      } else if (rng() % 2 == 0) {
+        BitBuffer other;
+        std::vector<bool> bits;
+        for (int n = rng() % 150; n > 0; --n) {
+          bool bit = rng() % 2;
+          other.appendBits(bit, 1);
+          bits.push_back(bit);
+        }
+        bb.appendData(other);
+        expected.insert(expected.end(), bits.begin(), bits.end());
+      } else {
+        int len = rng() % 33;
+        std::uint32_t val = len == 0 ? 0 : rng() >> (32 - len);
+        bb.appendBits(val, len);
+        for (int i = len - 1; i >= 0; --i) expected.push_back((val >> i) & 1);
+      }
+    }
+    ASSERT_EQ(expected.size(), bb.size());
+    std::vector<std::uint8_t> bytes((bb.size() + 7) / 8);
+    bb.getBytes(bytes.data());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      ASSERT_EQ(expected[i], bb.getBit(i));
+      ASSERT_EQ(expected[i], ((bytes[i / 8] >> (7 - i % 8)) & 1) != 0);
+    }
+    if (bb.size() % 8 != 0) {
+      EXPECT_EQ(0, bytes.back() & ((1 << (8 - bb.size() % 8)) - 1));
+    }
+  }
+  BitBuffer bb;
+  EXPECT_THROW(bb.appendBits(2, 1), std::domain_error);
+  EXPECT_THROW(bb.appendBits(0, 33), std::domain_error);
+  EXPECT_THROW(bb.getBit(0), std::out_of_range);
+}
+
+TEST(QrCodeTest, FastMaskSearch) {
+  // Every mask the estimate picks must read back, and it should mostly pick
+  // the mask of the full search or one scoring close to it
+  std::mt19937 rng(3);
+  const std::string alphabet(
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_");
+  long fast_total = 0, best_total = 0;
+  for (int iteration = 0; iteration < 60; ++iteration) {
+    std::string text("https://login.example.com/device?user_code=");
+    for (int i = rng() % (iteration < 50 ? 200 : 1200); i > 0; --i) {
+      text += alphabet[rng() % alphabet.size()];
+    }
+    auto ecc = static_cast<QrCode::Ecc>(rng() % 4);
+    QrCode best =
+        QrCode::encodeSegments(QrSegment::makeSegments(text.c_str()), ecc);
+    QrCode fast = QrCode::encodeSegments(QrSegment::makeSegments(text.c_str()),
+                                         ecc, 1, 40, -1, true,
+                                         QrCode::MaskSearch::FAST);
+    ASSERT_EQ(text, decode(best));
+    ASSERT_EQ(text, decode(fast));
+    QrCode fixed_buffer;
+    ASSERT_EQ(QrCode::Status::OK,
+              QrCode::encodeText(text.c_str(), ecc, fixed_buffer, 1, 40, -1,
+                                 true, true, QrCode::MaskSearch::FAST));
+    ASSERT_EQ(text, decode(fixed_buffer));
+    fast_total += fast.getPenaltyScore();
+    best_total += best.getPenaltyScore();
+  }
+  EXPECT_LT(fast_total, best_total * 11 / 10);
+  for (int mask = 0; mask < 8; ++mask) {
+    QrCode qr;
+    ASSERT_EQ(QrCode::Status::OK,
+              QrCode::encodeText(VERIFICATION_URL, QrCode::Ecc::MEDIUM, qr, 1,
+                                 40, mask));
+    EXPECT_EQ(mask, qr.getMask());
+    EXPECT_EQ(VERIFICATION_URL, decode(qr));
+  }
+}
+
+TEST(QrSegmentTest, OptimalSegmentsAreMinimal) {
+  // Compares with every assignment of modes to the characters of short texts
+  std::mt19937 rng(7);
+  const std::string alphabet("0123456789ABCZ:/. az?=&%");
+  const std::uint8_t kModes[] = {0x4, 0x2, 0x1};
+  for (int iteration = 0; iteration < 300; ++iteration) {
+    std::string text;
+    for (int i = 1 + rng() % 7; i > 0; --i) text += alphabet[rng() % 24];
+    int version = 1 + rng() % QrCode::MAX_VERSION;
+    int best = -1;
+    int assignments = 1;
+    for (size_t i = 0; i < text.size(); ++i) assignments *= 3;
+    for (int assignment = 0; assignment < assignments; ++assignment) {
+      std::vector<std::uint8_t> modes;
+      bool encodable = true;
+      for (int i = 0, rest = assignment; i < (int)text.size(); ++i, rest /= 3) {
+        modes.push_back(kModes[rest % 3]);
+        std::string c(1, text[i]);
+        if (rest % 3 == 1) encodable &= QrSegment::isAlphanumeric(c.c_str());
+        if (rest % 3 == 2) encodable &= QrSegment::isNumeric(c.c_str());
+      }
+      if (!encodable) continue;
+      int bits = QrSegment::getTotalBits(modes.data(), text.size(), version);
+      if (best == -1 || bits < best) best = bits;
+    }
+    std::vector<QrSegment> segs =
+        QrSegment::makeSegmentsOptimally(text.c_str(), version);
+    ASSERT_EQ(best, QrSegment::getTotalBits(segs, version)) << text;
+  }
+}
+
+TEST(QrSegmentTest, OptimalSegmentsShrinkUrls) {
+  const char *url = "HTTPS://LOGIN.EXAMPLE.COM/device?user_code=12345678";
+  std::vector<QrSegment> single = QrSegment::makeSegments(url);
+  std::vector<QrSegment> optimal = QrSegment::makeSegmentsOptimally(url, 5);
+  EXPECT_LT(QrSegment::getTotalBits(optimal, 5),
+            QrSegment::getTotalBits(single, 5));
+  EXPECT_EQ(3u, optimal.size());
+  // The fixed buffer encoder splits the text the same way
+  for (auto ecc : {QrCode::Ecc::LOW, QrCode::Ecc::HIGH}) {
+    QrCode expected = QrCode::encodeSegments(optimal, ecc, 1, 9);
+    QrCode qr;
+    ASSERT_EQ(QrCode::Status::OK,
+              QrCode::encodeText(url, ecc, qr, 1, 40, -1, true, true));
+    ASSERT_EQ(expected.getVersion(), qr.getVersion());
+    for (int y = 0; y < qr.getSize(); ++y) {
+      for (int x = 0; x < qr.getSize(); ++x) {
+        ASSERT_EQ(expected.getModule(x, y), qr.getModule(x, y));
+      }
+    }
+  }
+}
+
+TEST(QrCodeTest, VersionSelectionAtCapacity) {
+  // Version 1 LOW holds 19 data codewords, 17 bytes after the 12 header bits;
+  // version 10 starts the 16-bit byte count, so 271 bytes fit its 274
+  // codewords there but not with the 8-bit count of version 9
+  struct {
+    size_t length;
+    int min_version;
+    int version;
+  } cases[] = {{17, 1, 1}, {18, 1, 2}, {17, 3, 3}, {230, 1, 9},
+               {231, 1, 10}, {271, 1, 10}, {272, 1, 11}, {2953, 1, 40}};
+  for (auto &c : cases) {
+    std::vector<std::uint8_t> data(c.length, 'x');
+    std::vector<QrSegment> segs(1, QrSegment::makeBytes(data));
+    QrCode qr = QrCode::encodeSegments(segs, QrCode::Ecc::LOW, c.min_version,
+                                       40, -1, false);
+    EXPECT_EQ(c.version, qr.getVersion()) << c.length;
+  }
+  std::vector<QrSegment> segs(
+      1, QrSegment::makeBytes(std::vector<std::uint8_t>(2954, 'x')));
+  EXPECT_THROW(QrCode::encodeSegments(segs, QrCode::Ecc::LOW),
+               qrcodegen::data_too_long);
+  // The ECC is boosted as far as the chosen version allows
+  segs.assign(1, QrSegment::makeBytes(std::vector<std::uint8_t>(7, 'x')));
+  EXPECT_EQ(QrCode::Ecc::HIGH,
+            QrCode::encodeSegments(segs, QrCode::Ecc::LOW)
+                .getErrorCorrectionLevel());
+  segs.assign(1, QrSegment::makeBytes(std::vector<std::uint8_t>(14, 'x')));
+  EXPECT_EQ(QrCode::Ecc::MEDIUM,
+            QrCode::encodeSegments(segs, QrCode::Ecc::LOW)
+                .getErrorCorrectionLevel());
+}
+
+TEST(QrCodeTest, FixedBufferEncode) {
+  std::string text(VERIFICATION_URL);
+  text += "?user_code=e1e9b7be-e720-467e-bbe1-5c382356e4a9";
+  for (const char *payload : {"", "0123456789", "HTTPS://EXAMPLE.COM/",
+                              text.c_str()}) {
+    for (auto ecc : {QrCode::Ecc::LOW, QrCode::Ecc::HIGH}) {
+      QrCode expected = QrCode::encodeText(payload, ecc);
+      QrCode qr;
+      ASSERT_EQ(QrCode::Status::OK, QrCode::encodeText(payload, ecc, qr));
+      ASSERT_EQ(expected.getVersion(), qr.getVersion());
+      ASSERT_EQ(expected.getErrorCorrectionLevel(),
+                qr.getErrorCorrectionLevel());
+      ASSERT_EQ(expected.getMask(), qr.getMask());
+      for (int y = 0; y < qr.getSize(); ++y) {
+        for (int x = 0; x < qr.getSize(); ++x) {
+          ASSERT_EQ(expected.getModule(x, y), qr.getModule(x, y));
+        }
+      }
+    }
+  }
+}
+
+TEST(QrCodeTest, FixedBufferEncodeErrors) {
+  QrCode qr;
+  std::string text(3000, 'a');
+  EXPECT_EQ(QrCode::Status::DATA_TOO_LONG,
+            QrCode::encodeText(text.c_str(), QrCode::Ecc::LOW, qr));
+  EXPECT_EQ(QrCode::Status::DATA_TOO_LONG,
+            QrCode::encodeText(VERIFICATION_URL, QrCode::Ecc::LOW, qr, 1, 1));
+  EXPECT_EQ(QrCode::Status::INVALID_ARGUMENT,
+            QrCode::encodeText("PAM", QrCode::Ecc::LOW, qr, 2, 1));
+  EXPECT_EQ(QrCode::Status::INVALID_ARGUMENT,
+            QrCode::encodeText("PAM", QrCode::Ecc::LOW, qr, 1, 40, 8));
+  // The result is left untouched
+  EXPECT_EQ(1, qr.getVersion());
+  for (int y = 0; y < qr.getSize(); ++y) {
+    for (int x = 0; x < qr.getSize(); ++x) ASSERT_FALSE(qr.getModule(x, y));
+  }
+}
+
+TEST(QrCodeTest, FixedBufferEncodeWithoutAllocations) {
+  std::string text(VERIFICATION_URL);
+  text += "?user_code=e1e9b7be-e720-467e-bbe1-5c382356e4a9";
+  QrCode qr;
+  // The first encode of each version builds its tables
+  for (int version = 1; version <= QrCode::MAX_VERSION; ++version) {
+    ASSERT_EQ(QrCode::Status::OK,
+              QrCode::encodeText("PAM", QrCode::Ecc::HIGH, qr, version));
+  }
+  long before = allocations;
+  for (auto ecc : {QrCode::Ecc::LOW, QrCode::Ecc::MEDIUM,
+                   QrCode::Ecc::QUARTILE, QrCode::Ecc::HIGH}) {
+    QrCode::encodeText(text.c_str(), ecc, qr);
+    QrCode::encodeText("https://example.com/device", ecc, qr, 40, 40);
+    QrCode::encodeText("01234567890123456789", ecc, qr, 1, 40, 3);
+  }
+  QrCode::encodeText(std::string(3000, 'a').c_str(), QrCode::Ecc::LOW, qr);
+  long after = allocations;
+  // One allocation is the std::string of the too long text
+  EXPECT_EQ(1, after - before);
+}
+
+}  // namespace
@@ -0,0 +1,242 @@
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "include/nayuki/QrCode.hpp"
+#include "include/qrrender.hpp"
+
+#define VERIFICATION_URL \
+  "https://provider.com/oidc/device?user_code=e1e9b7be-e720-467e-bbe1"
+
+using qrcodegen::QrCode;
+
+namespace {
+
+typedef std::vector<std::vector<bool>> Modules;
+
+QrCode encode() {
+  return QrCode::encodeText(VERIFICATION_URL, QrCode::Ecc::LOW);
+}
+
+// Expects the dark modules, border included, to match the code
+void expect_modules(const QrCode &qr, int border, const Modules &dark) {
+  int width = qr.getSize() + 2 * border;
+  ASSERT_GE(dark.size(), width);
+  for (int y = 0; y < width; ++y) {
+    ASSERT_GE(dark[y].size(), width);
+    for (int x = 0; x < width; ++x) {
+      ASSERT_EQ(qr.getModule(x - border, y - border), dark[y][x])
+          << x << "," << y;
+    }
+  }
+}
+
+// Replays the output of a text renderer like a terminal, the glyphs draw the
+// light modules, or the dark ones in reverse video
+Modules replay_text(const std::string &rendered, int columns,
+                    const std::vector<std::string> &glyphs) {
+  Modules dark;
+  std::vector<bool> rows[2];
+  bool reverse = false;
+  for (size_t i = 0; i < rendered.length();) {
+    if (rendered[i] == '\033') {
+      size_t end = rendered.find('m', i);
+      std::string code = rendered.substr(i + 2, end - i - 2);
+      if (code == "7" || code == "40;97;7") reverse = true;
+      if (code == "27" || code == "40;97" || code == "0") reverse = false;
+      i = end + 1;
+    } else if (rendered[i] == '\n') {
+      dark.push_back(rows[0]);
+      dark.push_back(rows[1]);
+      rows[0].clear();
+      rows[1].clear();
+      ++i;
+    } else {
+      size_t glyph = 0;
+      while (glyph < glyphs.size() &&
+             rendered.compare(i, glyphs[glyph].length(), glyphs[glyph]) != 0) {
+        ++glyph;
+      }
+      EXPECT_LT(glyph, glyphs.size()) << rendered.substr(i, 3);
+      if (glyph == glyphs.size()) return dark;
+      for (int bit = 0; bit < 2 * columns; ++bit) {
+        rows[bit / columns].push_back((((glyph >> bit) & 1) != 0) == reverse);
+      }
+      i += glyphs[glyph].length();
+    }
+  }
+  return dark;
+}
+
+TEST(QrRenderTest, HalfBlock) {
+  QrCode qr = encode();
+  std::string rendered = QrRenderer::get("halfblock", "")->render(qr, 1);
+  expect_modules(qr, 1,
+                 replay_text(rendered, 1, {" ", "\u2580", "\u2584", "\u2588"}));
+}
+
+TEST(QrRenderTest, Quadrant) {
+  QrCode qr = encode();
+  for (int border : {1, 2}) {
+    std::string rendered = QrRenderer::get("quadrant", "")->render(qr, border);
+    expect_modules(
+        qr, border,
+        replay_text(rendered, 2,
+                    {" ", "\u2598", "\u259d", "\u2580", "\u2596", "\u258c",
+                     "\u259e", "\u259b", "\u2597", "\u259a", "\u2590",
+                     "\u259c", "\u2584", "\u2599", "\u259f", "\u2588"}));
+    EXPECT_LT(rendered.length(),
+              QrRenderer::get("halfblock", "")->render(qr, border).length());
+  }
+}
+
+TEST(QrRenderTest, Sixel) {
+  QrCode qr = encode();
+  std::string rendered = QrRenderer::get("sixel", "")->render(qr, 1);
+  ASSERT_EQ(0, rendered.find("\033Pq\"1;1;"));
+  ASSERT_EQ(rendered.length() - 3, rendered.find("\033\\\n"));
+  // Paints the sixels of each band, one pixel row per band is enough as a
+  // sixel is either empty or full here
+  Modules dark(1);
+  size_t x = 0;
+  int color = 0;
+  for (size_t i = rendered.find('#'); i < rendered.length() - 3;) {
+    char c = rendered[i];
+    int count = 1;
+    if (c == '#') {
+      size_t end = rendered.find_first_not_of("0123456789", i + 1);
+      color = std::stoi(rendered.substr(i + 1, end - i - 1));
+      if (rendered[end] == ';') {
+        end = rendered.find_first_not_of("0123456789;", end);
+      }
+      i = end;
+      continue;
+    } else if (c == '$') {
+      x = 0;
+    } else if (c == '-') {
+      x = 0;
+      dark.emplace_back();
+    } else {
+      if (c == '!') {
+        size_t end = rendered.find_first_not_of("0123456789", i + 1);
+        count = std::stoi(rendered.substr(i + 1, end - i - 1));
+        i = end;
+        c = rendered[i];
+      }
+      ASSERT_TRUE(c == '~' || c == '?') << c;
+      for (int pixel = 0; pixel < count; ++pixel, ++x) {
+        if (dark.back().size() <= x) dark.back().push_back(false);
+        if (c == '~') dark.back()[x] = color == 0;
+      }
+    }
+    ++i;
+  }
+  // Scale the pixels back to modules
+  int width = qr.getSize() + 2;
+  ASSERT_EQ(width, dark.size());
+  Modules modules(width, std::vector<bool>(width));
+  for (int y = 0; y < width; ++y) {
+    for (int x = 0; x < width; ++x) {
+      modules[y][x] = dark[y].size() > x * 6u && dark[y][x * 6];
+      for (int pixel = 1; pixel < 6 && x * 6u + pixel < dark[y].size();
+           ++pixel) {
+        ASSERT_EQ(modules[y][x], dark[y][x * 6 + pixel]);
+      }
+    }
+  }
+  expect_modules(qr, 1, modules);
+}
+
+std::string base64_decode(const std::string &text) {
+  const std::string alphabet(
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/");
+  std::string result;
+  uint32_t group = 0;
+  int bits = 0;
+  for (char c : text) {
+    if (c == '=') break;
+    group = group << 6 | alphabet.find(c);
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      result.push_back(static_cast<char>((group >> bits) & 0xff));
+    }
+  }
+  return result;
+}
+
+uint32_t read_uint32(const std::string &data, size_t offset) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; ++i) {
+    value = value << 8 | static_cast<unsigned char>(data[offset + i]);
+  }
+  return value;
+}
+
+TEST(QrRenderTest, Kitty) {
+  QrCode qr = encode();
+  int width = qr.getSize() + 2;
+  std::string rendered = QrRenderer::get("kitty", "")->render(qr, 1);
+  std::string header("\033_Ga=T,f=100,q=2,c=" + std::to_string(width) +
+                     ",r=" + std::to_string((width + 1) / 2) + ",");
+  ASSERT_EQ(0, rendered.find(header));
+  // Join the chunks, every one but the last has m=1
+  std::string payload;
+  for (size_t i = header.length(); i < rendered.length() - 1;) {
+    size_t data = rendered.find(';', i) + 1;
+    size_t end = rendered.find("\033\\", data);
+    bool last = end + 3 == rendered.length();
+    EXPECT_EQ(last ? "m=0;" : "m=1;", rendered.substr(data - 4, 4));
+    payload.append(rendered, data, end - data);
+    i = end + 2;
+    if (!last) {
+      ASSERT_EQ(i, rendered.find("\033_G", i));
+    }
+  }
+  std::string png = base64_decode(payload);
+  ASSERT_EQ(0, png.find("\x89PNG\r\n\x1a\n"));
+  ASSERT_EQ("IHDR", png.substr(12, 4));
+  EXPECT_EQ(width, read_uint32(png, 16));
+  EXPECT_EQ(width, read_uint32(png, 20));
+  EXPECT_EQ(std::string("\x01\x00\x00\x00\x00", 5), png.substr(24, 5));
+  size_t idat_length = read_uint32(png, 33);
+  ASSERT_EQ("IDAT", png.substr(37, 4));
+  std::string zlib = png.substr(41, idat_length);
+  ASSERT_EQ(std::string("\x78\x01", 2), zlib.substr(0, 2));
+  // Unpack the stored deflate blocks
+  std::string pixels;
+  for (size_t i = 2;;) {
+    bool final = zlib[i] & 1;
+    size_t length = static_cast<unsigned char>(zlib[i + 1]) |
+                    static_cast<unsigned char>(zlib[i + 2]) << 8;
+    pixels.append(zlib, i + 5, length);
+    i += 5 + length;
+    if (final) break;
+  }
+  size_t stride = 1 + (width + 7) / 8;
+  ASSERT_EQ(stride * width, pixels.length());
+  Modules modules(width, std::vector<bool>(width));
+  for (int y = 0; y < width; ++y) {
+    EXPECT_EQ(0, pixels[y * stride]);
+    for (int x = 0; x < width; ++x) {
+      modules[y][x] = !((pixels[y * stride + 1 + x / 8] >> (7 - x % 8)) & 1);
+    }
+  }
+  expect_modules(qr, 1, modules);
+  EXPECT_EQ("IEND", png.substr(png.length() - 8, 4));
+}
+
+TEST(QrRenderTest, Select) {
+  EXPECT_EQ(QrRenderer::get("kitty", ""),
+            QrRenderer::get("auto", "xterm-kitty"));
+  EXPECT_EQ(QrRenderer::get("sixel", ""), QrRenderer::get("auto", "foot"));
+  EXPECT_EQ(QrRenderer::get("halfblock", ""),
+            QrRenderer::get("auto", "xterm-256color"));
+  EXPECT_EQ(QrRenderer::get("halfblock", ""), QrRenderer::get("auto", ""));
+  EXPECT_NE(QrRenderer::get("halfblock", ""), QrRenderer::get("quadrant", ""));
+  EXPECT_EQ(NULL, QrRenderer::get("braille", ""));
+}
+
+}  // namespace
@@ -0,0 +1,170 @@
+#include <security/pam_appl.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "include/metrics.hpp"
+#include "include/stats.hpp"
+
+#define STATS_FILE "test_stats_file"
+#define HOST_A "ldaps://ldap-a:636"
+
+namespace {
+
+class StatsTest : public ::testing::Test {
+ protected:
+  void SetUp() override { unlink(STATS_FILE); }
+  void TearDown() override { unlink(STATS_FILE); }
+};
+
+TEST_F(StatsTest, Buckets) {
+  for (uint64_t value = 0; value < 16; ++value) {
+    EXPECT_EQ(value, Stats::bucket(value));
+    EXPECT_EQ(value, Stats::bucket_limit(value));
+  }
+  EXPECT_EQ(16, Stats::bucket(16));
+  EXPECT_EQ(31, Stats::bucket(31));
+  EXPECT_EQ(32, Stats::bucket(32));
+  EXPECT_EQ(32, Stats::bucket(33));
+  EXPECT_EQ(33u, Stats::bucket_limit(32));
+  // Every value lies in its bucket, which is at most 1/16 of it wide
+  int previous = 0;
+  for (uint64_t value = 1; value < (1ull << 41); value += value / 7 + 1) {
+    int bucket = Stats::bucket(value);
+    EXPECT_GE(bucket, previous);
+    ASSERT_LT(bucket, STATS_BUCKETS);
+    EXPECT_LE(value, Stats::bucket_limit(bucket));
+    if (bucket > 0 && bucket < STATS_BUCKETS - 1) {
+      EXPECT_GT(value, Stats::bucket_limit(bucket - 1));
+      EXPECT_LE(Stats::bucket_limit(bucket) - value, value / 16);
+    }
+    previous = bucket;
+  }
+  EXPECT_EQ(STATS_BUCKETS - 1, Stats::bucket(UINT64_MAX));
+}
+
+TEST_F(StatsTest, Quantiles) {
+  Stats stats;
+  ASSERT_TRUE(stats.open(STATS_FILE));
+  for (uint64_t value = 1; value <= 1000; ++value) {
+    stats.observe(STATS_DEVICE_MS, value * 1000);
+  }
+  StatsHistogram histogram = stats.histogram(STATS_DEVICE_MS);
+  EXPECT_EQ(1000u, histogram.count);
+  EXPECT_EQ(500500000u, histogram.sum);
+  EXPECT_EQ(1000000u, histogram.max);
+  uint64_t p50 = Stats::quantile(histogram, 0.5);
+  EXPECT_GE(p50, 500000u);
+  EXPECT_LE(p50, 500000u * 17 / 16);
+  uint64_t p99 = Stats::quantile(histogram, 0.99);
+  EXPECT_GE(p99, 990000u);
+  EXPECT_LE(p99, 1000000u);
+  EXPECT_EQ(1000000u, Stats::quantile(histogram, 1));
+  EXPECT_EQ(0u, Stats::quantile(stats.histogram(STATS_QR_MS), 0.5));
+}
+
+TEST_F(StatsTest, RecordLogin) {
+  LoginMetrics metrics;
+  metrics.add_ms("device_ms", 12.5);
+  metrics.add_count("polls", 2);
+  metrics.add_sample("poll_rtt_ms", "", 3);
+  metrics.add_sample("poll_rtt_ms", "", 4);
+  metrics.add_sample("ldap_ms", HOST_A, 7);
+  metrics.add_count("ldap_errors", 1);
+  metrics.add_count("bytes_received", 100);
+  metrics.add_count("unknown", 1);
+  metrics.set("authorized_by", "ldap");
+  {
+    Stats stats;
+    ASSERT_TRUE(stats.open(STATS_FILE));
+    stats.record(metrics, PAM_SUCCESS);
+    stats.record(metrics, PAM_AUTH_ERR);
+  }
+
+  // Shared through the file, which readers do not change
+  Stats stats;
+  ASSERT_TRUE(stats.open(STATS_FILE, false));
+  stats.observe(STATS_DEVICE_MS, 1);
+  stats.add(STATS_LDAP_ERRORS, 1);
+  EXPECT_EQ(1u, stats.counter(STATS_LOGINS_SUCCESS));
+  EXPECT_EQ(1u, stats.counter(STATS_LOGINS_AUTH_ERR));
+  EXPECT_EQ(0u, stats.counter(STATS_LOGINS_OTHER_ERR));
+  EXPECT_EQ(2u, stats.counter(STATS_LDAP_ERRORS));
+  EXPECT_EQ(200u, stats.counter(STATS_BYTES_RECEIVED));
+  EXPECT_EQ(2u, stats.counter(STATS_AUTHORIZED_LDAP));
+  EXPECT_EQ(2u, stats.histogram(STATS_TOTAL_MS).count);
+  EXPECT_EQ(2u, stats.histogram(STATS_DEVICE_MS).count);
+  EXPECT_EQ(25000u, stats.histogram(STATS_DEVICE_MS).sum);
+  EXPECT_EQ(4u, stats.histogram(STATS_POLL_RTT_MS).count);
+  EXPECT_EQ(2u, stats.histogram(STATS_LDAP_MS).count);
+  EXPECT_EQ(4u, stats.histogram(STATS_POLLS).sum);
+}
+
+TEST_F(StatsTest, Output) {
+  Stats stats;
+  EXPECT_FALSE(stats.open(STATS_FILE, false));
+  ASSERT_TRUE(stats.open(STATS_FILE));
+  stats.observe(STATS_POLL_RTT_MS, 2000);
+  stats.observe(STATS_POLLS, 3);
+  stats.add(STATS_QR_CACHE_HITS, 5);
+
+  std::string text = stats.text();
+  EXPECT_NE(std::string::npos, text.find("qr_cache_hits=5\n"));
+  EXPECT_NE(std::string::npos,
+            text.find("poll_rtt_ms count=1 mean=2.000 p50=2.000 p90=2.000 "
+                      "p99=2.000 p999=2.000 max=2.000\n"));
+  EXPECT_NE(std::string::npos,
+            text.find("polls count=1 mean=3.000 p50=3.000"));
+  EXPECT_EQ(std::string::npos, text.find("device_ms"));
+
+  std::string prometheus = stats.prometheus();
+  EXPECT_NE(std::string::npos,
+            prometheus.find("pam_oauth2_device_qr_cache_hits_total 5\n"));
+  EXPECT_NE(std::string::npos,
+            prometheus.find("pam_oauth2_device_phase_seconds_bucket{phase="
+                            "\"poll_rtt\",le=\"0.000991\"} 0\n"));
+  EXPECT_NE(std::string::npos,
+            prometheus.find("pam_oauth2_device_phase_seconds_bucket{phase="
+                            "\"poll_rtt\",le=\"0.002431\"} 1\n"));
+  EXPECT_NE(std::string::npos,
+            prometheus.find("pam_oauth2_device_phase_seconds_sum{phase="
+                            "\"poll_rtt\"} 0.002000\n"));
+  EXPECT_NE(std::string::npos,
+            prometheus.find("pam_oauth2_device_polls_bucket{le=\"3\"} 1\n"));
+  EXPECT_NE(std::string::npos,
+            prometheus.find("pam_oauth2_device_polls_count 1\n"));
+}
+
+TEST_F(StatsTest, PrometheusBuckets) {
+  Stats stats;
+  ASSERT_TRUE(stats.open(STATS_FILE));
+  // Values around the bucket limits, 1000 and 2500 share their histogram
+  // buckets with larger values
+  const uint64_t values[] = {90, 100, 991, 992, 1000, 2431, 2500, 2600};
+  for (uint64_t value : values) stats.observe(STATS_DEVICE_MS, value);
+
+  // Every le counts exactly the values up to it
+  std::string prometheus = stats.prometheus();
+  std::string prefix =
+      "pam_oauth2_device_phase_seconds_bucket{phase=\"device\",le=\"";
+  size_t buckets = 0;
+  for (size_t start = prometheus.find(prefix); start != std::string::npos;
+       start = prometheus.find(prefix, start + 1)) {
+    size_t end = prometheus.find('"', start + prefix.length());
+    std::string le = prometheus.substr(start + prefix.length(),
+                                       end - start - prefix.length());
+    if (le == "+Inf") continue;
+    uint64_t expected = 0;
+    for (uint64_t value : values) {
+      if (value / 1e6 <= std::stod(le)) ++expected;
+    }
+    EXPECT_EQ(std::to_string(expected),
+              prometheus.substr(end + 3, prometheus.find('\n', end) - end - 3))
+        << "le=" << le;
+    ++buckets;
+  }
+  EXPECT_EQ(20u, buckets);
+}
+
+}  // namespace
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "include/metrics.hpp"
+#include "include/nlohmann/json.hpp"
+#include "include/trace.hpp"
+
+using json = nlohmann::json;
+
+#define SPOOL_FILE "test_trace_spool"
+#define COLLECTOR_SOCKET "test_trace_socket"
+
+namespace {
+
+bool is_hex(const std::string &value, size_t length) {
+  return value.length() == length &&
+         value.find_first_not_of("0123456789abcdef") == std::string::npos;
+}
+
+// Returns the value of a string attribute, "" when it is missing
+std::string attribute(const json &attributes, const std::string &key) {
+  for (auto &attribute : attributes) {
+    if (attribute.at("key") == key) {
+      return attribute.at("value").at("stringValue").get<std::string>();
+    }
+  }
+  return "";
+}
+
+// Checks one line of an export against the OTLP/JSON
+// ExportTraceServiceRequest, returns its logins' spans
+std::vector<json> validate_request(const std::string &line) {
+  std::vector<json> logins;
+  json request = json::parse(line);
+  EXPECT_TRUE(request.at("resourceSpans").is_array());
+  for (auto &resource_spans : request.at("resourceSpans")) {
+    auto &resource = resource_spans.at("resource").at("attributes");
+    EXPECT_EQ("pam_oauth2_device", attribute(resource, "service.name"));
+    EXPECT_EQ(std::to_string(getpid()), attribute(resource, "process.pid"));
+    auto &scope_spans = resource_spans.at("scopeSpans");
+    EXPECT_EQ(1u, scope_spans.size());
+    EXPECT_EQ("pam_oauth2_device", scope_spans[0].at("scope").at("name"));
+    auto &spans = scope_spans[0].at("spans");
+    // The root span comes first, the phases are its children
+    std::string trace_id = spans[0].at("traceId");
+    std::string root_id = spans[0].at("spanId");
+    EXPECT_TRUE(is_hex(trace_id, 32));
+    EXPECT_EQ(0u, spans[0].count("parentSpanId"));
+    for (auto &span : spans) {
+      EXPECT_EQ(trace_id, span.at("traceId"));
+      EXPECT_TRUE(is_hex(span.at("spanId"), 16));
+      if (&span != &spans[0]) {
+        EXPECT_EQ(root_id, span.at("parentSpanId"));
+        EXPECT_NE(root_id, span.at("spanId"));
+      }
+      EXPECT_FALSE(span.at("name").get<std::string>().empty());
+      EXPECT_TRUE(span.at("kind").is_number_integer());
+      EXPECT_LE(std::stoull(span.at("startTimeUnixNano").get<std::string>()),
+                std::stoull(span.at("endTimeUnixNano").get<std::string>()));
+      EXPECT_TRUE(span.at("attributes").is_array());
+      EXPECT_TRUE(span.at("status").at("code").is_number_integer());
+    }
+    logins.push_back(spans);
+  }
+  return logins;
+}
+
+// A login of a device request, a failed poll and a successful one
+std::string login() {
+  LoginMetrics metrics;
+  LoginTrace trace;
+  metrics.set_trace(&trace);
+  {
+    PhaseTimer device(&metrics, "device_ms");
+    device.client();
+    device.attribute("url.full", "https://provider.com/device");
+  }
+  for (int poll = 1; poll <= 2; ++poll) {
+    PhaseTimer request(&metrics, "", "token");
+    request.client();
+    if (poll == 1) request.fail();
+  }
+  return trace.resource_spans("login", {{"pam.rc", "0"}}, false);
+}
+
+// Reads the lines sent to a Unix socket until expected logins arrived or
+// nothing is sent for a second
+class CollectorStub {
+ public:
+  explicit CollectorStub(size_t expected) : expected(expected), logins(0) {
+    unlink(COLLECTOR_SOCKET);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), COLLECTOR_SOCKET);
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    bind(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address));
+    listen(fd, 4);
+    thread = std::thread(&CollectorStub::run, this);
+  }
+  ~CollectorStub() {
+    if (thread.joinable()) thread.join();
+    close(fd);
+    unlink(COLLECTOR_SOCKET);
+  }
+  std::vector<std::string> wait() {
+    thread.join();
+    return lines;
+  }
+
+ private:
+  void run() {
+    while (logins < expected) {
+      int connection = accept(fd, NULL, NULL);
+      if (connection == -1) return;
+      std::string data;
+      char buffer[4096];
+      ssize_t n;
+      while ((n = read(connection, buffer, sizeof(buffer))) > 0) {
+        data.append(buffer, n);
+      }
+      close(connection);
+      size_t start = 0, end;
+      while ((end = data.find('\n', start)) != std::string::npos) {
+        lines.push_back(data.substr(start, end - start));
+        logins += json::parse(lines.back()).at("resourceSpans").size();
+        start = end + 1;
+      }
+    }
+  }
+
+  size_t expected, logins;
+  int fd;
+  std::vector<std::string> lines;
+  std::thread thread;
+};
+
+TEST(TraceTest, Ids) {
+  LoginTrace trace;
+  EXPECT_TRUE(is_hex(trace.trace_id(), 32));
+  EXPECT_NE(LoginTrace().trace_id(), trace.trace_id());
+  std::string span_id = LoginTrace::new_span_id();
+  EXPECT_TRUE(is_hex(span_id, 16));
+  EXPECT_NE(LoginTrace::new_span_id(), span_id);
+  EXPECT_EQ("00-" + trace.trace_id() + "-" + span_id + "-01",
+            trace.traceparent(span_id));
+}
+
+TEST(TraceTest, PhaseSpans) {
+  // Phases of an untraced login have no spans
+  LoginMetrics untraced;
+  PhaseTimer timer(&untraced, "device_ms");
+  EXPECT_EQ("", timer.client());
+  timer.stop();
+  EXPECT_EQ(1u, untraced.snapshot().size());
+
+  std::vector<json> logins = validate_request(
+      "{\"resourceSpans\":[" + login() + "]}");
+  ASSERT_EQ(1u, logins.size());
+  json &spans = logins[0];
+  ASSERT_EQ(4u, spans.size());
+  EXPECT_EQ("login", spans[0].at("name"));
+  EXPECT_EQ(1, spans[0].at("kind"));
+  EXPECT_EQ("0", attribute(spans[0].at("attributes"), "pam.rc"));
+  EXPECT_EQ("device", spans[1].at("name"));
+  EXPECT_EQ(3, spans[1].at("kind"));
+  EXPECT_EQ("https://provider.com/device",
+            attribute(spans[1].at("attributes"), "url.full"));
+  EXPECT_EQ("token", spans[2].at("name"));
+  EXPECT_EQ(2, spans[2].at("status").at("code"));
+  EXPECT_EQ(0, spans[3].at("status").at("code"));
+}
+
+TEST(TraceTest, PhaseTimerTraceparent) {
+  LoginMetrics metrics;
+  LoginTrace trace;
+  metrics.set_trace(&trace);
+  PhaseTimer timer(&metrics, "", "token");
+  std::string traceparent = timer.client();
+  EXPECT_EQ(55u, traceparent.length());
+  EXPECT_EQ(0u, traceparent.find("00-" + trace.trace_id() + "-"));
+  timer.stop();
+  // Traced only phases are not part of the record
+  EXPECT_EQ("", metrics.record());
+  json spans = json::parse(trace.resource_spans("login", {}, true))
+                   .at("scopeSpans")[0]
+                   .at("spans");
+  EXPECT_EQ(2, spans[0].at("status").at("code"));
+  EXPECT_EQ(traceparent, trace.traceparent(spans[1].at("spanId")));
+}
+
+TEST(TraceTest, FileExport) {
+  unlink(SPOOL_FILE);
+  {
+    SpanExporter exporter(SPOOL_FILE);
+    EXPECT_TRUE(exporter.enqueue(login()));
+    EXPECT_TRUE(exporter.enqueue(login()));
+    exporter.flush();
+    EXPECT_TRUE(exporter.enqueue(login()));
+  }
+  std::ifstream spool(SPOOL_FILE);
+  std::string line;
+  size_t logins = 0;
+  while (std::getline(spool, line)) {
+    logins += validate_request(line).size();
+  }
+  EXPECT_EQ(3u, logins);
+  unlink(SPOOL_FILE);
+}
+
+TEST(TraceTest, CollectorExport) {
+  CollectorStub collector(3);
+  SpanExporter exporter("unix:" COLLECTOR_SOCKET);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(exporter.enqueue(login()));
+  }
+  exporter.flush();
+  std::vector<std::string> lines = collector.wait();
+  ASSERT_FALSE(lines.empty());
+  std::vector<std::string> trace_ids;
+  for (auto &line : lines) {
+    for (auto &spans : validate_request(line)) {
+      trace_ids.push_back(spans[0].at("traceId"));
+    }
+  }
+  ASSERT_EQ(3u, trace_ids.size());
+  EXPECT_NE(trace_ids[0], trace_ids[1]);
+  EXPECT_NE(trace_ids[1], trace_ids[2]);
+}
+
+TEST(TraceTest, CollectorDown) {
+  unlink(COLLECTOR_SOCKET);
+  SpanExporter exporter("unix:" COLLECTOR_SOCKET);
+  EXPECT_TRUE(exporter.enqueue(login()));
+  // Dropped after a failed write, never blocks
+  exporter.flush();
+}
+
+}  // namespace